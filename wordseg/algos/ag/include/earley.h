@@ -8,6 +8,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -21,11 +22,17 @@ extern int debug;
 //!  for CFGs.  It is used to filter the possible categories and
 //!  their locations in order to speed the bottom-up probabilistic
 //!  CKY parser that follows.
+//!
+//!  The grammar is compiled to the integer symbol ids of the CKY
+//!  parser, and the categories found complete in each cell of the
+//!  chart are stored as a bitset over these ids, so the CKY parser
+//!  tests a bit rather than looking up a set.  The parser keeps its
+//!  buffers from one sentence to the next.
 //
 struct earley {
 
   typedef unsigned int U;
-  typedef std::set<U> sU;
+  typedef std::vector<U> Us;
 
   typedef symbol S;
   typedef std::vector<S> Ss;
@@ -35,9 +42,29 @@ struct earley {
   typedef std::unordered_map<S,Rps> S_Rps;
   typedef std::set<S> sS;
   typedef std::unordered_map<S,sS> S_sS;
-  typedef const sS* sSp;
-  typedef std::vector<sSp> sSps;
-  typedef std::vector<sS> U_sS;
+  typedef std::unordered_map<S,U> S_U;
+
+  typedef std::uint64_t word_type;   //!< a word of a bitset
+  typedef std::vector<word_type> words_type;
+
+  static const U noid = U(-1);
+  static const U wordbits = 64;
+
+  //! test() returns true if bit id is set in the bitset bits
+  //
+  static bool test(const word_type* bits, U id) {
+    return (bits[id / wordbits] >> (id % wordbits)) & 1;
+  }
+
+  //! set() sets bit id in the bitset bits, returning its old value
+  //
+  static bool set(word_type* bits, U id) {
+    word_type& word = bits[id / wordbits];
+    const word_type mask = word_type(1) << (id % wordbits);
+    const bool old = word & mask;
+    word |= mask;
+    return old;
+  }
 
   //! grammar{} holds the grammar in a format that is useful for faster parsing
   //
@@ -54,168 +81,220 @@ struct earley {
 	parent_ruleps[rule.first].push_back(&rule);
     }  // earley::grammar::add_rule()
 
-  };  //  earley::grammar{}
+    //! The compiled grammar.  The right hand sides of the rules are
+    //! concatenated in rhs, each followed by noid, so that a position
+    //! in rhs is a dotted rule whose next symbol is rhs[pos] (noid if
+    //! the rule is complete) and whose parent is lhs[pos].
+    //
+    U nsymbols;        //!< number of symbol ids
+    Us rhs;            //!< symbol after the dot of each dotted rule
+    Us lhs;            //!< parent of each dotted rule
+    Us rules_begin;    //!< the rules of parent p start at rules[rules_begin[p]..rules_begin[p+1]]
+    Us rules;          //!< position in rhs of the start of each rule
+    Us pret_begin;     //!< the preterminals of terminal t are pret[pret_begin[t]..pret_begin[t+1]]
+    Us pret;           //!< preterminals of each terminal
 
-  struct A {      //!< Active edge
-    U index;      //!< number of children found so far
-    U left;       //!< location of left edge in string
-    Rp rulep;     //!< pointer to rule being expanded
-    A(U index, U left, Rp rulep) : index(index), left(left), rulep(rulep) { }
+    //! compile() compiles the rules added so far, numbering the
+    //! symbols with symbol_id (which must contain all the symbols
+    //! of the rules).
+    //
+    void compile(const S_U& symbol_id, U nsymbols0) {
+      nsymbols = nsymbols0;
+      rhs.clear();
+      lhs.clear();
+      std::vector<Us> parent_rules(nsymbols);
+      cforeach (S_Rps, it, parent_ruleps) {
+	U parent = afind(symbol_id, it->first);
+	cforeach (Rps, rit, it->second) {
+	  parent_rules[parent].push_back(rhs.size());
+	  cforeach (Ss, cit, (*rit)->second) {
+	    rhs.push_back(afind(symbol_id, *cit));
+	    lhs.push_back(parent);
+	  }
+	  rhs.push_back(noid);
+	  lhs.push_back(parent);
+	}
+      }
+      flatten(parent_rules, rules_begin, rules);
 
-    bool operator= (const A& a) const {
-      return index == a.index && left == a.left && rulep == a.rulep;
-    }
+      std::vector<Us> terminal_pret(nsymbols);
+      cforeach (S_sS, it, terminal_preterminals) {
+	U terminal = afind(symbol_id, it->first);
+	cforeach (sS, pit, it->second)
+	  terminal_pret[terminal].push_back(afind(symbol_id, *pit));
+      }
+      flatten(terminal_pret, pret_begin, pret);
+    }  // earley::grammar::compile()
 
-    bool operator< (const A& a) const {
-      return index < a.index
-	|| (index == a.index
-	    && (left < a.left
-		|| (left == a.left && rulep < a.rulep)));
+    static void flatten(const std::vector<Us>& uss, Us& begin, Us& flat) {
+      begin.clear();
+      flat.clear();
+      cforeach (std::vector<Us>, it, uss) {
+	begin.push_back(flat.size());
+	flat.insert(flat.end(), it->begin(), it->end());
+      }
+      begin.push_back(flat.size());
+    }  // earley::grammar::flatten()
+
+    //! is_preterminal() returns true if there is a rule cat --> terminal
+    //
+    bool is_preterminal(U terminal, U cat) const {
+      if (terminal == noid)
+	return false;
+      for (U i = pret_begin[terminal]; i < pret_begin[terminal+1]; ++i)
+	if (pret[i] == cat)
+	  return true;
+      return false;
     }
+
+  };  //  earley::grammar{}
+
+  //! An item{} is a dotted rule (a position in grammar::rhs) started
+  //! at origin.  The items of a chart position waiting for the same
+  //! symbol are chained by their next_waiting index.
+  //
+  struct item {
+    U pos;
+    U origin;
+    U next_waiting;
+    item(U pos, U origin, U next_waiting)
+      : pos(pos), origin(origin), next_waiting(next_waiting) { }
   };
 
-  typedef std::set<A> sA;
-  typedef std::pair<sA,sU> sAsU;
-  typedef std::unordered_map<S,sAsU> S_sAsU;
-  typedef std::vector<S_sAsU> U_S_sAsU;
+  typedef std::vector<item> items_type;
+
+  U n;                   //!< length of the last parsed sentence
+  U nwords;              //!< number of words of the bitset of a cell
+  words_type completes;  //!< bitset of the complete categories of each cell
+  items_type items;      //!< the items of all the chart positions
+  Us set_begin;          //!< items[set_begin[j]..] are the items ending at j
+  Us waiting;            //!< first item ending at j waiting for symbol s, at j*nsymbols+s
+  words_type seen;       //!< bitset of the (dotted rule, origin) of the items ending at j
+  words_type predicted;  //!< bitset of the symbols predicted at the current position
 
-  const grammar& g;         //!< grammar
-  const Ss& terminals;      //!< terminals
-  sSps preterminals;        //!< preterminals
-  U_S_sAsU ichart;          //!< inside chart
-  U_sS& completes;          //!< complete edges
+  earley() : n(0), nwords(0) { }
 
   static U index(U i, U j) { return j*(j-1)/2+i; }
   static U ncells(U n) { return n*(n+1)/2; }
 
-  void inside(U left, U right, Rp rp, U i) {
-    // TRACE4(left, right, *rp, i);
-    if (i == rp->second.size())
-      icomplete(left, right, rp->first);
-    else if (right < terminals.size()) {
-      S child = rp->second[i];
-      std::pair<S_sAsU::iterator,bool> citb
-	= ichart[right].insert(S_sAsU::value_type(child,sAsU()));
-      sA& as = citb.first->second.first;
-      sU& cs = citb.first->second.second;
-      // TRACE2(citb.second, as.count(A(i,left,rp)));
-      if (!as.insert(A(i,left,rp)).second)
-	return;  // this active edge is already in chart
-      if (terminals[right] == child)
-	inside(left, right+1, rp, i+1);
-      if (citb.second) { // new search
-	const sSp preterminals_right = preterminals[right];
-	if (preterminals_right != NULL && preterminals_right->count(child)) {
-	  completes[index(right,right+1)].insert(child);
-	  cs.insert(right+1);
-	  inside(left, right+1, rp, i+1);
-	}
-	inside(right, child);
-      }
-      else {  // already searched for
-	cforeach (sU, cit, cs)
-	  inside(left, *cit, rp, i+1);
-      }
-    }
-  }  // earley::inside()
-
-  void icomplete(U left, U right, S cat) {
-    // TRACE3(left, right, cat);
-    sAsU& ascs = ichart[left][cat];
-    sA& as = ascs.first;
-    sU& cs = ascs.second;
-    if (!cs.insert(right).second)
-      return;
-    cforeach (sA, it, as) {
-      assert(it->rulep->second[it->index] == cat);
-      inside(it->left, right, it->rulep, it->index+1);
-    }
-    completes[index(left,right)].insert(cat);
+  //! cell() returns the bitset of the categories complete in left-right
+  //
+  const word_type* cell(U left, U right) const {
+    return &completes[index(left, right)*nwords];
   }
 
-  void inside(U left, S cat) {
-    // TRACE2(left, cat);
-    S_Rps::const_iterator prit = g.parent_ruleps.find(cat);
-    if (prit != g.parent_ruleps.end()) {
-      const Rps& ruleps = prit->second;
-      cforeach (Rps, it, ruleps)
-	inside(left, left, *it, 0);
-    }
+  bool complete(U left, U right, U cat) const {
+    return test(cell(left, right), cat);
   }
 
-  bool complete(U left, U right, S cat) const {
-    U i = index(left, right);
-    assert(i < completes.size());
-    return completes[i].count(cat);
-  }
+  //! parse() computes the categories that span each substring of
+  //! terminals (given by their symbol ids, or noid) and which are
+  //! predicted top-down from start at their left edge
+  //
+  void parse(const grammar& g, U start, const Us& terminals) {
+    n = terminals.size();
+    nwords = (g.nsymbols + wordbits - 1) / wordbits;
+    const U npos = g.rhs.size();
+    completes.assign(ncells(n) * nwords, 0);
+    items.clear();
+    set_begin.assign(n + 2, 0);
+    waiting.assign((n + 1) * g.nsymbols, noid);
+    seen.assign(((npos*(n+1) + wordbits - 1) / wordbits), 0);
+    predicted.resize(nwords);
 
-  earley(const grammar& g, S start, const Ss& terminals, U_sS& completes)
-    : g(g), terminals(terminals), preterminals(terminals.size()),
-      ichart(terminals.size()), completes(completes)
-  {
-    completes.clear();
-    completes.resize(ncells(terminals.size()));
-    // TRACE1(terminals);
-    for (U i = 0; i < terminals.size(); ++i) {
-      S_sS::const_iterator it = g.terminal_preterminals.find(terminals[i]);
-      if (it == g.terminal_preterminals.end())
-	preterminals[i] = NULL;
-      else
-	preterminals[i] = &it->second;
-    }
+    if (start == noid)
+      return;
 
-    if (debug >= 50000)
-      std::cerr << "\n# earley terminals = " << terminals << std::endl;
-
-    if (debug >= 70000) {
-      std::cerr << "# earley preterminals:";
-      for (U i = 0; i < preterminals.size(); ++i)
-        if (preterminals[i])
-	  std::cerr << " " << *preterminals[i];
-	else
-	  std::cerr << " ()";
-      std::cerr << std::endl;
-    }
+    for (U j = 0; j <= n; ++j) {
+      set_begin[j] = items.size();
+      std::fill(predicted.begin(), predicted.end(), 0);
+      std::fill(seen.begin(), seen.end(), 0);
+      const U terminal = j < n ? terminals[j] : noid;
 
-    { // here is where we actually parse
+      if (j == 0) {
+	if (g.is_preterminal(terminal, start))
+	  set(&completes[index(0, 1)*nwords], start);
+	predict(g, start, 0);
+      }
+      else {
+	// scan the items of position j-1 into position j
+	for (U k = set_begin[j-1]; k < set_begin[j]; ++k) {
+	  const item it = items[k];
+	  const U next = g.rhs[it.pos];
+	  if (next == noid)
+	    continue;
+	  const U prevterminal = terminals[j-1];
+	  if (next == prevterminal || g.is_preterminal(prevterminal, next))
+	    add(g, it.pos+1, it.origin, j);
+	}
+      }
 
-      const sSp preterminals0 = preterminals[0];
-      if (preterminals0 != NULL && preterminals0->count(start)) {
-	completes[index(0,1)].insert(start);
-	std::pair<S_sAsU::iterator,bool> citb
-	  = ichart[0].insert(S_sAsU::value_type(start,sAsU()));
-	assert(citb.second);
-	sU& cs = citb.first->second.second;
-	cs.insert(1);
+      // process the items of position j, as an agenda
+      for (U k = set_begin[j]; k < items.size(); ++k) {
+	const item it = items[k];
+	const U next = g.rhs[it.pos];
+	if (next == noid) {  // complete
+	  const U parent = g.lhs[it.pos];
+	  if (set(&completes[index(it.origin, j)*nwords], parent))
+	    continue;
+	  for (U w = waiting[it.origin*g.nsymbols + parent]; w != noid; w = items[w].next_waiting)
+	    add(g, items[w].pos+1, items[w].origin, j);
+	}
+	else {
+	  if (terminal != noid && g.is_preterminal(terminal, next))
+	    set(&completes[index(j, j+1)*nwords], next);
+	  predict(g, next, j);
+	}
       }
-      inside(0, start);
     }
+    set_begin[n+1] = items.size();
 
     if (debug >= 50000)
-      for (U left = 0; left < terminals.size(); ++left)
-	for (U right = left+1; right <= terminals.size(); ++right)
-	  if (!completes[index(left,right)].empty()) {
-	    std::cerr << "# earley: left = " << left << ", right = " << right
-		      << ", completes =";
-	    cforeach (sS, it, completes[index(left,right)])
-	      std::cerr << ' ' << *it;
-	    std::cerr << std::endl;
-	  }
-
-    if (debug >= 70000)
-      for (U right = 0; right < ichart.size(); ++right)
-	cforeach (S_sAsU, it0, ichart[right]) {
-	  S cat = it0->first;
-	  const sA& as = it0->second.first;
-	  const sU& cs = it0->second.second;
-	  std::cerr << "# earley incomplete: right = " << right << ", cs = " << cs;
-	  cforeach (sA, it1, as)
-	    std::cerr << "; cat = " << cat
-		      << "; left = " << it1-> left
-		      << ", index = " << it1->index
-		      << ", rule = " << *(it1->rulep);
+      for (U left = 0; left < n; ++left)
+	for (U right = left+1; right <= n; ++right) {
+	  const word_type* bits = cell(left, right);
+	  bool empty = true;
+	  for (U w = 0; w < nwords; ++w)
+	    empty = empty && bits[w] == 0;
+	  if (empty)
+	    continue;
+	  std::cerr << "# earley: left = " << left << ", right = " << right
+		    << ", completes =";
+	  for (U s = 0; s < g.nsymbols; ++s)
+	    if (test(bits, s))
+	      std::cerr << ' ' << s;
 	  std::cerr << std::endl;
 	}
-  }
+  }  // earley::parse()
+
+private:
+
+  //! predict() adds the rules expanding cat to position j
+  //
+  void predict(const grammar& g, U cat, U j) {
+    if (set(&predicted[0], cat))
+      return;
+    for (U r = g.rules_begin[cat]; r < g.rules_begin[cat+1]; ++r)
+      add(g, g.rules[r], j, j);
+  }  // earley::predict()
+
+  //! add() adds the item (pos, origin) to position j, unless it is
+  //! already there
+  //
+  void add(const grammar& g, U pos, U origin, U j) {
+    if (set(&seen[0], origin*g.rhs.size() + pos))
+      return;
+    const U next = g.rhs[pos];
+    U next_waiting = noid;
+    if (next != noid) {
+      U& head = waiting[j*g.nsymbols + next];
+      next_waiting = head;
+      head = items.size();
+    }
+    items.push_back(item(pos, origin, next_waiting));
+  }  // earley::add()
 
 };  // earley{}
+
+const earley::U earley::noid;
+const earley::U earley::wordbits;
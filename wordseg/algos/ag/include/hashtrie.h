@@ -0,0 +1,380 @@
+// hashtrie.h
+//
+// A flat trie package for C++: the nodes of the trie are numbered,
+// and its edges are stored in a single open-addressing hash table.
+
+#ifndef HASHTRIE_H
+#define HASHTRIE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+//! A hashtrie maps from a sequence of keys to data, like trie{}, but
+//! its nodes are identified by integer ids.  The children of a node
+//! are not stored in the node: the (parent id, key) edges of the whole
+//! trie are in one hash table with linear probing, so that looking up
+//! a child is a short scan of a flat array rather than a descent in a
+//! std::map.
+//!
+//! A node keeps its id, and its data its address, until the node is
+//! erased, so that node ids can be used as keys in other tables.  The
+//! ids of erased nodes are reused by the nodes inserted later.
+//!
+//! The traversals (for_each() and operator<<) visit the children of a
+//! node in increasing key order, as trie{} does, and tolerate the
+//! insertion and erasure of the nodes not yet visited.
+//
+template <class key_type_, class data_type_, class hash_type_ = std::hash<key_type_> >
+class hashtrie {
+
+public:
+
+  typedef unsigned int id_type;
+  typedef std::vector<id_type> ids_type;
+  typedef key_type_ key_type;
+  typedef data_type_ data_type;
+  typedef hash_type_ hash_type;
+
+  static const id_type noid = id_type(-1);  //!< the id of no node
+  static const id_type root = 0;            //!< the id of the empty sequence
+
+private:
+
+  //! A node_type{} is a node of the trie.  Its children are linked by
+  //! next_sibling and prev_sibling, and the erased nodes by next_sibling.
+  //
+  struct node_type {
+    data_type data;
+    key_type key;          //!< the last key of the sequence of this node
+    id_type parent;        //!< noid for the root and the erased nodes
+    id_type first_child;
+    id_type next_sibling;
+    id_type prev_sibling;
+    std::size_t hash;      //!< hash of the (parent, key) edge
+
+    node_type()
+      : data(), key(), parent(noid), first_child(noid),
+	next_sibling(noid), prev_sibling(noid), hash(0) { }
+  };  // hashtrie::node_type{}
+
+  std::deque<node_type> nodes;  //!< the nodes, indexed by id
+  id_type free_nodes;           //!< first erased node
+  id_type nedges;               //!< number of nodes other than the root
+  ids_type slots;               //!< the hash table of the edges, noid if empty
+
+public:
+
+  hashtrie() : nodes(1), free_nodes(noid), nedges(0), slots(16, noid) { }
+
+  id_type end() const { return noid; }
+
+  data_type& data(id_type node) { return nodes[node].data; }
+  const data_type& data(id_type node) const { return nodes[node].data; }
+
+  //! key() returns the last key of the sequence of node
+  //
+  const key_type& key(id_type node) const { return nodes[node].key; }
+
+  //! size() returns the number of non-default values in the trie.
+  //
+  id_type size() const {
+    id_type s = 0;
+    for (typename std::deque<node_type>::const_iterator it = nodes.begin();
+	 it != nodes.end(); ++it)
+      if (!(it->data == data_type()))
+	++s;
+    return s;
+  }  // hashtrie::size()
+
+  //! clear() removes all the elements from a hashtrie
+  //
+  void clear() {
+    nodes.assign(1, node_type());
+    free_nodes = noid;
+    nedges = 0;
+    slots.assign(16, noid);
+  }  // hashtrie::clear()
+
+  //! find1() returns the child of node for key, or noid if there is
+  //! no such child (or if node is noid).
+  //
+  id_type find1(id_type node, const key_type& key) const {
+    if (node == noid)
+      return noid;
+    const std::size_t mask = slots.size() - 1;
+    for (std::size_t i = edge_hash(node, key) & mask; ; i = (i+1) & mask) {
+      const id_type child = slots[i];
+      if (child == noid)
+	return noid;
+      const node_type& n = nodes[child];
+      if (n.parent == node && n.key == key)
+	return child;
+    }
+  }  // hashtrie::find1()
+
+  id_type find1(const key_type& key) const {
+    return find1(root, key);
+  }  // hashtrie::find1()
+
+  //! find() returns the node of the sequence of keys from start to
+  //! finish, or noid if there is none.
+  //
+  template <class It>
+  id_type find(It start, It finish) const {
+    id_type node = root;
+    for ( ; start != finish && node != noid; ++start)
+      node = find1(node, *start);
+    return node;
+  }  // hashtrie::find()
+
+  template <class Keys>
+  id_type find(const Keys& keys) const {
+    return find(keys.begin(), keys.end());
+  }  // hashtrie::find()
+
+  //! insert() returns the node of the sequence of keys from start to
+  //! finish, inserting it and its ancestors if need be.
+  //
+  template <class It>
+  id_type insert(It start, It finish) {
+    id_type node = root;
+    for ( ; start != finish; ++start) {
+      const id_type child = find1(node, *start);
+      node = (child == noid) ? new_node(node, *start) : child;
+    }
+    return node;
+  }  // hashtrie::insert()
+
+  //! operator[]() returns a reference to the value associated with
+  //! keys.begin() to keys.end(), creating such a value if necessary.
+  //
+  template <class Keys>
+  data_type& operator[] (const Keys& keys) {
+    return nodes[insert(keys.begin(), keys.end())].data;
+  }  // hashtrie::operator[]
+
+  //! erase() deletes the value associated with start-finish, and the
+  //! nodes left without value nor children.
+  //
+  template <class It>
+  void erase(It start, It finish) {
+    id_type node = find(start, finish);
+    if (node == noid)
+      return;
+    nodes[node].data = data_type();
+    while (node != root && nodes[node].first_child == noid
+	   && nodes[node].data == data_type()) {
+      const id_type parent = nodes[node].parent;
+      delete_node(node);
+      node = parent;
+    }
+  }  // hashtrie::erase()
+
+  template <class Keys>
+  void erase(const Keys& keys) {
+    erase(keys.begin(), keys.end());
+  }  // hashtrie::erase()
+
+  //! children() sets ids to the children of node, in increasing key order
+  //
+  void children(id_type node, ids_type& ids) const {
+    ids.clear();
+    for (id_type child = nodes[node].first_child; child != noid;
+	 child = nodes[child].next_sibling)
+      ids.push_back(child);
+    std::sort(ids.begin(), ids.end(), key_less(*this));
+  }  // hashtrie::children()
+
+  //! for_each() does a top-down traversal of the trie, calling
+  //! p(keys, data) at each non-default value of data
+  //
+  template <typename Proc>
+  void for_each(Proc p) {
+    std::vector<key_type> keys;
+    for_each_helper(root, p, keys);
+  }  // hashtrie::for_each()
+
+  template <typename Proc>
+  void for_each(Proc p) const {
+    std::vector<key_type> keys;
+    for_each_helper(root, p, keys);
+  }  // hashtrie::for_each()
+
+  //! write() writes the subtrie of node, in the format of trie{}
+  //
+  std::ostream& write(std::ostream& os, id_type node = root) const {
+    os << '(' << nodes[node].data;
+    for (id_type child = next_child(node, NULL); child != noid;
+	 child = next_child(node, &nodes[child].key))
+      write(os << ' ' << nodes[child].key << ' ', child);
+    return os << ')';
+  }  // hashtrie::write()
+
+private:
+
+  struct key_less {
+    const hashtrie& t;
+    key_less(const hashtrie& t) : t(t) { }
+    bool operator() (id_type n0, id_type n1) const {
+      return std::less<key_type>()(t.nodes[n0].key, t.nodes[n1].key);
+    }
+  };  // hashtrie::key_less{}
+
+  //! edge_hash() mixes the hash of key with parent (splitmix64 finalizer),
+  //! since the hashes of keys may have few significant low bits
+  //
+  static std::size_t edge_hash(id_type parent, const key_type& key) {
+    std::uint64_t h = std::uint64_t(hash_type()(key))
+      + 0x9e3779b97f4a7c15ULL * (std::uint64_t(parent) + 1);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return std::size_t(h ^ (h >> 31));
+  }  // hashtrie::edge_hash()
+
+  //! next_child() returns the child of node with the smallest key
+  //! greater than *after (of any key if after is NULL), or noid.  The
+  //! children are scanned anew at each call, so that the traversals
+  //! see the nodes inserted or erased meanwhile.
+  //
+  id_type next_child(id_type node, const key_type* after) const {
+    std::less<key_type> less;
+    id_type next = noid;
+    for (id_type c = nodes[node].first_child; c != noid; c = nodes[c].next_sibling)
+      if ((after == NULL || less(*after, nodes[c].key))
+	  && (next == noid || less(nodes[c].key, nodes[next].key)))
+	next = c;
+    return next;
+  }  // hashtrie::next_child()
+
+  template <typename Proc, typename Keys>
+  void for_each_helper(id_type node, Proc& p, Keys& keys) {
+    if (!(nodes[node].data == data_type()))
+      p(keys, nodes[node].data);
+    for (id_type child = next_child(node, NULL); child != noid; ) {
+      keys.push_back(nodes[child].key);
+      for_each_helper(child, p, keys);
+      child = next_child(node, &keys.back());
+      keys.pop_back();
+    }
+  }  // hashtrie::for_each_helper()
+
+  template <typename Proc, typename Keys>
+  void for_each_helper(id_type node, Proc& p, Keys& keys) const {
+    if (!(nodes[node].data == data_type()))
+      p(keys, nodes[node].data);
+    for (id_type child = next_child(node, NULL); child != noid; ) {
+      keys.push_back(nodes[child].key);
+      for_each_helper(child, p, keys);
+      child = next_child(node, &keys.back());
+      keys.pop_back();
+    }
+  }  // hashtrie::for_each_helper()
+
+  //! place() inserts the edge of node in the hash table
+  //
+  void place(id_type node) {
+    const std::size_t mask = slots.size() - 1;
+    std::size_t i = nodes[node].hash & mask;
+    while (slots[i] != noid)
+      i = (i+1) & mask;
+    slots[i] = node;
+  }  // hashtrie::place()
+
+  //! rehash() moves the edges to a hash table of nslots slots
+  //
+  void rehash(std::size_t nslots) {
+    slots.assign(nslots, noid);
+    for (id_type node = 0; node < nodes.size(); ++node)
+      if (nodes[node].parent != noid)
+	place(node);
+  }  // hashtrie::rehash()
+
+  //! new_node() inserts a child of parent for key, keeping the hash
+  //! table at most half full
+  //
+  id_type new_node(id_type parent, const key_type& key) {
+    if (2*(std::size_t(nedges)+1) > slots.size())
+      rehash(2*slots.size());
+    id_type node;
+    if (free_nodes != noid) {
+      node = free_nodes;
+      free_nodes = nodes[node].next_sibling;
+    }
+    else {
+      node = nodes.size();
+      nodes.push_back(node_type());
+    }
+    node_type& n = nodes[node];
+    n.key = key;
+    n.parent = parent;
+    n.first_child = noid;
+    n.prev_sibling = noid;
+    n.next_sibling = nodes[parent].first_child;
+    if (n.next_sibling != noid)
+      nodes[n.next_sibling].prev_sibling = node;
+    nodes[parent].first_child = node;
+    n.hash = edge_hash(parent, key);
+    place(node);
+    ++nedges;
+    return node;
+  }  // hashtrie::new_node()
+
+  //! delete_node() removes the childless node from the trie.  Its slot
+  //! in the hash table is refilled by shifting back the following
+  //! edges of its probe sequence, so that no tombstones are needed.
+  //
+  void delete_node(id_type node) {
+    node_type& n = nodes[node];
+    assert(n.parent != noid && n.first_child == noid);
+    if (n.prev_sibling != noid)
+      nodes[n.prev_sibling].next_sibling = n.next_sibling;
+    else
+      nodes[n.parent].first_child = n.next_sibling;
+    if (n.next_sibling != noid)
+      nodes[n.next_sibling].prev_sibling = n.prev_sibling;
+
+    const std::size_t mask = slots.size() - 1;
+    std::size_t i = n.hash & mask;
+    while (slots[i] != node)
+      i = (i+1) & mask;
+    for (std::size_t j = (i+1) & mask; slots[j] != noid; j = (j+1) & mask) {
+      const std::size_t home = nodes[slots[j]].hash & mask;
+      // the edge in j can fill the hole in i unless its home slot is
+      // cyclically in (i, j]
+      if (j > i ? (home <= i || home > j) : (home <= i && home > j)) {
+	slots[i] = slots[j];
+	i = j;
+      }
+    }
+    slots[i] = noid;
+
+    n.data = data_type();
+    n.key = key_type();
+    n.parent = noid;
+    n.prev_sibling = noid;
+    n.next_sibling = free_nodes;
+    free_nodes = node;
+    --nedges;
+  }  // hashtrie::delete_node()
+
+};  // hashtrie{}
+
+template <class key_type, class data_type, class hash_type>
+const typename hashtrie<key_type,data_type,hash_type>::id_type
+hashtrie<key_type,data_type,hash_type>::noid;
+
+template <class key_type, class data_type, class hash_type>
+const typename hashtrie<key_type,data_type,hash_type>::id_type
+hashtrie<key_type,data_type,hash_type>::root;
+
+template <class key_type, class data_type, class hash_type>
+std::ostream& operator<< (std::ostream& os, const hashtrie<key_type,data_type,hash_type>& t) {
+  return t.write(os);
+}  // operator<<
+
+#endif // HASHTRIE_H
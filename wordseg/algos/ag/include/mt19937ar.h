@@ -6,6 +6,56 @@
 #ifndef MT19937AR_H
 #define MT19937AR_H
 
+/* mt19937ar_type is a Mersenne twister generator holding its own state,
+   so that concurrent samplers (e.g. several chains, each with its own
+   generator) do not share a stream of random numbers.  Its operator()
+   returns a random number on [0,1) with 53-bit resolution, so it can be
+   passed as a uniform random number generator to the slice samplers. */
+class mt19937ar_type {
+public:
+  enum { N = 624 };
+
+  mt19937ar_type() : mti(N+1) { }
+  explicit mt19937ar_type(unsigned long s) { init_genrand(s); }
+
+  /* initializes mt[N] with a seed */
+  void init_genrand(unsigned long s);
+
+  /* initialize by an array with array-length */
+  void init_by_array(unsigned long init_key[], int key_length);
+
+  /* generates a random number on [0,0xffffffff]-interval */
+  unsigned long genrand_int32(void);
+
+  /* generates a random number on [0,0x7fffffff]-interval */
+  long genrand_int31(void) { return (long)(genrand_int32()>>1); }
+
+  /* generates a random number on [0,1]-real-interval */
+  double genrand_real1(void) { return genrand_int32()*(1.0/4294967295.0); }
+
+  /* generates a random number on [0,1)-real-interval */
+  double genrand_real2(void) { return genrand_int32()*(1.0/4294967296.0); }
+
+  /* generates a random number on (0,1)-real-interval */
+  double genrand_real3(void) {
+    return (((double) genrand_int32()) + 0.5)*(1.0/4294967296.0);
+  }
+
+  /* generates a random number on [0,1) with 53-bit resolution*/
+  double genrand_res53(void) {
+    unsigned long a=genrand_int32()>>5, b=genrand_int32()>>6;
+    return(a*67108864.0+b)*(1.0/9007199254740992.0);
+  }
+
+  double operator() () { return genrand_res53(); }
+
+private:
+  unsigned long mt[N]; /* the array for the state vector  */
+  int mti;             /* mti==N+1 means mt[N] is not initialized */
+};
+
+/* The functions below draw from a default generator, one per thread. */
+
 /*
 #ifdef __cplusplus
 extern "C" {
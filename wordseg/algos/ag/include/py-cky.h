@@ -11,6 +11,7 @@
 #include <cstdlib>
 // #include <ext/hash_map>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <set>
 #include <sstream>
@@ -24,7 +25,7 @@
 #include "slice-sampler.h"
 #include "sym.h"
 #include "xtree.h"
-#include "trie.h"
+#include "hashtrie.h"
 #include "utility.h"
 
 extern int debug;
@@ -54,15 +55,7 @@ extern int debug;
 inline float power(float x, float y) { return y == 1 ? x : powf(x, y); }
 inline double power(double x, double y) { return y == 1 ? x : pow(x, y); }
 
-#ifndef QUADPREC
-  typedef double F;
-#else
-  #include "quadmath.h"
-  typedef __float128 F;
-  inline __float128 power(__float128 x, __float128 y) { return y == 1 ? x : pow(double(x), double(y)); }
-#endif
-
-// inline long double power(long double x, long double y) { return powl(x, y); }
+typedef double F;
 
 typedef symbol S;
 typedef std::vector<S> Ss;
@@ -126,10 +119,6 @@ std::istream& operator>> (std::istream& is,
   return is;
 }
 
-// inline F random1() { return rand()/(RAND_MAX+1.0); }
-inline F random1() { return mt_genrand_res53(); }
-
-
 //! A pycfg_type is a CKY parser for a py-cfg
 //
 struct pycfg_type {
@@ -137,7 +126,8 @@ struct pycfg_type {
   pycfg_type()
     : estimate_theta_flag(false), predictive_parse_filter(false),
       default_weight(1), default_pya(1e-1), default_pyb(1e3),
-      pya_beta_a(0), pya_beta_b(0), pyb_gamma_s(0), pyb_gamma_c(0) { }
+      pya_beta_a(0), pya_beta_b(0), pyb_gamma_s(0), pyb_gamma_c(0),
+      nserials(0), nrules(0), stamp(0) { }
 
   typedef unsigned int U;
   typedef std::pair<U,U> UU;
@@ -148,19 +138,22 @@ struct pycfg_type {
 
   typedef std::unordered_map<S,S_F> S_S_F;
 
-  typedef trie<S, S_F> St_S_F;
-  typedef St_S_F::const_iterator Stit;
+  typedef hashtrie<S, S_F> St_S_F;
 
   typedef catcounttree_type tree;
 
-  typedef std::set<tree*> sT;
+  typedef std::set<tree*, tree::serial_less> sT;
 
-  typedef trie<S,sT> St_sT;
+  typedef hashtrie<S,sT> St_sT;
 
   typedef std::vector<tree*> Ts;
 
   typedef std::map<S,Ts> S_Ts;
 
+  typedef std::vector<U> Us;
+  typedef std::vector<UU> UUs;
+  typedef std::unordered_map<S,U> S_Id;
+
   //! If estimate_theta_flag is true, then we estimate the generator
   //! rule weights using a Dirichlet prior
   //
@@ -231,6 +224,17 @@ struct pycfg_type {
   S_F parent_pya;  //!< pya value for parent
   S_F parent_pyb;  //!< pyb value for parent
 
+  //! nserials counts the PY tables created, and numbers the trees
+  //! inserted in terms_pytrees (see catcounttree_type::serial)
+  //
+  unsigned long nserials;
+
+  //! rng is the random number generator of the chain this grammar is
+  //! sampled by.  It is used to resample pya and pyb, and is passed
+  //! to the parsers sampling trees from this grammar.
+  //
+  mt19937ar_type rng;
+
   //! get_pya() returns the value of pya for this parent
   //
   F get_pya(S parent) const {
@@ -251,6 +255,7 @@ struct pycfg_type {
     else // pya == default_pya
       if (it != parent_pya.end())
 	parent_pya.erase(it);
+    touch(parent);
     return old_pya;
   }  // pycfg_type::set_pya()
 
@@ -302,11 +307,11 @@ struct pycfg_type {
 	return dfind(it->second, parent);
     }
     else {  // rhs.size() > 1
-      Stit it = rhs_parent_weight.find(rhs);
-      if (it == rhs_parent_weight.end())
+      U node = rhs_parent_weight.find(rhs);
+      if (node == rhs_parent_weight.end())
 	return 0;
       else
-	return dfind(it->data, parent);
+	return dfind(rhs_parent_weight.data(node), parent);
     }
   }  // pycfg_type::rule_weight()
 
@@ -322,22 +327,22 @@ struct pycfg_type {
     return ruleweight/parentweight;
   }  // pycfg_type::rule_prob()
 
-  //! tree_prob() returns the probability of the tree under the current
-  //! model
+  //! tree_logprob() returns the log probability of the tree under the
+  //! current model
   //
-  F tree_prob(const tree* tp) const {
+  F tree_logprob(const tree* tp) const {
     if (tp->children.empty())
-      return 1;
+      return 0;
     F pya = get_pya(tp->cat);
     if (pya == 1) { // no cache
-      F prob = 1;
+      F logprob = 0;
       Ss children;
       cforeach(tree::ptrs_type, it, tp->children) {
 	children.push_back((*it)->cat);
-	prob *= tree_prob(*it);
+	logprob += tree_logprob(*it);
       }
-      prob *= rule_prob(tp->cat, children);
-      return prob;
+      logprob += log(rule_prob(tp->cat, children));
+      return logprob;
     }
     F pyb = get_pyb(tp->cat);
     U pym = dfind(parent_pym, tp->cat);
@@ -347,24 +352,24 @@ struct pycfg_type {
       assert(pym > 0);
       F prob = (tp->count - pya)/(pyn + pyb);
       assert(finite(prob)); assert(prob > 0); assert(prob <= 1);
-      return prob;
+      return log(prob);
     }
     // new node
     F prob = (pym * pya + pyb)/(pyn + pyb);
     assert(finite(prob)); assert(prob > 0); assert(prob <= 1);
+    F logprob = log(prob);
     Ss children;
     cforeach(tree::ptrs_type, it, tp->children) {
       children.push_back((*it)->cat);
-      prob *= tree_prob(*it);
+      logprob += tree_logprob(*it);
     }
-    prob *= rule_prob(tp->cat, children);
-    if (prob < 0)
-      std::cerr << "## pycfg_type::tree_prob(" << *tp << ") = "
-		<< prob << std::endl;
-    assert(finite(prob)); assert(prob <= 1); assert(prob >= 0);
-    // assert(prob > 0);
-    return prob;
-  }  // pycfg_type::tree_prob()
+    logprob += log(rule_prob(tp->cat, children));
+    if (logprob > 0)
+      std::cerr << "## pycfg_type::tree_logprob(" << *tp << ") = "
+		<< logprob << std::endl;
+    assert(logprob <= 0);
+    return logprob;
+  }  // pycfg_type::tree_logprob()
 
   //! incrrule() increments the weight of the rule parent --> rhs,
   //! returning the probability of this rule under the old grammar.
@@ -373,6 +378,8 @@ struct pycfg_type {
   F incrrule(S parent, const rhs_type& rhs, F weight = 1) {
     assert(!rhs.empty());
     assert(weight >= 0);
+    if (weight != 0)
+      touch(parent);
     F& parentweight = parent_weight[parent];
     F parentweight0 = parentweight;
     F rhsweight0;
@@ -400,6 +407,8 @@ struct pycfg_type {
   F decrrule(S parent, const rhs_type& rhs, F weight = 1) {
     assert(weight >= 0);
     assert(!rhs.empty());
+    if (weight != 0)
+      touch(parent);
     F rhsweight;
     F parentweight = (parent_weight[parent] -= weight);
     assert(parentweight >= 0);
@@ -429,38 +438,40 @@ struct pycfg_type {
 
   //! incrtree() increments the cache for tp, increments
   //! the rules if the cache count is appropriate, and returns
-  //! the probability of this tree under the original model.
+  //! the log probability of this tree under the original model.
   //
   F incrtree(tree* tp, U weight = 1) {
     if (tp->children.empty())
-      return 1;  // terminal node
+      return 0;  // terminal node
     assert(weight >= 0);
     F pya = get_pya(tp->cat);    // PY cache statistics
     F pyb = get_pyb(tp->cat);
     if (pya == 1) { // don't table this category
-      F prob = 1;
+      F logprob = 0;
       {
 	Ss children;
 	cforeach (tree::ptrs_type, it, tp->children)
 	  children.push_back((*it)->cat);
-	prob *= incrrule(tp->cat, children, estimate_theta_flag*weight);
+	logprob += log(incrrule(tp->cat, children, estimate_theta_flag*weight));
       }
       cforeach (tree::ptrs_type, it, tp->children)
-	prob *= incrtree(*it, weight);
-      return prob;
+	logprob += incrtree(*it, weight);
+      return logprob;
     }
-    else if (tp->count > 0) {  // old PY table entry
+    touch(tp->cat);
+    if (tp->count > 0) {  // old PY table entry
       U& pyn = parent_pyn[tp->cat];
       F prob = (tp->count - pya)/(pyn + pyb);
       assert(finite(prob)); assert(prob > 0); assert(prob <= 1);
       tp->count += weight;              // increment entry count
       pyn += weight;                    // increment PY count
-      return prob;
+      return log(prob);
     }
     else { // new PY table entry
       {
 	Ss terms;
 	tp->terminals(terms);
+	tp->serial = ++nserials;
 	bool inserted ATTRIBUTE_UNUSED = terms_pytrees[terms].insert(tp).second;
 	assert(inserted);
       }
@@ -471,41 +482,43 @@ struct pycfg_type {
       tp->count += weight;              // increment count
       pym += 1;                         // one more PY table entry
       pyn += weight;                    // increment PY count
+      F logprob = log(prob);
       {
 	Ss children;
 	cforeach (tree::ptrs_type, it, tp->children)
 	  children.push_back((*it)->cat);
-	prob *= incrrule(tp->cat, children, estimate_theta_flag*weight);
+	logprob += log(incrrule(tp->cat, children, estimate_theta_flag*weight));
       }
       cforeach (tree::ptrs_type, it, tp->children)
-	prob *= incrtree(*it, weight);
-      return prob;
+	logprob += incrtree(*it, weight);
+      return logprob;
     }
   }  // pycfg_type::incrtree()
 
   //! decrtree() decrements the cache for tp, decrements
   //! the rules if the cache count is appropriate, and returns
-  //! the probability of this tree under the new model.
+  //! the log probability of this tree under the new model.
   //
   F decrtree(tree* tp, U weight = 1) {
     if (tp->children.empty())
-      return 1;  // terminal node
+      return 0;  // terminal node
     F pya = get_pya(tp->cat);    // PY cache statistics
     if (pya == 1) {  // don't table this category
-      F prob = 1;
+      F logprob = 0;
       {
 	Ss children;
 	cforeach (tree::ptrs_type, it, tp->children)
 	  children.push_back((*it)->cat);
 	F ruleprob = decrrule(tp->cat, children, estimate_theta_flag*weight);
 	assert(ruleprob > 0);
-	prob *= ruleprob;
+	logprob += log(ruleprob);
       }
       cforeach (tree::ptrs_type, it, tp->children)
-	prob *= decrtree(*it, weight);
-      return prob;
+	logprob += decrtree(*it, weight);
+      return logprob;
     }
     assert(weight <= tp->count);
+    touch(tp->cat);
     tp->count -= weight;
     assert(afind(parent_pyn, tp->cat) >= weight);
     const U pyn = (parent_pyn[tp->cat] -= weight);
@@ -514,7 +527,7 @@ struct pycfg_type {
       assert(pyn > 0);
       F prob = (tp->count - pya)/(pyn + pyb);
       assert(finite(prob)); assert(prob > 0); assert(prob <= 1);
-      return prob;
+      return log(prob);
     }
     else { // tp->count == 0, remove PY table entry
       {
@@ -538,17 +551,16 @@ struct pycfg_type {
 	parent_pyn.erase(tp->cat);
       F prob = (pym*pya + pyb)/(pyn + pyb);  // select new table
       assert(finite(prob)); assert(prob > 0); assert(prob <= 1);
+      F logprob = log(prob);
       {
 	Ss children;
 	cforeach (tree::ptrs_type, it, tp->children)
 	  children.push_back((*it)->cat);
-	prob *= decrrule(tp->cat, children, estimate_theta_flag*weight);
+	logprob += log(decrrule(tp->cat, children, estimate_theta_flag*weight));
       }
-      assert(prob > 0);
       cforeach (tree::ptrs_type, it, tp->children)
-	prob *= decrtree(*it, weight);
-      // assert(prob > 0);
-      return prob;
+	logprob += decrtree(*it, weight);
+      return logprob;
     }
   }  // pycfg_type::decrtree()
 
@@ -586,6 +598,7 @@ struct pycfg_type {
       rule_priorweight[SSs(parent,rhs)] += weight;
       parent_priorweight[parent] += weight;
     }
+    index_grammar();
     return is;
   }  // pycfg_type::read()
 
@@ -802,9 +815,10 @@ struct pycfg_type {
       F pyb = get_pyb(parent);
       // TRACE5(parent, pym, pyn, pya, pyb);
       resample_pyb_type pyb_logP(pyn, pym, pya, pyb_gamma_c, pyb_gamma_s, min_pyb);
-      // pyb = slice_sampler1d(pyb_logP, pyb, random1, 0.0, std::numeric_limits<double>::infinity(), 0.0, niterations, 100*niterations);
-      F pyb0 = slice_sampler1dp(pyb_logP, pyb, random1, 1, niterations);
+      // pyb = slice_sampler1d(pyb_logP, pyb, rng, 0.0, std::numeric_limits<double>::infinity(), 0.0, niterations, 100*niterations);
+      F pyb0 = slice_sampler1dp(pyb_logP, pyb, rng, 1, niterations);
       parent_pyb[parent] = pyb0 + min_pyb;
+      touch(parent);
       // parent_bap[parent].first += naccepted;
       // parent_bap[parent].second += nproposed;
     }
@@ -860,8 +874,9 @@ struct pycfg_type {
       U pym = afind(parent_pym, parent);
       const Ts& trees = afind(parent_trees, parent);
       resample_pya_type pya_logP(pyn, pym, pyb, pya_beta_a, pya_beta_b, trees);
-      pya = slice_sampler1d(pya_logP, pya, random1, std::numeric_limits<double>::min(), 1.0, 0.0, niterations);
+      pya = slice_sampler1d(pya_logP, pya, rng, std::numeric_limits<double>::min(), 1.0, 0.0, niterations);
       parent_pya[parent] = pya;
+      touch(parent);
     }
   }  // pycfg_type::resample_pya()
 
@@ -909,6 +924,154 @@ struct pycfg_type {
     return os;
   }  // pycfg_type::write_adaptor_parameters()
 
+  //////////////////////////////////////////////////////////////////////
+  //                                                                  //
+  //                    Dense grammar indices                         //
+  //                                                                  //
+  //////////////////////////////////////////////////////////////////////
+
+  //! The CKY parser indexes its chart cells by dense integer ids
+  //! rather than by symbols and trie iterators.  These ids are
+  //! assigned by index_grammar() once the grammar has been read.
+  //! The rules never change after that (only their weights do, and
+  //! these stay positive) so the indices keep pointers to the rule
+  //! weights stored in unarychild_parent_weight, rhs_parent_weight
+  //! and parent_weight.  A copy of a pycfg_type must be re-indexed.
+
+  //! noid is the id of a missing symbol or active state
+  //
+  static const U noid = U(-1);
+
+  //! id_weight_type{} is a rule seen from one of its ends, i.e. the
+  //! id of the symbol or active state at the other end, the id of the
+  //! rule and a pointer to the rule weight
+  //
+  struct id_weight_type {
+    U id;
+    U rule;
+    const F* weight;
+    id_weight_type(U id, U rule, const F* weight) : id(id), rule(rule), weight(weight) { }
+  };
+
+  typedef std::vector<id_weight_type> IdWs;
+
+  //! active_type{} is a node of the rhs_parent_weight trie, i.e. a
+  //! non-empty prefix of the right hand side of some rules
+  //
+  struct active_type {
+    U prev;         //!< active state for the prefix minus its last symbol, or noid
+    U last;         //!< symbol id of the last symbol of the prefix
+    UUs next;       //!< (symbol id, active state) for each extension of the prefix
+    IdWs parents;   //!< parents of the rules whose rhs is this prefix
+
+    active_type(U prev, U last) : prev(prev), last(last) { }
+  };
+
+  typedef std::vector<active_type> active_types;
+
+  S_Id symbol_id;                    //!< maps grammar symbols to their id
+  Ss id_symbol;                      //!< maps ids back to grammar symbols
+  std::vector<const F*> id_parentweight;  //!< parent_weight of each symbol, or NULL
+  Us id_active;                      //!< active state of each symbol as a first child, or noid
+  std::vector<IdWs> id_unaryparents;   //!< parents of each symbol in unary rules
+  std::vector<IdWs> id_unarychildren;  //!< children of each symbol in unary rules
+  std::vector<IdWs> id_binaryrules;    //!< active states completing a non-unary rule of each symbol
+  active_types active_states;         //!< the nodes of rhs_parent_weight (without the root)
+  U nrules;                          //!< number of rules, which are numbered from 0
+
+  //! The parsers tabulate the annealed rule and PY factors of each
+  //! parent, so every change to the weights or to the PY statistics
+  //! of a parent is recorded by touch(), which sets its stamp to the
+  //! next value of the modification counter.
+  //
+  typedef unsigned long stamp_type;
+  stamp_type stamp;                  //!< modification counter
+  std::vector<stamp_type> id_stamp;  //!< stamp of the last change to each symbol
+
+  //! touch() records a change to the rules or the PY statistics of parent
+  //
+  void touch(S parent) {
+    U p = id(parent);
+    if (p != noid)
+      id_stamp[p] = ++stamp;
+  }  // pycfg_type::touch()
+
+  //! id() returns the id of symbol s, or noid if s doesn't appear in
+  //! the grammar
+  //
+  U id(S s) const {
+    S_Id::const_iterator it = symbol_id.find(s);
+    return (it == symbol_id.end()) ? noid : it->second;
+  }  // pycfg_type::id()
+
+  //! index_grammar() assigns ids to the grammar symbols and to the
+  //! nodes of rhs_parent_weight
+  //
+  void index_grammar() {
+    symbol_id.clear();
+    id_symbol.clear();
+    cforeach (SSs_F, it, rule_priorweight) {
+      index_symbol(it->first.first);
+      cforeach (Ss, it1, it->first.second)
+	index_symbol(*it1);
+    }
+    U nsymbols = id_symbol.size();
+    id_stamp.assign(nsymbols, ++stamp);
+    nrules = 0;
+
+    id_parentweight.assign(nsymbols, NULL);
+    cforeach (S_F, it, parent_weight)
+      id_parentweight[afind(symbol_id, it->first)] = &it->second;
+
+    id_unaryparents.assign(nsymbols, IdWs());
+    id_unarychildren.assign(nsymbols, IdWs());
+    cforeach (S_S_F, it, unarychild_parent_weight) {
+      U child = afind(symbol_id, it->first);
+      cforeach (S_F, it1, it->second) {
+	U parent = afind(symbol_id, it1->first);
+	id_unaryparents[child].push_back(id_weight_type(parent, nrules, &it1->second));
+	id_unarychildren[parent].push_back(id_weight_type(child, nrules, &it1->second));
+	++nrules;
+      }
+    }
+
+    id_active.assign(nsymbols, U(noid));
+    id_binaryrules.assign(nsymbols, IdWs());
+    active_states.clear();
+    index_actives(St_S_F::root, noid);
+  }  // pycfg_type::index_grammar()
+
+  U index_symbol(S s) {
+    std::pair<S_Id::iterator,bool> itb = symbol_id.insert(S_Id::value_type(s, id_symbol.size()));
+    if (itb.second)
+      id_symbol.push_back(s);
+    return itb.first->second;
+  }  // pycfg_type::index_symbol()
+
+  //! index_actives() assigns ids to the children of node (a node of
+  //! rhs_parent_weight) whose own id is prev
+  //
+  void index_actives(U node, U prev) {
+    Us children;
+    rhs_parent_weight.children(node, children);
+    cforeach (Us, it, children) {
+      U active = active_states.size();
+      U last = afind(symbol_id, rhs_parent_weight.key(*it));
+      active_states.push_back(active_type(prev, last));
+      if (prev == noid)
+	id_active[last] = active;
+      else
+	active_states[prev].next.push_back(UU(last, active));
+      cforeach (S_F, it1, rhs_parent_weight.data(*it)) {
+	U parent = afind(symbol_id, it1->first);
+	active_states[active].parents.push_back(id_weight_type(parent, nrules, &it1->second));
+	id_binaryrules[parent].push_back(id_weight_type(active, nrules, &it1->second));
+	++nrules;
+      }
+      index_actives(*it, active);
+    }
+  }  // pycfg_type::index_actives()
+
   //! initialize_predictive_parse_filter() initializes the predictive
   //! parse filter by building the grammar that the Earley parser requires
   //
@@ -923,6 +1086,9 @@ struct pycfg_type {
 					       children.size() == 1
 					       && !parent_priorweight.count(child1));
     }
+    // the symbol ids are the ones assigned by index_grammar(), which
+    // are the same in a re-indexed copy of this grammar
+    predictive_parse_filter_grammar.compile(symbol_id, id_symbol.size());
   }  // pycfg_type::initialize_predictive_parse_filter();
 
 };  // pycfg_type{}
@@ -939,16 +1105,6 @@ std::ostream& operator<< (std::ostream& os, const pycfg_type& g) {
   return g.write(os);
 }  // operator<< (pycfg_type&)
 
-namespace std {
-    template <> struct hash<pycfg_type::Stit>
-        : public std::unary_function<pycfg_type::Stit, std::size_t> {
-        size_t operator()(const pycfg_type::Stit t) const
-        {
-            return size_t(&(*t));
-        }  // ext::hash<pycfg_type::Stit>::operator()
-    };  // ext::hash<pycfg_type::Stit>{}
-} // namespace std
-
 static const F unaryclosetolerance = 1e-7;
 
 class pycky {
@@ -956,26 +1112,123 @@ class pycky {
 public:
 
   const pycfg_type& g;
+  mt19937ar_type& rng;  // random number generator used to sample trees
   F anneal;         // annealing factor (1 = no annealing)
 
-  pycky(const pycfg_type& g, F anneal=1) : g(g), anneal(anneal) { }
-
   typedef pycfg_type::tree tree;
+
+  //! arena, if not NULL, holds the new nodes of the trees returned by
+  //! random_tree(), instead of the heap
+  //
+  tree::arena_type* arena;
+
+  pycky(const pycfg_type& g, mt19937ar_type& rng, F anneal=1)
+    : g(g), rng(rng), anneal(anneal), arena(NULL), factors_stamp(0),
+      factors_anneal(0), factors_default_pya(0), factors_default_pyb(0) { }
+
   typedef pycfg_type::U U;
-  typedef pycfg_type::S_S_F S_S_F;
-  typedef pycfg_type::St_S_F St_S_F;
-  typedef pycfg_type::Stit Stit;
+  typedef pycfg_type::Us Us;
+  typedef pycfg_type::UUs UUs;
+  typedef pycfg_type::IdWs IdWs;
+  typedef pycfg_type::active_type active_type;
 
-  typedef std::vector<S_F> S_Fs;
-  // typedef ext::hash_map<Stit,F> Stit_F;
-  typedef std::unordered_map<Stit,F> Stit_F;
-  typedef std::vector<Stit_F> Stit_Fs;
+  typedef std::vector<F> Fs;
+  typedef std::pair<U,F> UF;
+  typedef std::vector<UF> UFs;
 
   typedef pycfg_type::sT sT;
 
   typedef pycfg_type::St_sT St_sT;
-  typedef St_sT::const_iterator StsTit;
-  typedef std::vector<StsTit> StsTits;
+
+  //! A cell_type{} holds the inside scores of the inactive edges
+  //! (indexed by symbol id) and of the active edges (indexed by
+  //! active state id) of a chart cell.  The ids with a non-zero score
+  //! are listed in inactive_ids and active_ids, so that a cell can be
+  //! traversed and cleared in time proportional to its contents.
+  //!
+  //! The scores of a cell are scaled by 2^-scale, so that the largest
+  //! one is about 1: the inside probability of an edge is its score
+  //! times 2^scale.  This keeps long sentences from underflowing
+  //! in double precision.
+  //
+  struct cell_type {
+    Fs inactive;
+    Us inactive_ids;
+    Fs active;
+    Us active_ids;
+    int scale;
+
+    //! reset() empties the cell and sizes it for the grammar
+    //
+    void reset(U nsymbols, U nactives) {
+      cforeach (Us, it, inactive_ids)
+	inactive[*it] = 0;
+      inactive_ids.clear();
+      cforeach (Us, it, active_ids)
+	active[*it] = 0;
+      active_ids.clear();
+      if (inactive.size() != nsymbols)
+	inactive.assign(nsymbols, 0);
+      if (active.size() != nactives)
+	active.assign(nactives, 0);
+      scale = 0;
+    }  // pycky::cell_type::reset()
+
+    //! rescale() changes the scale of the cell to newscale, dropping
+    //! the scores that underflow
+    //
+    void rescale(int newscale) {
+      F factor = ldexp(F(1), scale - newscale);
+      Us::iterator out = inactive_ids.begin();
+      cforeach (Us, it, inactive_ids)
+	if ((inactive[*it] *= factor) != 0)
+	  *out++ = *it;
+      inactive_ids.erase(out, inactive_ids.end());
+      out = active_ids.begin();
+      cforeach (Us, it, active_ids)
+	if ((active[*it] *= factor) != 0)
+	  *out++ = *it;
+      active_ids.erase(out, active_ids.end());
+      scale = newscale;
+    }  // pycky::cell_type::rescale()
+
+    //! normalize() rescales the cell so its largest score is in [0.5,1)
+    //
+    void normalize() {
+      F maxprob = 0;
+      cforeach (Us, it, inactive_ids)
+	maxprob = std::max(maxprob, inactive[*it]);
+      cforeach (Us, it, active_ids)
+	maxprob = std::max(maxprob, active[*it]);
+      if (maxprob == 0)
+	return;
+      int exponent;
+      frexp(maxprob, &exponent);
+      if (exponent != 0)
+	rescale(scale + exponent);
+    }  // pycky::cell_type::normalize()
+
+    void add_inactive(U id, F prob) {
+      if (prob == 0)
+	return;
+      F& p = inactive[id];
+      if (p == 0)
+	inactive_ids.push_back(id);
+      p += prob;
+    }  // pycky::cell_type::add_inactive()
+
+    void add_active(U id, F prob) {
+      if (prob == 0)
+	return;
+      F& p = active[id];
+      if (p == 0)
+	active_ids.push_back(id);
+      p += prob;
+    }  // pycky::cell_type::add_active()
+
+  };  // pycky::cell_type{}
+
+  typedef std::vector<cell_type> cell_types;
 
   //! index() returns the location of cell in cells[]
   //
@@ -986,16 +1239,77 @@ public:
   static U ncells(U n) { return n*(n+1)/2; }
 
   Ss terminals;
-  S_Fs inactives;
-  Stit_Fs actives;
-  StsTits pytits;
+  cell_types cells;  //!< the chart, reused from one sentence to the next
+  Us pytits;          //!< node of terms_pytrees of the terminals of each cell, or noid
 
-  typedef std::set<S> sS;
-  typedef std::vector<sS> sSs;
-  sSs predicteds;
+  Us terminal_ids;    //!< symbol ids of the terminals, or noid
+  earley predicteds;  //!< predictive parse filter, if g.predictive_parse_filter
 
-  //! inside() constructs the inside table, and returns the probability
-  //! of the start symbol rewriting to the terminals.
+  //! mincachescale is the smallest scale of a cell the PY cache
+  //! probabilities (which are at most 1) can be added to without
+  //! overflowing
+  //
+  static const int mincachescale = -960;
+
+  //! The annealed rule probabilities and PY factors only change with
+  //! the grammar (after incrtree() or decrtree()) or with anneal, so
+  //! update_factors() tabulates them at the start of inside(), by rule
+  //! id and by symbol id, and the chart loops only read these tables.
+  //
+  Fs rule_factor;        //!< power(rule weight/parent weight, anneal)
+  Fs id_newtablefactor;  //!< power((pym*pya+pyb)/(pyn+pyb), anneal), 1 if not adapted
+  Fs id_pya;             //!< pya of each symbol
+  Fs id_pynb;            //!< pyn+pyb of each symbol
+  pycfg_type::stamp_type factors_stamp;  //!< value of g.stamp when the tables were updated
+  F factors_anneal, factors_default_pya, factors_default_pyb;
+
+  //! update_factors() recomputes the factors of the parents touched
+  //! since the last call, or all of them if the annealing factor or
+  //! the default PY parameters have changed
+  //
+  void update_factors() {
+    U nsymbols = g.id_symbol.size();
+    bool all = id_pya.size() != nsymbols || rule_factor.size() != g.nrules
+      || anneal != factors_anneal || g.default_pya != factors_default_pya
+      || g.default_pyb != factors_default_pyb;
+    if (!all && factors_stamp == g.stamp)
+      return;
+    if (all) {
+      rule_factor.resize(g.nrules);
+      id_newtablefactor.resize(nsymbols);
+      id_pya.resize(nsymbols);
+      id_pynb.resize(nsymbols);
+    }
+    for (U parent = 0; parent < nsymbols; ++parent)
+      if (all || g.id_stamp[parent] > factors_stamp)
+	update_factors(parent);
+    factors_stamp = g.stamp;
+    factors_anneal = anneal;
+    factors_default_pya = g.default_pya;
+    factors_default_pyb = g.default_pyb;
+  }  // pycky::update_factors()
+
+  void update_factors(U parent) {
+    S parentsym = g.id_symbol[parent];
+    F pya = g.get_pya(parentsym);
+    F pyb = g.get_pyb(parentsym);
+    U pym = dfind(g.parent_pym, parentsym);
+    U pyn = dfind(g.parent_pyn, parentsym);
+    id_pya[parent] = pya;
+    id_pynb[parent] = pyn + pyb;
+    id_newtablefactor[parent] = (pya == 1) ? 1 : power((pym*pya + pyb)/(pyn + pyb), anneal);
+    const F* parentweight = g.id_parentweight[parent];
+    if (parentweight == NULL)
+      return;
+    cforeach (IdWs, it, g.id_unarychildren[parent])
+      rule_factor[it->rule] = power(*it->weight/(*parentweight), anneal);
+    cforeach (IdWs, it, g.id_binaryrules[parent])
+      rule_factor[it->rule] = power(*it->weight/(*parentweight), anneal);
+  }  // pycky::update_factors()
+
+  //! inside() constructs the inside table, and returns the log
+  //! probability of the start symbol rewriting to the terminals
+  //! (-infinity if they can't be parsed).
   //
   template <typename terminals_type>
   F inside(const terminals_type& terminals0, S start) {
@@ -1007,17 +1321,24 @@ public:
 
     U n = terminals.size();
 
+    update_factors();
+
+    terminal_ids.resize(n);
+    for (U i = 0; i < n; ++i)
+      terminal_ids[i] = g.id(terminals[i]);
+
     if (g.predictive_parse_filter) {
-      earley(g.predictive_parse_filter_grammar, start, terminals, predicteds);
-      if (!predicteds[index(0,n)].count(start))
+      U startid = g.id(start);
+      predicteds.parse(g.predictive_parse_filter_grammar, startid, terminal_ids);
+      if (startid == pycfg_type::noid || !predicteds.complete(0, n, startid))
 	std::cerr << "## " << HERE << " Error: earley parse failed, terminals = "
 		  << terminals << std::endl << exit_failure;
     }
 
-    inactives.clear();
-    inactives.resize(ncells(n));
-    actives.clear();
-    actives.resize(ncells(n));
+    if (cells.size() < ncells(n))
+      cells.resize(ncells(n));
+    for (U i = 0; i < ncells(n); ++i)
+      cells[i].reset(g.id_symbol.size(), g.active_states.size());
     pytits.clear();
     pytits.resize(ncells(n));
 
@@ -1026,26 +1347,29 @@ public:
 #endif
     for (U i = 0; i < n; ++i) {   // terminals
       pytits[index(i, i+1)] = g.terms_pytrees.find1(terminals[i]);  // PY cache
-      inactives[index(i,i+1)][terminals[i]] = 1;
-      StsTit& pytit = pytits[index(i,i+1)];
+      cell_type& cell = cells[index(i,i+1)];
+      U terminal = terminal_ids[i];
+      if (terminal != pycfg_type::noid)
+	cell.add_inactive(terminal, 1);
+      U pytit = pytits[index(i,i+1)];
       if (pytit != g.terms_pytrees.end())
-	add_pycache(pytit->data, inactives[index(i,i+1)]);
-      inside_unaryclose(inactives[index(i,i+1)], actives[index(i,i+1)],
-			g.predictive_parse_filter ? &predicteds[index(i,i+1)] : NULL);
+	add_pycache(g.terms_pytrees.data(pytit), cell);
+      inside_unaryclose(cell, g.predictive_parse_filter ? predicteds.cell(i, i+1) : NULL);
+      cell.normalize();
 
       if (debug >= 20000)
 	std::cerr << "# cky::inside() inactives[" << i << "," << i+1 << "] = "
-		  << inactives[index(i,i+1)] << std::endl;
+		  << inactives(i, i+1) << std::endl;
       if (debug >= 20100)
 	std::cerr << "# cky::inside() actives[" << i << "," << i+1 << "] = "
-		  << actives[index(i,i+1)] << std::endl;
+		  << actives(i, i+1) << std::endl;
 
       if (debug >= 20100) {
 	std::cerr << "# cky::inside() pytits[" << i << "," << i+1 << "] = ";
 	if (pytits[index(i, i+1)] == g.terms_pytrees.end())
 	  std::cerr << "()" << std::endl;
 	else
-	  std::cerr << pytits[index(i, i+1)]->data << std::endl;
+	  std::cerr << g.terms_pytrees.data(pytits[index(i, i+1)]) << std::endl;
       }
     }
 
@@ -1055,72 +1379,80 @@ public:
 #endif
       for (U left = 0; left <= n-gap; ++left) {
 	U right = left + gap;
-	sS* predictedparents = g.predictive_parse_filter ?
-	  &predicteds[index(left,right)] : NULL;
-	const StsTit& pytit0 = pytits[index(left, right-1)];
-	StsTit& pytit = pytits[index(left, right)];
-	if (pytit0 == g.terms_pytrees.end())
-	  pytit = g.terms_pytrees.end();
-	else
-	  pytit = pytit0->find1(terminals[right-1]);
-	S_F& parentinactives = inactives[index(left,right)];
-	Stit_F& parentactives = actives[index(left,right)];
+	const earley::word_type* predictedparents = g.predictive_parse_filter ?
+	  predicteds.cell(left, right) : NULL;
+	U& pytit = pytits[index(left, right)];
+	pytit = g.terms_pytrees.find1(pytits[index(left, right-1)], terminals[right-1]);
+	cell_type& parentcell = cells[index(left,right)];
+	bool scaled = false;   // the parent scale is the largest scale of its children
+	for (U mid = left+1; mid < right; ++mid) {
+	  const cell_type& rightcell = cells[index(mid,right)];
+	  const cell_type& leftcell = cells[index(left,mid)];
+	  if (rightcell.inactive_ids.empty() || leftcell.active_ids.empty())
+	    continue;
+	  int scale = leftcell.scale + rightcell.scale;
+	  if (!scaled || scale > parentcell.scale)
+	    parentcell.scale = scale;
+	  scaled = true;
+	}
 	for (U mid = left+1; mid < right; ++mid) {
-	  const S_F& rightinactives = inactives[index(mid,right)];
-	  if (rightinactives.empty())
+	  const cell_type& rightcell = cells[index(mid,right)];
+	  if (rightcell.inactive_ids.empty())
+	    continue;
+	  const cell_type& leftcell = cells[index(left,mid)];
+	  const F midfactor = ldexp(F(1), leftcell.scale + rightcell.scale - parentcell.scale);
+	  if (midfactor == 0)
 	    continue;
-	  Stit_F& leftactives = actives[index(left,mid)];
-	  cforeach (Stit_F, itleft, leftactives) {
-	    const Stit leftactive = itleft->first;
-	    const F leftprob = itleft->second;
-	    cforeach (S_F, itright, rightinactives) {
-	      S rightinactive = itright->first;
-	      const F rightprob = itright->second;
-	      const Stit parentactive = leftactive->find1(rightinactive);
-	      if (parentactive != leftactive->end()) {
-		F leftrightprob = leftprob * rightprob;
-		cforeach (S_F, itparent, parentactive->data) {
-		  S parent = itparent->first;
-		  if (g.predictive_parse_filter
-		      && !predictedparents->count(parent))
-		    continue;
-		  parentinactives[parent] += leftrightprob
-		    * power(itparent->second/afind(g.parent_weight, parent), anneal);
-		}
-		if (!parentactive->key_trie.empty())
-		  parentactives[parentactive] += leftrightprob;
+	  cforeach (Us, itleft, leftcell.active_ids) {
+	    const active_type& leftactive = g.active_states[*itleft];
+	    const F leftprob = leftcell.active[*itleft] * midfactor;
+	    cforeach (UUs, itnext, leftactive.next) {
+	      const F rightprob = rightcell.inactive[itnext->first];
+	      if (rightprob == 0)
+		continue;
+	      const U parentactive = itnext->second;
+	      const active_type& parentstate = g.active_states[parentactive];
+	      F leftrightprob = leftprob * rightprob;
+	      cforeach (IdWs, itparent, parentstate.parents) {
+		U parent = itparent->id;
+		if (predictedparents && !earley::test(predictedparents, parent))
+		  continue;
+		parentcell.add_inactive(parent, leftrightprob * rule_factor[itparent->rule]);
 	      }
+	      if (!parentstate.next.empty())
+		parentcell.add_active(parentactive, leftrightprob);
 	    }
 	  }
 	}
 	// PY correction
-	foreach (S_F, it, parentinactives) {
-	  F pya = g.get_pya(it->first);    // PY cache statistics
-	  if (pya == 1.0)
-	    continue;
-	  F pyb = g.get_pyb(it->first);
-	  U pym = dfind(g.parent_pym, it->first);
-	  U pyn = dfind(g.parent_pyn, it->first);
-	  it->second *= power( (pym*pya + pyb)/(pyn + pyb), anneal);
+	cforeach (Us, it, parentcell.inactive_ids)
+	  parentcell.inactive[*it] *= id_newtablefactor[*it];
+	if (pytit != g.terms_pytrees.end()) {
+	  if (parentcell.scale < mincachescale)
+	    parentcell.rescale(mincachescale);
+	  add_pycache(g.terms_pytrees.data(pytit), parentcell);
 	}
-	if (pytit != g.terms_pytrees.end())
-	  add_pycache(pytit->data, parentinactives);
-	inside_unaryclose(parentinactives, parentactives, predictedparents);
+	inside_unaryclose(parentcell, predictedparents);
+	parentcell.normalize();
 	if (debug >= 20000)
 	  std::cerr << "# cky::inside() inactives[" << left << "," << right
-		    << "] = " << parentinactives << std::endl;
+		    << "] = " << inactives(left, right) << std::endl;
 	if (debug >= 20100)
 	  std::cerr << "# cky::inside() actives[" << left << "," << right << "] = "
-		    << parentactives << std::endl;
+		    << actives(left, right) << std::endl;
 	if (debug >= 20100) {
 	  std::cerr << "# cky::inside() pytits[" << left << "," << right << "] = ";
 	  if (pytits[index(left, right)] == g.terms_pytrees.end())
 	    std::cerr << "()" << std::endl;
 	  else
-	    std::cerr << pytits[index(left, right)]->data << std::endl;
+	    std::cerr << g.terms_pytrees.data(pytits[index(left, right)]) << std::endl;
 	}
       }
-    return dfind(inactives[index(0,n)], start);
+    U startid = g.id(start);
+    const cell_type& rootcell = cells[index(0,n)];
+    if (startid == pycfg_type::noid || rootcell.inactive[startid] == 0)
+      return -std::numeric_limits<F>::infinity();
+    return log(rootcell.inactive[startid]) + rootcell.scale*log(F(2));
   }  // pycky::inside()
 
   template <typename terminals_type>
@@ -1128,60 +1460,78 @@ public:
     return inside(terminals, g.start);
   }
 
-  void add_pycache(const sT& tps, S_F& inactives) const {
+  //! inactives() returns the inactive scores of cell left-right as a
+  //! map (for tracing), before scaling by 2^scale
+  //
+  S_F inactives(U left, U right) const {
+    S_F s_f;
+    const cell_type& cell = cells[index(left, right)];
+    cforeach (Us, it, cell.inactive_ids)
+      s_f[g.id_symbol[*it]] = cell.inactive[*it];
+    return s_f;
+  }  // pycky::inactives()
+
+  //! actives() returns the active scores of cell left-right as a map
+  //! from active state ids (for tracing)
+  //
+  std::map<U,F> actives(U left, U right) const {
+    std::map<U,F> u_f;
+    const cell_type& cell = cells[index(left, right)];
+    cforeach (Us, it, cell.active_ids)
+      u_f[*it] = cell.active[*it];
+    return u_f;
+  }  // pycky::actives()
+
+  void add_pycache(const sT& tps, cell_type& cell) const {
     cforeach (sT, it, tps) {
-      symbol cat = (*it)->cat;
-      F pya = g.get_pya(cat);    // PY cache statistics
+      U cat = g.id((*it)->cat);
+      F pya = id_pya[cat];    // PY cache statistics
       if (pya == 1.0)
 	continue;
-      F pyb = g.get_pyb(cat);
-      U pyn = dfind(g.parent_pyn, cat);
-      inactives[cat] += power( ((*it)->count - pya)/(pyn + pyb), anneal);
+      cell.add_inactive(cat, ldexp(power( ((*it)->count - pya)/id_pynb[cat], anneal),
+				   -cell.scale));
     }
   }  // pycky::add_cache()
 
-  void inside_unaryclose(S_F& inactives, Stit_F& actives, const sS* predictedparents) const {
+  //! add_delta() adds prob to the entry for id in delta, which only
+  //! ever holds a handful of unary parents
+  //
+  static void add_delta(UFs& delta, U id, F prob) {
+    foreach (UFs, it, delta)
+      if (it->first == id) {
+	it->second += prob;
+	return;
+      }
+    delta.push_back(UF(id, prob));
+  }  // pycky::add_delta()
+
+  void inside_unaryclose(cell_type& cell, const earley::word_type* predictedparents) const {
     F delta = 1;
-    S_F delta_prob1 = inactives;
-    S_F delta_prob0;
+    UFs delta_prob1;
+    cforeach (Us, it, cell.inactive_ids)
+      delta_prob1.push_back(UF(*it, cell.inactive[*it]));
+    UFs delta_prob0;
     while (delta > unaryclosetolerance) {
       delta = 0;
-      delta_prob0 = delta_prob1;
-      // delta_prob0.swap(delta_prob1);
+      delta_prob0.swap(delta_prob1);
       delta_prob1.clear();
-      cforeach (S_F, it0, delta_prob0) {
-	S child = it0->first;
-	S_S_F::const_iterator it = g.unarychild_parent_weight.find(child);
-	if (it != g.unarychild_parent_weight.end()) {
-	  const S_F& parent_weight = it->second;
-	  cforeach (S_F, it1, parent_weight) {
-	    S parent = it1->first;
-	    if (g.predictive_parse_filter
-		&& !predictedparents->count(parent))
-	      continue;
-	    F prob = it0->second;
-	    F pya = g.get_pya(parent);
-	    if (pya == 1)
-	      prob *= power(it1->second/afind(g.parent_weight, parent),
-			    anneal);
-	    else {
-	      F pyb = g.get_pyb(parent);
-	      U pym = dfind(g.parent_pym, parent);
-	      U pyn = dfind(g.parent_pyn, parent);
-	      prob *= power(it1->second/afind(g.parent_weight, parent)
-			     * (pym*pya + pyb)/(pyn + pyb),
-			    anneal);
-	    }
-	    delta_prob1[parent] += prob;
-	    delta = std::max(delta, prob/(inactives[parent] += prob));
-	  }
+      cforeach (UFs, it0, delta_prob0) {
+	const IdWs& parent_weight = g.id_unaryparents[it0->first];
+	cforeach (IdWs, it1, parent_weight) {
+	  U parent = it1->id;
+	  if (predictedparents && !earley::test(predictedparents, parent))
+	    continue;
+	  F prob = it0->second * rule_factor[it1->rule] * id_newtablefactor[parent];
+	  add_delta(delta_prob1, parent, prob);
+	  cell.add_inactive(parent, prob);
+	  delta = std::max(delta, prob/cell.inactive[parent]);
 	}
       }
     }
-    cforeach (S_F, it0, inactives) {
-      Stit it1 = g.rhs_parent_weight.find1(it0->first);
-      if (it1 != g.rhs_parent_weight.end())
-	actives[it1] += it0->second;
+    cforeach (Us, it, cell.inactive_ids) {
+      U active = g.id_active[*it];
+      if (active != pycfg_type::noid)
+	cell.add_active(active, cell.inactive[*it]);
     }
   } // pycky::inside_unaryclose()
 
@@ -1190,95 +1540,97 @@ public:
   //
   tree* random_tree(S s) {
     U n = terminals.size();
-    return random_inactive(s, afind(inactives[index(0, n)], s), 0, n);
+    U sid = g.id(s);
+    assert(sid != pycfg_type::noid);
+    assert(cells[index(0, n)].inactive[sid] > 0);
+    return random_inactive(sid, cells[index(0, n)].inactive[sid], 0, n);
   }  // pycky::random_tree
 
   tree* random_tree() { return random_tree(g.start); }
 
+  //! make_tree() returns a new node of a random tree
+  //
+  tree* make_tree(S cat) const {
+    return arena ? arena->make(cat) : new tree(cat);
+  }  // pycky::make_tree()
+
   //! random_inactive() returns a random expansion for an inactive edge
   //
-  tree* random_inactive(const S parent, F parentprob,
+  tree* random_inactive(const U parent, F parentprob,
 			const U left, const U right) const {
 
-    if (left+1 == right && parent == terminals[left])
-      return new tree(parent);
+    const S parentsym = g.id_symbol[parent];
+
+    if (left+1 == right && parentsym == terminals[left])
+      return make_tree(parentsym);
 
-    F probthreshold = parentprob * random1();
+    const cell_type& parentcell = cells[index(left, right)];
+    F probthreshold = parentprob * rng();
     F probsofar = 0;
-    F pya = g.get_pya(parent);
-    F rulefactor = 1;
+    F pya = id_pya[parent];
 
     if (pya != 1) {
 
       // get tree from cache
 
-      F pyb = g.get_pyb(parent);
-      U pyn = dfind(g.parent_pyn, parent);
-      const StsTit& pytit = pytits[index(left, right)];
+      U pytit = pytits[index(left, right)];
       if (pytit != g.terms_pytrees.end())
-	cforeach (sT, it, pytit->data) {
-	  if ((*it)->cat != parent)
+	cforeach (sT, it, g.terms_pytrees.data(pytit)) {
+	  if ((*it)->cat != parentsym)
 	    continue;
-	  probsofar += power( ((*it)->count - pya)/(pyn + pyb), anneal);
+	  probsofar += ldexp(power( ((*it)->count - pya)/id_pynb[parent], anneal),
+			     -parentcell.scale);
 	  if (probsofar >= probthreshold)
 	    return *it;
 	}
-      U pym = dfind(g.parent_pym, parent);
-      rulefactor = (pym*pya + pyb)/(pyn + pyb);
     }
 
     // tree won't come from cache, so cons up new node
 
-    tree* tp = new tree(parent);
-    rulefactor /=  afind(g.parent_weight, parent);
-    const S_F& parentinactives = inactives[index(left, right)];
+    tree* tp = make_tree(parentsym);
+    assert(g.id_parentweight[parent] != NULL);
+    const F newtablefactor = id_newtablefactor[parent];
 
     // try unary rules
 
-    cforeach (S_F, it0, parentinactives) {
-      S child = it0->first;
-      F childprob = it0->second;
-      S_S_F::const_iterator it1 = g.unarychild_parent_weight.find(child);
-      if (it1 != g.unarychild_parent_weight.end()) {
-	const S_F& parent1_weight = it1->second;
-	probsofar += childprob
-	  * power(dfind(parent1_weight, parent)*rulefactor, anneal);
-	if (probsofar >= probthreshold) {
-	  tp->children.push_back(random_inactive(child, childprob, left, right));
-	  return tp;
-	}
+    cforeach (IdWs, it, g.id_unarychildren[parent]) {
+      U child = it->id;
+      F childprob = parentcell.inactive[child];
+      if (childprob == 0)
+	continue;
+      probsofar += childprob * rule_factor[it->rule] * newtablefactor;
+      if (probsofar >= probthreshold) {
+	tp->children.push_back(random_inactive(child, childprob, left, right));
+	return tp;
       }
     }
 
     // try binary rules
 
+    const IdWs& binaryrules = g.id_binaryrules[parent];
     for (U mid = left+1; mid < right; ++mid) {
-      const Stit_F& leftactives = actives[index(left,mid)];
-      const S_F& rightinactives = inactives[index(mid,right)];
-      cforeach (Stit_F, itleft, leftactives) {
-	const Stit leftactive = itleft->first;
-	const F leftprob = itleft->second;
-	cforeach (S_F, itright, rightinactives) {
-	  S rightinactive = itright->first;
-	  const F rightprob = itright->second;
-	  const Stit parentactive = leftactive->find1(rightinactive);
-	  if (parentactive != leftactive->end()) {
-	    S_F::const_iterator it = parentactive->data.find(parent);
-	    if (it != parentactive->data.end()) {
-	      probsofar += leftprob * rightprob
-		* power(it->second*rulefactor, anneal);
-	      if (probsofar >= probthreshold) {
-		random_active(leftactive, leftprob, left, mid, tp->children);
-		tp->children.push_back(random_inactive(rightinactive, rightprob, mid, right));
-		return tp;
-	      }
-	    }
-	  }
+      const cell_type& leftcell = cells[index(left,mid)];
+      const cell_type& rightcell = cells[index(mid,right)];
+      const F midfactor = ldexp(F(1), leftcell.scale + rightcell.scale - parentcell.scale);
+      cforeach (IdWs, it, binaryrules) {
+	const active_type& parentactive = g.active_states[it->id];
+	const F leftprob = leftcell.active[parentactive.prev];
+	if (leftprob == 0)
+	  continue;
+	const F rightprob = rightcell.inactive[parentactive.last];
+	if (rightprob == 0)
+	  continue;
+	probsofar += leftprob * rightprob * midfactor
+	  * rule_factor[it->rule] * newtablefactor;
+	if (probsofar >= probthreshold) {
+	  random_active(parentactive.prev, leftprob, left, mid, tp->children);
+	  tp->children.push_back(random_inactive(parentactive.last, rightprob, mid, right));
+	  return tp;
 	}
       }
     }
 
-    std::cerr << "\n## Error in pycky::random_inactive(), parent = " << parent
+    std::cerr << "\n## Error in pycky::random_inactive(), parent = " << parentsym
 	      << ", left = " << left << ", right = " << right
 	      << ", probsofar = " << probsofar
 	      << " still below probthreshold = " << probthreshold
@@ -1286,43 +1638,43 @@ public:
     return tp;
   }  // pycky::random_inactive()
 
-  void random_active(const Stit parent, F parentprob, const U left, const U right,
+  void random_active(const U parent, F parentprob, const U left, const U right,
 		     tree::ptrs_type& siblings) const {
-    F probthreshold = random1() * parentprob;
+    F probthreshold = rng() * parentprob;
     F probsofar = 0;
+    const active_type& parentactive = g.active_states[parent];
 
-    // unary rule
+    if (parentactive.prev == pycfg_type::noid) {
 
-    const S_F& parentinactives = inactives[index(left, right)];
-    cforeach (S_F, it, parentinactives)
-      if (g.rhs_parent_weight.find1(it->first) == parent) {
-	probsofar += it->second;
-	if (probsofar >= probthreshold) {
-	  siblings.push_back(random_inactive(it->first, it->second, left, right));
-	  return;
-	}
-	break;  // only one unary child can possibly generate this parent
+      // unary rule: only one child can possibly generate this parent
+
+      F childprob = cells[index(left, right)].inactive[parentactive.last];
+      probsofar += childprob;
+      if (childprob > 0 && probsofar >= probthreshold) {
+	siblings.push_back(random_inactive(parentactive.last, childprob, left, right));
+	return;
       }
+    }
+    else {
 
-    // binary rules
-
-    for (U mid = left + 1; mid < right; ++mid) {
-      const Stit_F& leftactives = actives[index(left,mid)];
-      const S_F& rightinactives = inactives[index(mid,right)];
-      cforeach (Stit_F, itleft, leftactives) {
-	const Stit leftactive = itleft->first;
-	const F leftprob = itleft->second;
-	cforeach (S_F, itright, rightinactives) {
-	  S rightinactive = itright->first;
-	  const F rightprob = itright->second;
-	  if (parent == leftactive->find1(rightinactive)) {
-	    probsofar += leftprob * rightprob;
-	    if (probsofar >= probthreshold) {
-	      random_active(leftactive, leftprob, left, mid, siblings);
-	      siblings.push_back(random_inactive(rightinactive, rightprob, mid, right));
-	      return;
-	    }
-	  }
+      // binary rules
+
+      const int parentscale = cells[index(left,right)].scale;
+      for (U mid = left + 1; mid < right; ++mid) {
+	const cell_type& leftcell = cells[index(left,mid)];
+	const cell_type& rightcell = cells[index(mid,right)];
+	const F leftprob = leftcell.active[parentactive.prev];
+	if (leftprob == 0)
+	  continue;
+	const F rightprob = rightcell.inactive[parentactive.last];
+	if (rightprob == 0)
+	  continue;
+	probsofar += leftprob * rightprob
+	  * ldexp(F(1), leftcell.scale + rightcell.scale - parentscale);
+	if (probsofar >= probthreshold) {
+	  random_active(parentactive.prev, leftprob, left, mid, siblings);
+	  siblings.push_back(random_inactive(parentactive.last, rightprob, mid, right));
+	  return;
 	}
       }
     }
@@ -1353,33 +1705,33 @@ struct resample_pycache_helper {
       tp0->terminals(words);
       S start = tp0->category();
       F old_pya = g.set_pya(start, 1.0);
-      F pi0 = g.decrtree(tp0);
-      if (pi0 < 0)
-	std::cerr << "## pi0 = " << pi0 << ", tp0 = " << tp0 << std::endl;
-      assert(pi0 >= 0);
-      F r0 = g.tree_prob(tp0);
-      assert(r0 >= 0);
-
-      F tprob = p.inside(words, start);   // parse string
-      if (tprob <= 0)
-	std::cerr << "## Error in resample_pycache(): words = " << words << ", tprob = " << tprob
+      F logpi0 = g.decrtree(tp0);
+      if (logpi0 > 0)
+	std::cerr << "## logpi0 = " << logpi0 << ", tp0 = " << tp0 << std::endl;
+      assert(logpi0 <= 0);
+      F logr0 = g.tree_logprob(tp0);
+      assert(logr0 <= 0);
+
+      F logtprob = p.inside(words, start);   // parse string
+      if (!finite(logtprob))
+	std::cerr << "## Error in resample_pycache(): words = " << words << ", logtprob = " << logtprob
 		  << ", tp0 = " << tp0 << std::endl
 		  << "## g = " << g << std::endl;
-      assert(tprob >= 0);
+      assert(finite(logtprob));
       tree* tp1 = p.random_tree(start);
-      F r1 = g.tree_prob(tp1);
-      assert(r1 >= 0);
+      F logr1 = g.tree_logprob(tp1);
+      assert(logr1 <= 0);
 
       if (tp0->generalize() == tp1->generalize()) {  // ignore top count
 	g.incrtree(tp0);
 	tp1->selective_delete();
       }
       else {  // *tp1 != *tp0, do acceptance rejection
-	F pi1 = g.incrtree(tp1);
-	F pi1r0 = pi1 * r0;
-	F pi0r1 = pi0 * r1;
-	F accept = (pi0r1 > 0) ? power(pi1r0/pi0r1, p.anneal) : 2.0; // accept if there has been an underflow
-	if (random1() <= accept) {
+	F logpi1 = g.incrtree(tp1);
+	F accept = exp(p.anneal * (logpi1 + logr0 - logpi0 - logr1));
+	if (!finite(accept))  // accept if the old tree had probability 0
+	  accept = 2.0;
+	if (p.rng() <= accept) {
 	  tp0->generalize().swap(tp1->generalize());  // don't swap top counts
 	  tp1->selective_delete();
 	}
@@ -700,11 +700,11 @@ std::istream& operator>> (std::istream& is, std::vector<T>& xs)
 
 // Sets
 //
-template <class T>
-std::ostream& operator<< (std::ostream& os, const std::set<T>& s)
+template <class T, class Compare>
+std::ostream& operator<< (std::ostream& os, const std::set<T,Compare>& s)
 {
     os << '(';
-    for (typename std::set<T>::const_iterator i = s.begin(); i != s.end(); ++i) {
+    for (typename std::set<T,Compare>::const_iterator i = s.begin(); i != s.end(); ++i) {
         if (i != s.begin())
             os << ' ';
         os << *i;
@@ -7,8 +7,8 @@
 #define XTREE_H
 
 #include <algorithm>
+#include <cassert>
 #include <iostream>
-#include <set>
 #include <vector>
 
 #include "sym.h"
@@ -95,7 +95,7 @@ struct xtree_type {
     for ( ; it0 != children.end(); ++it0, ++it1) {
       if (it1 == t.children.end())
 	return false;
-      if (!(**it0 == **it1))
+      if (*it0 != *it1 && !(**it0 == **it1))  // shared subtrees are equal
 	return false;
     }
     return it1 == t.children.end();
@@ -129,38 +129,118 @@ public:
   typedef unsigned int count_type;
   count_type count;
 
+  //! serial is set by the grammar when the node becomes a PY table, in
+  //! the order the tables are created.  Sets of trees are ordered by
+  //! serial number rather than by address, so that a chain doesn't
+  //! depend on the memory layout, nor on the threads the trees were
+  //! sampled by.
+  //
+  unsigned long serial;
+
   catcounttree_type(symbol cat=symbol(), count_type count=0)
-    : xtree_type<catcounttree_type>(cat), count(count) { }
+    : xtree_type<catcounttree_type>(cat), count(count), serial(0) { }
+
+  //! serial_less{} orders tree pointers by serial number
+  //
+  struct serial_less {
+    bool operator() (const catcounttree_type* t0, const catcounttree_type* t1) const {
+      return t0->serial < t1->serial;
+    }
+  };
 
   bool operator== (const catcounttree_type& t) const {
     return cat == t.cat && count == t.count && equal_children(t);
   }
 
-  typedef std::set<ptr_type> sptr_type;
-
   //! selective_delete() deletes all nodes from the top of the tree that have a count
   //! of zero
   //
   void selective_delete() {
-    sptr_type todelete;
+    ptrs_type todelete;
     selective_delete_helper(todelete);
     assert((count != 0) == todelete.empty());
-    for (sptr_type::iterator it = todelete.begin(); it != todelete.end(); ++it)
-      delete *it;
+    release(todelete);
+  }  // catcounttree_type::selective_delete()
+
+  //! selective_delete() deletes the nodes with a count of zero from the
+  //! top of each tree in tps.  The trees may share such nodes, which are
+  //! deleted only once.
+  //
+  static void selective_delete(const ptrs_type& tps) {
+    ptrs_type todelete;
+    for (ptrs_type::const_iterator it = tps.begin(); it != tps.end(); ++it)
+      (*it)->selective_delete_helper(todelete);
+    release(todelete);
   }  // catcounttree_type::selective_delete()
 
 private:
 
-  void selective_delete_helper(sptr_type& todelete) {
+  void selective_delete_helper(ptrs_type& todelete) {
     if (count == 0) {
-      todelete.insert(this);
+      todelete.push_back(this);
       for (ptrs_type::iterator it = children.begin(); it != children.end(); ++it)
 	(*it)->selective_delete_helper(todelete);
     }
   }  // catcounttree_type::selective_delete_helper()
 
+  //! release() deletes the nodes of tps, which may be listed more than
+  //! once
+  //
+  static void release(ptrs_type& tps) {
+    std::sort(tps.begin(), tps.end());
+    tps.erase(std::unique(tps.begin(), tps.end()), tps.end());
+    for (ptrs_type::iterator it = tps.begin(); it != tps.end(); ++it)
+      delete *it;
+  }  // catcounttree_type::release()
+
 public:
 
+  //! arena_type{} holds the nodes of trees which are thrown away all
+  //! at once, such as the test parses.  reset() frees all the nodes
+  //! made since the previous reset, and the next make() calls reuse
+  //! them, with the capacity of their children vector.  The nodes must
+  //! not be in a PY table when the arena is reset.
+  //
+  class arena_type {
+  public:
+    arena_type() : nused(0) { }
+
+    ~arena_type() {
+      for (ptrs_type::iterator it = nodes.begin(); it != nodes.end(); ++it)
+	delete *it;
+    }
+
+    arena_type(const arena_type&) = delete;
+    arena_type& operator= (const arena_type&) = delete;
+
+    //! make() returns a new node labelled cat
+    //
+    catcounttree_type* make(symbol cat) {
+      if (nused == nodes.size()) {
+	nodes.push_back(new catcounttree_type(cat));
+	return nodes[nused++];
+      }
+      catcounttree_type* tp = nodes[nused++];
+      tp->cat = cat;
+      tp->count = 0;
+      tp->serial = 0;
+      tp->children.clear();
+      return tp;
+    }  // catcounttree_type::arena_type::make()
+
+    //! reset() frees all the nodes of the arena
+    //
+    void reset() {
+      for (size_t i = 0; i < nused; ++i)
+	assert(nodes[i]->count == 0);
+      nused = 0;
+    }  // catcounttree_type::arena_type::reset()
+
+  private:
+    ptrs_type nodes;
+    size_t nused;    // the nodes in use are nodes[0 .. nused-1]
+  };  // catcounttree_type::arena_type{}
+
   //! swap() swaps the contents of two catcounttrees
   //
   void swap(catcounttree_type& t) {
@@ -18,6 +18,8 @@ const char usage[] =
 "       [-x eval-every] [-X eval-cmd] [-Y eval-cmd]\n"
 "       [-u test1.yld] [-U eval-cmd]\n"
 "       [-v test1.yld] [-V eval-cmd]\n"
+"       [--nchains nchains] [--threads nthreads] [--ignore-first-parses n]\n"
+"       [--boundary-marginals file] [--block-size K]\n"
 "       grammar.lt < train.yld\n"
 "\n"
 " -d debug        -- debug level\n"
@@ -56,6 +58,11 @@ const char usage[] =
 // " -U eval-cmd     -- parses of test1.yld are piped into this command\n"
 // " -v test2.yld    -- test strings to be parsed (but not trained on) every eval-every iterations\n"
 // " -V eval-cmd     -- parses of test2.yld are piped into this command\n"
+" --nchains nchains       -- run nchains independent chains, print the consensus parses of test1.yld\n"
+" --threads nthreads      -- number of chains run in parallel (default: one thread per chain)\n"
+" --ignore-first-parses n -- with --nchains, don't count the first n parses of test1.yld of each chain\n"
+" --boundary-marginals f  -- with --nchains, write the word boundary marginals of test1.yld to file f\n"
+" --block-size K          -- resample the training sentences by blocks of K, parsed in K threads\n"
 "\n"
 "The grammar consists of a sequence of rules, one per line, in the\n"
 "following format:\n"
@@ -98,6 +105,26 @@ const char usage[] =
 "parses are piped into the commands specified by the -U and -V parameters respectively.\n"
 "Just as for the -X eval-cmd, these commands are only run _once_.\n"
 "\n"
+"With --nchains, the chains share the training data and the grammar\n"
+"read at startup, chain c being seeded with rand-init + c.  Instead of\n"
+"printing the parses of test1.yld every eval-every iterations, the\n"
+"segmentations sampled by all the chains are counted, and only the most\n"
+"frequent segmentation of each test sentence is printed at the end.  The\n"
+"trace, grammar and parses files of chain c are suffixed by .c\n"
+"\n"
+"With --boundary-marginals file, the posterior probability of a word\n"
+"boundary between each pair of consecutive terminals of test1.yld (the\n"
+"fraction of the counted segmentations having this boundary) is written\n"
+"to file, one line per test sentence.\n"
+"\n"
+"With --block-size K, the training sentences are resampled K at a time:\n"
+"the old parses of the block are removed from the grammar, the K\n"
+"sentences are parsed in parallel threads against this frozen grammar,\n"
+"and the proposal parses are inserted one by one with the usual\n"
+"Metropolis-Hastings correction.  This is an approximate sampler (the\n"
+"sentences of a block don't see each other's new parses) which scales\n"
+"a chain to K cores.  The default K = 1 is the exact Gibbs sampler.\n"
+"\n"
 "The program can now estimate the Pitman-Yor hyperparameters a and b for each\n"
 "adapted nonterminal.  To specify a uniform Beta prior on the a parameter, set\n"
 "\n"
@@ -116,13 +143,21 @@ const char usage[] =
 "is not adapted.\n"
 "\n";
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <getopt.h>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <time.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 // #include "pstream.h"
@@ -131,6 +166,7 @@ const char usage[] =
 #include "xtree.h"
 
 typedef unsigned int U;
+typedef std::vector<U> Us;
 typedef std::vector<Ss> Sss;
 
 // namespace pstream {
@@ -156,6 +192,11 @@ typedef std::vector<Ss> Sss;
 
 int debug = 100;
 
+//! output_mutex serializes the outputs of the chains running in
+//! parallel (writing a grammar toggles catcounttree_type::compact_trees)
+//
+std::mutex output_mutex;
+
 struct S_F_incrementer {
   const F increment;
   S_F_incrementer(F increment) : increment(increment) { }
@@ -169,12 +210,122 @@ struct S_F_incrementer {
 };
 
 struct RandomNumberGenerator : public std::unary_function<U,U> {
+  mt19937ar_type& mt;
+  RandomNumberGenerator(mt19937ar_type& mt) : mt(mt) { }
   U operator() (U nmax) {
-    return mt_genrand_int32() % nmax;
+    return mt.genrand_int32() % nmax;
   }
 };
 
 
+//! parse_counter_type{} counts the segmentations of the test sentences
+//! sampled by all the chains, and returns the most frequent one.  A
+//! segmentation is stored as the bitset of the positions of the
+//! sentence starting a word, and only spelled out in the output.
+//
+struct parse_counter_type {
+  typedef std::uint64_t word_type;
+  typedef std::vector<word_type> bits_type;
+  enum { wordbits = 64 };
+
+  //! bits_hash{} hashes a bitset (FNV-1a over its words)
+  //
+  struct bits_hash {
+    size_t operator() (const bits_type& bits) const {
+      std::uint64_t h = 14695981039346656037ULL;
+      cforeach (bits_type, it, bits)
+	h = (h ^ *it) * 1099511628211ULL;
+      return size_t(h ^ (h >> 32));
+    }
+  };  // parse_counter_type::bits_hash{}
+
+  typedef std::unordered_map<bits_type,U,bits_hash> Bits_U;
+
+  std::mutex mutex;
+  const Sss& sentences;
+  std::vector<Bits_U> counts;     //!< counts of the segmentations of each sentence
+  std::vector<Us> nboundaries;    //!< number of segmentations with a word starting at each position
+  U nparses;                      //!< number of segmentations counted per sentence
+
+  parse_counter_type(const Sss& sentences)
+    : sentences(sentences), counts(sentences.size()),
+      nboundaries(sentences.size()), nparses(0)
+  {
+    for (U i = 0; i < sentences.size(); ++i)
+      nboundaries[i].assign(sentences[i].size(), 0);
+  }
+
+  static bool test(const bits_type& bits, U pos) {
+    return (bits[pos / wordbits] >> (pos % wordbits)) & 1;
+  }
+
+  //! add() counts a segmentation for each test sentence
+  //
+  void add(const std::vector<bits_type>& parses) {
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(parses.size() == counts.size());
+    for (U i = 0; i < parses.size(); ++i) {
+      ++counts[i][parses[i]];
+      for (U pos = 0; pos < nboundaries[i].size(); ++pos)
+	nboundaries[i][pos] += test(parses[i], pos);
+    }
+    ++nparses;
+  }  // parse_counter_type::add()
+
+  //! words() returns the segmentation bits of sentence i, as written by
+  //! xtree_parse_words() (the terminals are not escaped)
+  //
+  std::string words(U i, const bits_type& bits) const {
+    std::string os;
+    for (U pos = 0; pos < sentences[i].size(); ++pos) {
+      if (test(bits, pos))
+	os += ' ';
+      os += sentences[i][pos].string_reference();
+    }
+    return os;
+  }  // parse_counter_type::words()
+
+  //! write_consensus() writes the most frequent segmentation of each
+  //! sentence, breaking ties by taking the smallest string so the
+  //! result doesn't depend on the scheduling of the chains
+  //
+  std::ostream& write_consensus(std::ostream& os) const {
+    for (U i = 0; i < counts.size(); ++i) {
+      std::string best;
+      U bestcount = 0;
+      cforeach (Bits_U, it, counts[i])
+	if (it->second > bestcount) {
+	  best = words(i, it->first);
+	  bestcount = it->second;
+	}
+	else if (it->second == bestcount) {
+	  std::string w = words(i, it->first);
+	  if (w < best)
+	    best.swap(w);
+	}
+      os << best << std::endl;
+    }
+    return os;
+  }  // parse_counter_type::write_consensus()
+
+  //! write_boundary_marginals() writes, for each sentence, the fraction
+  //! of the counted segmentations having a word boundary between each
+  //! pair of consecutive terminals
+  //
+  std::ostream& write_boundary_marginals(std::ostream& os) const {
+    cforeach (std::vector<Us>, it, nboundaries) {
+      for (U pos = 1; pos < it->size(); ++pos) {
+	if (pos > 1)
+	  os << ' ';
+	os << (nparses > 0 ? F((*it)[pos]) / nparses : F(0));
+      }
+      os << std::endl;
+    }
+    return os;
+  }  // parse_counter_type::write_boundary_marginals()
+};  // parse_counter_type{}
+
+
 /*
   This function has been for wordseg by Mathieu Bernard. It serves to
   display an utterance as the input utterance with spaces at word
@@ -182,11 +333,11 @@ struct RandomNumberGenerator : public std::unary_function<U,U> {
   complete tree, and (slowly) parsed from Python.
  */
 template<class XTree>
-std::ostream& xtree_parse_words(std::ostream& os, const XTree& tree, const std::string& word_category)
+std::ostream& xtree_parse_words(std::ostream& os, const XTree& tree, symbol word_category)
 {
-    // special case of an empty category: stream the complete tree as
-    // in the original code.
-    if(word_category == "")
+    // special case of an undefined category: stream the complete tree
+    // as in the original code.
+    if(word_category.is_undefined())
     {
         os << tree;
         return os;
@@ -194,14 +345,15 @@ std::ostream& xtree_parse_words(std::ostream& os, const XTree& tree, const std::
 
     if(tree.children.empty())
     {
-        // final trees are nuclear phonemes
-        os << tree.specialize().category();
+        // final trees are nuclear phonemes, written as in the input
+        // text (and not escaped as in a tree)
+        os << tree.specialize().category().string_reference();
     }
     else
     {
         for(const auto& child : tree.children)
         {
-            if(word_category == child->specialize().category().string_reference())
+            if(word_category == child->specialize().category())
             {
                 // we found a word boundary
                 os << " ";
@@ -215,6 +367,143 @@ std::ostream& xtree_parse_words(std::ostream& os, const XTree& tree, const std::
 }
 
 
+//! xtree_word_starts() sets in bits the positions of the terminals of
+//! tree (the first one being at pos) starting a word_category, as
+//! xtree_parse_words() does with spaces, and returns the position
+//! following the last terminal of tree
+//
+template<class XTree>
+U xtree_word_starts(const XTree& tree, symbol word_category, U pos,
+		    parse_counter_type::bits_type& bits)
+{
+  if (tree.children.empty())
+    return pos + 1;
+  for (const auto& child : tree.children) {
+    if (child->specialize().category() == word_category)
+      bits[pos / parse_counter_type::wordbits]
+	|= parse_counter_type::word_type(1) << (pos % parse_counter_type::wordbits);
+    pos = xtree_word_starts(*child, word_category, pos, bits);
+  }
+  return pos;
+}
+
+
+//! sample_test_parses() samples a parse of each test sentence under
+//! the current grammar.  Without parse counter the segmentations are
+//! written to stdout, followed by an empty line.  Otherwise they are
+//! counted, unless this is one of the first ignore_first_parses calls.
+//! The parses are thrown away: their nodes are made in the arena of
+//! the chain, reset at the end.
+//
+void sample_test_parses(pycfg_type& g, pycky& p, pycky::tree::arena_type& arena,
+			const Sss& test1s,
+			symbol word_category,
+			parse_counter_type* parse_counter,
+			U ignore_first_parses, U& nparses) {
+  typedef pycky::tree tree;
+  std::vector<parse_counter_type::bits_type> parses;
+  p.arena = &arena;
+  cforeach (Sss, it, test1s) {
+    p.inside(*it);
+    tree* tp = p.random_tree();
+    g.incrtree(tp, 1);
+    if (parse_counter) {
+      parses.push_back(parse_counter_type::bits_type(
+	  (it->size() + parse_counter_type::wordbits - 1) / parse_counter_type::wordbits));
+      xtree_word_starts(*tp, word_category, 0, parses.back());
+    }
+    else
+      xtree_parse_words(std::cout, *tp, word_category) << std::endl;
+    g.decrtree(tp, 1);
+  }
+  p.arena = NULL;
+  arena.reset();
+  if (!parse_counter)
+    std::cout << std::endl;
+  else if (nparses >= ignore_first_parses)
+    parse_counter->add(parses);
+  ++nparses;
+}  // sample_test_parses()
+
+
+//! block_workers_type{} runs the K proposals of a block of sentences:
+//! the first one in the calling thread, and the others in K-1 threads
+//! created once per chain, which wait for the next block in between.
+//
+class block_workers_type {
+public:
+  typedef std::function<void(U)> job_type;
+
+  block_workers_type(U nworkers)
+    : job(NULL), njobs(0), generation(0), nbusy(0), stop(false) {
+    for (U k = 1; k <= nworkers; ++k)
+      workers.emplace_back(&block_workers_type::work, this, k);
+  }
+
+  ~block_workers_type() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wakeup.notify_all();
+    for (U k = 0; k < workers.size(); ++k)
+      workers[k].join();
+  }
+
+  //! run() calls job(k) for k = 0 to njobs-1, job(k) in worker k,
+  //! and returns once they are all done.
+  //
+  void run(U njobs, const job_type& job) {
+    assert(njobs <= workers.size() + 1);
+    const U nbusy_block = njobs > 1 ? njobs - 1 : 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      this->job = &job;
+      this->njobs = njobs;
+      nbusy = nbusy_block;
+      ++generation;
+    }
+    if (nbusy_block > 0)
+      wakeup.notify_all();
+    if (njobs > 0)
+      job(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return nbusy == 0; });
+  }
+
+private:
+  void work(U k) {
+    U seen = 0;
+    for (;;) {
+      const job_type* job;
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	wakeup.wait(lock, [&]() { return stop || generation != seen; });
+	if (stop)
+	  return;
+	seen = generation;
+	if (k >= njobs)  // not part of this block
+	  continue;
+	job = this->job;
+      }
+      (*job)(k);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--nbusy == 0)
+	done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wakeup, done;
+  const job_type* job;
+  U njobs;
+  U generation;  // number of blocks run so far
+  U nbusy;       // number of workers still running the current block
+  bool stop;
+};  // block_workers_type{}
+
+
 F gibbs_estimate(pycfg_type& g, const Sss& trains,
 		 F train_frac, bool train_frac_randomise,
 		 // Postreamps& evalcmds,
@@ -230,11 +519,17 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
 		 std::ostream* grammar_stream_ptr,
 		 std::ostream* trace_stream_ptr,
                  // grammar category at which to place word boundaries
-                 // when displaying parsed trees to stdout.
-                 const std::string& word_category,
+                 // when displaying parsed trees to stdout (undefined to
+                 // display the complete trees).
+                 symbol word_category,
 		 const Sss& test1s, // Postreamps& test1cmds,
-		 const Sss& test2s // Postreamps& test2cmds,
+		 const Sss& test2s, // Postreamps& test2cmds,
 		 // Postreamps& grammarcmds
+		 // if not NULL, count the test1s parses instead of printing them
+		 parse_counter_type* parse_counter,
+		 U ignore_first_parses,
+		 // number of sentences resampled together (1 is a plain Gibbs sweep)
+		 U block_size
     ) {
 
   typedef pycky::tree tree;
@@ -247,7 +542,24 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
   U nwords = 0;
   // F sum_log2prob = 0;
   tps_type tps(n, NULL);
-  pycky p(g, anneal_start);
+  pycky p(g, g.rng, anneal_start);
+  pycky::tree::arena_type test_arena;
+  RandomNumberGenerator rng(g.rng);
+  U ntestparses = 0;
+
+  // with blocked sampling, the k-th sentence of a block is parsed by
+  // parsers[k], with its own random number generator (parsers[0] is p)
+  std::vector<mt19937ar_type> block_rngs(block_size);
+  std::vector<pycky*> parsers(1, &p);
+  for (U k = 1; k < block_size; ++k) {
+    block_rngs[k].init_genrand(g.rng.genrand_int32());
+    parsers.push_back(new pycky(g, block_rngs[k], anneal_start));
+  }
+  block_workers_type block_workers(block_size - 1);
+  Us block;
+  tps_type tp1s(block_size, NULL), discarded;
+  std::vector<F> logpi0s(block_size), logr0s(block_size),
+    logr1s(block_size), logtprobs(block_size);
 
   if (g.pya_beta_a < -1 && g.pya_beta_b < 0)
     g.default_pya = 0.999;
@@ -260,85 +572,46 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
   else {
     for (unsigned i = 0; i < nn; ++i)
       train_flag[i] = true;
-    if (train_frac_randomise) {
-      RandomNumberGenerator rng;
+    if (train_frac_randomise)
       std::random_shuffle(train_flag.begin(), train_flag.end(), rng);
-    }
   }
 
-  {
-    Us try_later; // indices of sentences that are so long that the parser underflows
-
-    // initialize tps with (random) trees
-
-    for (unsigned i = 0; i < n; ++i) {
-      if (!train_flag[i])
-	continue;
-
-      if (debug >= 1000)
-	std::cerr << "# trains[" << i << "] = " << trains[i];
-
-      nwords += trains[i].size();
-
-      F tprob = p.inside(trains[i]);
-
-      if (debug >= 1000)
-	std::cerr << ", tprob = " << tprob;
-
-      if (tprob <= 0) {
-	if (debug >= 1000)
-	  std::cerr << ", parse failed, will retry later " << std::endl;
-	try_later.push_back(i);  // underflowed now; we'll try this later
-	continue;
-      }
+  // initialize tps with (random) trees
 
-      tps[i] = p.random_tree();
+  for (unsigned i = 0; i < n; ++i) {
+    if (!train_flag[i])
+      continue;
 
-      if (debug >= 1000)
-	std::cerr << ", tps[" << i << "] = " << tps[i] << std::endl;
-
-      if (!delayed_initialization)
-	g.incrtree(tps[i]);        // incremental initialisation
-    }
-
-    if (delayed_initialization)    // collect statistics from the random trees
-      for (unsigned i = 0; i < n; ++i)
-	if (tps[i] != NULL)
-	  g.incrtree(tps[i]);
-
-    cforeach (Us, it, try_later) {
+    if (debug >= 1000)
+      std::cerr << "# trains[" << i << "] = " << trains[i];
 
-      if (debug >= 1000)
-	std::cerr << "# reparsing trains[" << *it << "] = " << trains[*it];
+    nwords += trains[i].size();
 
-      F tprob = p.inside(trains[*it]);
+    F logtprob = p.inside(trains[i]);
 
-      if (debug >= 1000)
-	std::cerr << ", tprob = " << tprob;
+    if (debug >= 1000)
+      std::cerr << ", logtprob = " << logtprob;
 
-      if (tprob <= 0)
-      {
-          std::cerr << "\n## " << HERE << " Error in py-cfg::gibbs_estimate(), tprob = "
-                    << tprob
-                    << ", trains[" << *it << "] = " << trains[*it]
-                    << " failed to parse." << std::endl;
-      #ifndef QUADPREC
-          std::cerr << "ERROR probability falls to 0 with double precision, "
-                    << "retry with quadruple precision: "
-                    << "recompile with the flag 'cmake -DAG_QUADRUPLE=ON'" << std::endl;
-      #endif
-          std::cerr << exit_failure;
-      }
+    if (!finite(logtprob))
+      std::cerr << "\n## " << HERE << " Error in py-cfg::gibbs_estimate(), logtprob = "
+		<< logtprob
+		<< ", trains[" << i << "] = " << trains[i]
+		<< " failed to parse." << std::endl << exit_failure;
 
-      tps[*it] = p.random_tree();
+    tps[i] = p.random_tree();
 
-      if (debug >= 1000)
-	std::cerr << ", tps[" << *it << "] = " << tps[*it] << std::endl;
+    if (debug >= 1000)
+      std::cerr << ", tps[" << i << "] = " << tps[i] << std::endl;
 
-      g.incrtree(tps[*it]);
-    }
+    if (!delayed_initialization)
+      g.incrtree(tps[i]);        // incremental initialisation
   }
 
+  if (delayed_initialization)    // collect statistics from the random trees
+    for (unsigned i = 0; i < n; ++i)
+      if (tps[i] != NULL)
+	g.incrtree(tps[i]);
+
   if (trace_stream_ptr)
     *trace_stream_ptr << "# " << nwords << " tokens in "
 		      << nn << " sentences" << std::endl
@@ -354,7 +627,7 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
   for (U iteration = 0; iteration < niterations; ++iteration) {
 
     if (random_order)
-      std::random_shuffle(index.begin(), index.end());
+      std::random_shuffle(index.begin(), index.end(), rng);
 
     if (iteration + z_its > niterations)
       p.anneal = 1.0/z_temp;
@@ -366,6 +639,8 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
       p.anneal = anneal_stop;
 
     assert(finite(p.anneal));
+    for (U k = 1; k < parsers.size(); ++k)
+      parsers[k]->anneal = p.anneal;
 
     if (debug >= 100)
     {
@@ -432,24 +707,9 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
       //   gc << std::endl;
       // }
 
-      cforeach (Sss, it, test1s) {  // parse test1s
-	p.inside(*it);
-	tree* tp = p.random_tree();
-	g.incrtree(tp, 1);
-        // std::cout << tp << std::endl;
-        xtree_parse_words(std::cout, *tp, word_category) << std::endl;
-	// foreach (Postreamps, tcit, test1cmds) {
-	//   pstream::ostream& tc = **tcit;
-	//   tc << tp << std::endl;
-	// }
-	g.decrtree(tp, 1);
-	tp->selective_delete();
-      }
-      std::cout << std::endl;
-      // foreach (Postreamps, tcit, test1cmds) {
-      //   pstream::ostream& tc = **tcit;
-      //   tc << std::endl;
-      // }
+      // parse test1s
+      sample_test_parses(g, p, test_arena, test1s, word_category,
+			 parse_counter, ignore_first_parses, ntestparses);
 
       cforeach (Sss, it, test2s) {  // parse test2s
 	p.inside(*it);
@@ -478,105 +738,139 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
     unchanged = 0;
     rejected = 0;
 
-    for (U i0 = 0; i0 < n; ++i0) {
-
-      U i = index[i0];
-
-      if (!train_flag[i])  // skip this sentence if we don't train on it
-	continue;
-
-      if (debug >= 1000)
-	std::cerr << "# trains[" << i << "] = " << trains[i];
-
-      tree* tp0 = tps[i];                // get the old parse for sentence to resample
-      assert(tp0);
-
-      F pi0 = g.decrtree(tp0);           // remove the old parse's fragments from the CRPs
-      if (pi0 <= 0)
-	std::cerr << "## " << HERE
-		  << " Underflow in gibbs_estimate() while computing pi0 = decrtree(tp0):"
-		  << " pi0 = " << pi0
-		  << ", iteration = " << iteration
-		  << ", trains[" << i << "] = " << trains[i]
-	  //      << std::endl << "## tp0 = " << tp0
-		  << std::endl;
-
-      F r0 = g.tree_prob(tp0);            // compute old tree's prob under proposal grammar
-      if (r0 <= 0)
-	std::cerr << "## " << HERE
-		  << " Underflow in gibbs_estimate() while computing r0 = tree_prob(tp0):"
-		  << " r0 = " << r0
-		  << ", iteration = " << iteration
-		  << ", trains[" << i << "] = " << trains[i]
-	  //      << std::endl << "## tp0 = " << tp0
-		  << std::endl;
-
-      F tprob = p.inside(trains[i]);       // compute inside CKY table for proposal grammar
-      if (tprob <= 0)
-	std::cerr << "## " << HERE
-		  << " Underflow in gibbs_estimate() while computing tprob = inside(trains[i]):"
-		  << " tprob = " << tprob
-		  << ", iteration = " << iteration
-		  << ", trains[" << i << "] = " << trains[i]
-	  //      << std::endl << "## g = " << g
-		  << std::endl;
-      assert(tprob > 0);
+    for (U i0 = 0; i0 < n; ) {
+
+      // the next block of (at most block_size) sentences to resample
+      block.clear();
+      for ( ; i0 < n && block.size() < block_size; ++i0)
+	if (train_flag[index[i0]])  // skip this sentence if we don't train on it
+	  block.push_back(index[i0]);
+      U nblock = block.size();
+
+      // remove the old parses' fragments from the CRPs.  With a single
+      // sentence, logpi0 is its old parse's probability given the other
+      // parses, otherwise it is recomputed when the proposal is inserted
+      for (U k = nblock; k-- > 0; ) {
+	U i = block[k];
+	tree* tp0 = tps[i];                // get the old parse for sentence to resample
+	assert(tp0);
+
+	logpi0s[k] = g.decrtree(tp0);
+	if (!finite(logpi0s[k]))
+	  std::cerr << "## " << HERE
+		    << " Zero probability in gibbs_estimate() while computing logpi0 = decrtree(tp0):"
+		    << " logpi0 = " << logpi0s[k]
+		    << ", iteration = " << iteration
+		    << ", trains[" << i << "] = " << trains[i]
+	    //      << std::endl << "## tp0 = " << tp0
+		    << std::endl;
+      }
 
-      if (debug >= 1000)
-	std::cerr << ", tprob = " << tprob;
-      // sum_log2prob += log2(tprob);
+      for (U k = 0; k < nblock; ++k) {
+	U i = block[k];
+	logr0s[k] = g.tree_logprob(tps[i]);  // compute old tree's prob under proposal grammar
+	if (!finite(logr0s[k]))
+	  std::cerr << "## " << HERE
+		    << " Zero probability in gibbs_estimate() while computing logr0 = tree_logprob(tp0):"
+		    << " logr0 = " << logr0s[k]
+		    << ", iteration = " << iteration
+		    << ", trains[" << i << "] = " << trains[i]
+	    //      << std::endl << "## tp0 = " << tp0
+		    << std::endl;
+      }
 
-      tree* tp1 = p.random_tree();         // sample proposal parse from proposal grammar CKY table
-      F r1 = g.tree_prob(tp1);
-      // assert(r1 > 0);
+      // propose() samples the proposal parse of the k-th sentence of
+      // the block, on parsers[k].  The grammar is not modified until
+      // all the proposals are sampled, so they run in parallel threads.
+      auto propose = [&](U k) {
+	U i = block[k];
+	pycky& pk = *parsers[k];
+
+	logtprobs[k] = pk.inside(trains[i]);  // compute inside CKY table for proposal grammar
+	if (!finite(logtprobs[k]))
+	  std::cerr << "## " << HERE
+		    << " Parse failure in gibbs_estimate() while computing logtprob = inside(trains[i]):"
+		    << " logtprob = " << logtprobs[k]
+		    << ", iteration = " << iteration
+		    << ", trains[" << i << "] = " << trains[i]
+	    //      << std::endl << "## g = " << g
+		    << std::endl;
+	assert(finite(logtprobs[k]));
+
+	tp1s[k] = pk.random_tree();          // sample proposal parse from proposal grammar CKY table
+	logr1s[k] = g.tree_logprob(tp1s[k]);
+      };
+
+      block_workers.run(nblock, propose);
+
+      // insert the proposal parses in the CRPs, and accept or reject
+      // them.  The old parses of a block may share nodes which are no
+      // longer counted, so the discarded parses are only deleted once
+      // the whole block is inserted.
+      discarded.clear();
+      for (U k = 0; k < nblock; ++k) {
+	U i = block[k];
+	tree* tp0 = tps[i];
+	tree* tp1 = tp1s[k];
+	F logpi0 = logpi0s[k];
+	F logr0 = logr0s[k];
+	F logr1 = logr1s[k];
 
-      if (*tp0 == *tp1) {                  // don't do anything if proposal parse is same as old parse
 	if (debug >= 1000)
-	  std::cerr << ", tp0 == tp1" << std::flush;
-	++unchanged;
-	g.incrtree(tp1, 1);
-	tps[i] = tp1;
-	tp0->selective_delete();
-      }
-      else {
-	F pi1 = g.incrtree(tp1, 1);        // insert proposal parse into CRPs, compute proposal's true probability
-	// assert(pi1 > 0);
+	  std::cerr << "# trains[" << i << "] = " << trains[i]
+		    << ", logtprob = " << logtprobs[k];
 
-	if (debug >= 1000)
-	  std::cerr << ", r0 = " << r0 << ", pi0 = " << pi0
-		    << ", r1 = " << r1 << ", pi1 = " << pi1 << std::flush;
-
-	if (hastings_correction) {         // perform accept-reject step
-	  F accept = (pi1 * r0) / (pi0 * r1); // acceptance probability
-	  if (p.anneal != 1)
-	    accept = power(accept, p.anneal);
-	  if (!finite(accept))  // accept if there has been an underflow
-	    accept = 2.0;
+	if (*tp0 == *tp1) {                  // don't do anything if proposal parse is same as old parse
 	  if (debug >= 1000)
-	    std::cerr << ", accept = " << accept << std::flush;
-	  if (random1() <= accept) {      // do we accept the proposal parse?
-	    if (debug >= 1000)            //  yes
-	      std::cerr << ", accepted" << std::flush;
-	    tps[i] = tp1;                 //  insert proposal parse into set of parses
-	    tp0->selective_delete();      //  release storage associated with old parse
+	    std::cerr << ", tp0 == tp1" << std::flush;
+	  ++unchanged;
+	  g.incrtree(tp1, 1);
+	  tps[i] = tp1;
+	  discarded.push_back(tp0);
+	}
+	else {
+	  if (nblock > 1) {                  // old parse's probability given the parses inserted so far
+	    logpi0 = g.incrtree(tp0, 1);
+	    g.decrtree(tp0, 1);
 	  }
-	  else {                          // reject proposal parse
+	  F logpi1 = g.incrtree(tp1, 1);     // insert proposal parse into CRPs, compute proposal's true probability
+
+	  if (debug >= 1000)
+	    std::cerr << ", logr0 = " << logr0 << ", logpi0 = " << logpi0
+		      << ", logr1 = " << logr1 << ", logpi1 = " << logpi1 << std::flush;
+
+	  if (hastings_correction) {         // perform accept-reject step
+	    F accept = exp(p.anneal * (logpi1 + logr0 - logpi0 - logr1)); // acceptance probability
+	    if (!finite(accept))  // accept if the old parse had probability 0
+	      accept = 2.0;
 	    if (debug >= 1000)
-	      std::cerr << ", rejected" << std::flush;
-	    g.decrtree(tp1, 1);           // remove proposal parse from CRPs
-	    g.incrtree(tp0, 1);           // reinsert old parse into CRPs
-	    tp1->selective_delete();      // release storage associated with proposal parse
-	    ++rejected;
+	      std::cerr << ", accept = " << accept << std::flush;
+	    if (g.rng() <= accept) {      // do we accept the proposal parse?
+	      if (debug >= 1000)            //  yes
+		std::cerr << ", accepted" << std::flush;
+	      tps[i] = tp1;                 //  insert proposal parse into set of parses
+	      discarded.push_back(tp0);     //  release storage associated with old parse
+	    }
+	    else {                          // reject proposal parse
+	      if (debug >= 1000)
+		std::cerr << ", rejected" << std::flush;
+	      g.decrtree(tp1, 1);           // remove proposal parse from CRPs
+	      g.incrtree(tp0, 1);           // reinsert old parse into CRPs
+	      discarded.push_back(tp1);     // release storage associated with proposal parse
+	      ++rejected;
+	    }
+	  }
+	  else {                            // no hastings correction
+	    tps[i] = tp1;                   // save proposal parse
+	    discarded.push_back(tp0);       // delete old parse
 	  }
 	}
-	else {                            // no hastings correction
-	  tps[i] = tp1;                   // save proposal parse
-	  tp0->selective_delete();        // delete old parse
-	}
+
+	if (debug >= 1000)
+	  std::cerr << ", tps[" << i << "] = " << tps[i] << std::endl;
       }
 
-      if (debug >= 1000)
-	std::cerr << ", tps[" << i << "] = " << tps[i] << std::endl;
+      tree::selective_delete(discarded);
     }
 
     if (iteration < resample_pycache_nits)
@@ -593,6 +887,7 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
       g.default_pya = std::min(0.999, std::max(0.0, 1.0 - pow(iteration/(-g.pya_beta_a),-g.pya_beta_b)));
 
     if (finalparses_stream_ptr && iteration + nparses_iterations >= niterations) {
+      std::lock_guard<std::mutex> lock(output_mutex);
       for (U i = 0; i < n; ++i)
 	if (train_flag[i])
 	  (*finalparses_stream_ptr) << tps[i] << std::endl;
@@ -652,24 +947,9 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
   //   ec << std::endl;
   // }
 
-  cforeach (Sss, it, test1s) {  // final parse of test1s
-    p.inside(*it);
-    tree* tp = p.random_tree();
-    g.incrtree(tp, 1);
-    // std::cout << tp << std::endl;
-    xtree_parse_words(std::cout, *tp, word_category) << std::endl;
-    // foreach (Postreamps, tcit, test1cmds) {
-    //   pstream::ostream& tc = **tcit;
-    //   tc << tp << std::endl;
-    // }
-    g.decrtree(tp, 1);
-    tp->selective_delete();
-  }
-  std::cout << std::endl;
-  // foreach (Postreamps, tcit, test1cmds) {
-  //   pstream::ostream& tc = **tcit;
-  //   tc << std::endl;
-  // }
+  // final parse of test1s
+  sample_test_parses(g, p, test_arena, test1s, word_category,
+		     parse_counter, ignore_first_parses, ntestparses);
 
   // cforeach (Sss, it, test2s) {  // final parse for test2s
   //   p.inside(*it);
@@ -704,8 +984,10 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
   if (debug >= 10000)
     std::cerr << "# g.terms_pytrees = " << g.terms_pytrees << std::endl;
 
-  if (grammar_stream_ptr)
+  if (grammar_stream_ptr) {
+    std::lock_guard<std::mutex> lock(output_mutex);
     (*grammar_stream_ptr) << g;
+  }
 
   bool estimate_theta_flag = g.estimate_theta_flag;
   g.estimate_theta_flag = false;
@@ -716,6 +998,9 @@ F gibbs_estimate(pycfg_type& g, const Sss& trains,
     }
   g.estimate_theta_flag = estimate_theta_flag;
 
+  for (U k = 1; k < parsers.size(); ++k)
+    delete parsers[k];
+
   return logPcorpus;
 }  // gibbs_estimate()
 
@@ -751,12 +1036,50 @@ int main(int argc, char** argv) {
   F train_frac = 1.0;
   bool train_frac_randomise = false;
   std::string word_category = "";
+  U nchains = 0;   // 0 is a single chain printing all its parses
+  U nthreads = 0;  // 0 is one thread per chain
+  U ignore_first_parses = 0;
+  std::string boundary_marginals_filename;
+  U block_size = 1;
+
+  // options without short name
+  enum { NCHAINS = 256, THREADS, IGNORE_FIRST_PARSES, BOUNDARY_MARGINALS, BLOCK_SIZE };
+  static const struct option long_options[] = {
+    {"nchains", required_argument, NULL, NCHAINS},
+    {"threads", required_argument, NULL, THREADS},
+    {"ignore-first-parses", required_argument, NULL, IGNORE_FIRST_PARSES},
+    {"boundary-marginals", required_argument, NULL, BOUNDARY_MARGINALS},
+    {"block-size", required_argument, NULL, BLOCK_SIZE},
+    {NULL, 0, NULL, 0}
+  };
 
   int chr;
   // while ((chr = getopt(argc, argv, "A:CDEF:G:H:I:N:PR:ST:U:V:X:Y:Z:a:b:d:e:f:g:h:m:n:r:s:t:u:v:w:x:z:"))
-  while ((chr = getopt(argc, argv, "A:CDEF:G:H:I:N:PR:ST:U:Z:a:b:c:d:e:f:g:h:m:n:r:s:t:u:w:x:z:"))
+  while ((chr = getopt_long(argc, argv, "A:CDEF:G:H:I:N:PR:ST:U:Z:a:b:c:d:e:f:g:h:m:n:r:s:t:u:w:x:z:",
+			    long_options, NULL))
 	 != -1)
     switch (chr) {
+    case NCHAINS:
+      nchains = atoi(optarg);
+      if (nchains == 0)
+	std::cerr << "# Error in " << argv[0]
+		  << ": --nchains must be positive" << std::endl << usage << abort;
+      break;
+    case THREADS:
+      nthreads = atoi(optarg);
+      break;
+    case IGNORE_FIRST_PARSES:
+      ignore_first_parses = atoi(optarg);
+      break;
+    case BOUNDARY_MARGINALS:
+      boundary_marginals_filename = optarg;
+      break;
+    case BLOCK_SIZE:
+      block_size = atoi(optarg);
+      if (block_size == 0)
+	std::cerr << "# Error in " << argv[0]
+		  << ": --block-size must be positive" << std::endl << usage << abort;
+      break;
     case 'A':
       parses_filename = optarg;
       break;
@@ -885,6 +1208,14 @@ int main(int argc, char** argv) {
     std::cerr << usage << abort;
   }
 
+  if (nchains > 0 && word_category.empty())
+    std::cerr << "# Error in " << argv[0]
+	      << ": --nchains requires a word category (-c)" << std::endl << usage << abort;
+
+  if (!boundary_marginals_filename.empty() && nchains == 0)
+    std::cerr << "# Error in " << argv[0]
+	      << ": --boundary-marginals requires --nchains" << std::endl << usage << abort;
+
   // if (debug >= 1000)
   //   std::cerr << "# eval_cmds = " << evalcmdstrs << std::endl;
 
@@ -950,12 +1281,6 @@ int main(int argc, char** argv) {
   if (rand_init == 0)
     rand_init = time(NULL);
 
-  mt_init_genrand(rand_init);
-
-  std::ostream* trace_stream_ptr = NULL;
-  if (!trace_filename.empty())
-    trace_stream_ptr = new std::ofstream(trace_filename.c_str());
-
   std::stringstream parameters;
   parameters << "# D = " << delayed_initialization
              << ", E = " << g.estimate_theta_flag
@@ -981,83 +1306,111 @@ int main(int argc, char** argv) {
              << ", z = " << z_its
              << ", T = " << 1.0/anneal_start
              << ", t = " << anneal_stop;
+  if (nchains > 0)
+    parameters << ", nchains = " << nchains
+               << ", ignore-first-parses = " << ignore_first_parses;
+  if (block_size > 1)
+    parameters << ", block-size = " << block_size;
   if (debug >= 100)
       std::cerr << parameters.str() << std::endl;
 
-  if (trace_stream_ptr)
-      *trace_stream_ptr << parameters.str() << std::endl;
-
   if (train_frac < 0 || train_frac > 1)
     std::cerr << "## Error in py-cfg: -s train_frac must be between 0 and 1\n"
 	      << abort;
 
-  std::ostream* finalparses_stream_ptr = NULL;
-  if (!parses_filename.empty())
-    finalparses_stream_ptr = new std::ofstream(parses_filename.c_str());
-
-  std::ostream* grammar_stream_ptr = NULL;
-  if (!grammar_filename.empty())
-    grammar_stream_ptr = new std::ofstream(grammar_filename.c_str());
-
   if (debug >= 1000)
     std::cerr << "# py-cfg Initial grammar = \n" << g << std::endl;
 
-  pycky parser(g);
-
-  gibbs_estimate(g, trains, train_frac, train_frac_randomise, // evalcmds
-                 eval_every,
-		 niterations, anneal_start, anneal_stop, anneal_its,
-                 z_temp, z_its,
-		 hastings_correction, random_order, delayed_initialization,
-		 static_cast<U>(resample_pycache_nits),
-                 nparses_iterations,
-		 finalparses_stream_ptr,
-                 grammar_stream_ptr, trace_stream_ptr,
-                 word_category,
-		 test1s, // test1cmds,
-                 test2s // , test2cmds, grammarcmds
-      );
-
-  if (finalparses_stream_ptr)
-  {
-      delete finalparses_stream_ptr;
-  }
-
-  if (grammar_stream_ptr)
-  {
-      delete grammar_stream_ptr;
-  }
-
-  // foreach (Postreamps, it, grammarcmds)
-  // {
-  //     pstream::ostream& gc = **it;
-  //     gc.close();
-  //     delete *it;
-  // }
+  // the symbol table is not locked, so the word category is interned
+  // here, before the chains start
+  const symbol word_symbol = word_category.empty() ? symbol() : symbol(word_category);
+
+  // run_chain() runs the chain number chain on its own copy of the
+  // grammar, seeded with rand_init + chain.  With several chains, the
+  // output files of each chain are suffixed by the chain number.
+  auto run_chain = [&](U chain, parse_counter_type* parse_counter) {
+    std::string suffix;
+    if (nchains > 1) {
+      std::ostringstream os;
+      os << '.' << chain;
+      suffix = os.str();
+    }
 
-  // foreach (Postreamps, it, evalcmds)
-  // {
-  //     pstream::ostream& gc = **it;
-  //     gc.close();
-  //     delete *it;
-  // }
+    std::ostream* trace_stream_ptr = NULL;
+    if (!trace_filename.empty()) {
+      trace_stream_ptr = new std::ofstream((trace_filename + suffix).c_str());
+      *trace_stream_ptr << parameters.str();
+      if (nchains > 0)
+	*trace_stream_ptr << ", chain = " << chain;
+      *trace_stream_ptr << std::endl;
+    }
 
-  // foreach (Postreamps, it, test1cmds)
-  // {
-  //     pstream::ostream& gc = **it;
-  //     gc.close();
-  //     delete *it;
-  // }
+    std::ostream* finalparses_stream_ptr = NULL;
+    if (!parses_filename.empty())
+      finalparses_stream_ptr = new std::ofstream((parses_filename + suffix).c_str());
+
+    std::ostream* grammar_stream_ptr = NULL;
+    if (!grammar_filename.empty())
+      grammar_stream_ptr = new std::ofstream((grammar_filename + suffix).c_str());
+
+    // the indices of a copied grammar point to the rules of the original
+    pycfg_type chain_g(g);
+    chain_g.index_grammar();
+    chain_g.rng.init_genrand(rand_init + chain);
+
+    gibbs_estimate(chain_g, trains, train_frac, train_frac_randomise, // evalcmds
+		   eval_every,
+		   niterations, anneal_start, anneal_stop, anneal_its,
+		   z_temp, z_its,
+		   hastings_correction, random_order, delayed_initialization,
+		   static_cast<U>(resample_pycache_nits),
+		   nparses_iterations,
+		   finalparses_stream_ptr,
+		   grammar_stream_ptr, trace_stream_ptr,
+		   word_symbol,
+		   test1s, // test1cmds,
+		   test2s, // , test2cmds, grammarcmds
+		   parse_counter, ignore_first_parses,
+		   block_size
+	);
+
+    if (finalparses_stream_ptr)
+      delete finalparses_stream_ptr;
 
-  // foreach (Postreamps, it, test2cmds)
-  // {
-  //     pstream::ostream& gc = **it;
-  //     gc.close();
-  //     delete *it;
-  // }
+    if (grammar_stream_ptr)
+      delete grammar_stream_ptr;
 
-  if (trace_stream_ptr)
-  {
+    if (trace_stream_ptr)
       delete trace_stream_ptr;
+  };
+
+  if (nchains == 0)
+    run_chain(0, NULL);
+  else {
+    // the chains are shared by nthreads workers, and all count their
+    // test parses in parse_counter
+    parse_counter_type parse_counter(test1s);
+    if (nthreads == 0 || nthreads > nchains)
+      nthreads = nchains;
+
+    std::atomic<U> next_chain(0);
+    std::vector<std::thread> workers;
+    for (U t = 0; t < nthreads; ++t)
+      workers.emplace_back([&]() {
+	  for (U chain = next_chain++; chain < nchains; chain = next_chain++)
+	    run_chain(chain, &parse_counter);
+	});
+    for (U t = 0; t < nthreads; ++t)
+      workers[t].join();
+
+    parse_counter.write_consensus(std::cout);
+
+    if (!boundary_marginals_filename.empty()) {
+      std::ofstream os(boundary_marginals_filename.c_str());
+      if (!os)
+	std::cerr << "# Error in " << argv[0] << ", can't open boundary marginals file "
+		  << boundary_marginals_filename << abort;
+      parse_counter.write_boundary_marginals(os);
+    }
   }
 }
@@ -2,8 +2,8 @@
    A C-program for MT19937, with initialization improved 2002/1/26.
    Coded by Takuji Nishimura and Makoto Matsumoto.
 
-   Before using, initialize the state by using mt_init_genrand(seed)  
-   or mt_init_by_array(init_key, key_length).
+   Before using, initialize the state by using init_genrand(seed)  
+   or init_by_array(init_key, key_length).
 
    Copyright (C) 1997 - 2002, Makoto Matsumoto and Takuji Nishimura,
    All rights reserved.                          
@@ -43,18 +43,14 @@
 
 #include "mt19937ar.h"   /* XXX MJ 17th March 2006 */
 
-/* Period parameters */  
-#define N 624
+/* Period parameters (N is mt19937ar_type::N) */
 #define M 397
 #define MATRIX_A 0x9908b0dfUL   /* constant vector a */
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N]; /* the array for the state vector  */
-static int mti=N+1; /* mti==N+1 means mt[N] is not initialized */
-
 /* initializes mt[N] with a seed */
-void mt_init_genrand(unsigned long s)
+void mt19937ar_type::init_genrand(unsigned long s)
 {
     mt[0]= s & 0xffffffffUL;
     for (mti=1; mti<N; mti++) {
@@ -73,10 +69,10 @@ void mt_init_genrand(unsigned long s)
 /* init_key is the array for initializing keys */
 /* key_length is its length */
 /* slight change for C++, 2004/2/26 */
-void mt_init_by_array(unsigned long init_key[], int key_length)
+void mt19937ar_type::init_by_array(unsigned long init_key[], int key_length)
 {
     int i, j, k;
-    mt_init_genrand(19650218UL);
+    init_genrand(19650218UL);
     i=1; j=0;
     k = (N>key_length ? N : key_length);
     for (; k; k--) {
@@ -99,17 +95,17 @@ void mt_init_by_array(unsigned long init_key[], int key_length)
 }
 
 /* generates a random number on [0,0xffffffff]-interval */
-unsigned long mt_genrand_int32(void)
+unsigned long mt19937ar_type::genrand_int32(void)
 {
     unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
+    static const unsigned long mag01[2]={0x0UL, MATRIX_A};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
     if (mti >= N) { /* generate N words at one time */
         int kk;
 
-        if (mti == N+1)   /* if mt_init_genrand() has not been called, */
-            mt_init_genrand(5489UL); /* a default initial seed is used */
+        if (mti == N+1)   /* if init_genrand() has not been called, */
+            init_genrand(5489UL); /* a default initial seed is used */
 
         for (kk=0;kk<N-M;kk++) {
             y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
@@ -136,39 +132,27 @@ unsigned long mt_genrand_int32(void)
     return y;
 }
 
-/* generates a random number on [0,0x7fffffff]-interval */
-long mt_genrand_int31(void)
-{
-    return (long)( mt_genrand_int32()>>1);
-}
+/* the default generator of the mt_* functions, one per thread */
+static thread_local mt19937ar_type generator;
 
-/* generates a random number on [0,1]-real-interval */
-double mt_genrand_real1(void)
-{
-    return mt_genrand_int32()*(1.0/4294967295.0); 
-    /* divided by 2^32-1 */ 
-}
+void mt_init_genrand(unsigned long s) { generator.init_genrand(s); }
 
-/* generates a random number on [0,1)-real-interval */
-double mt_genrand_real2(void)
+void mt_init_by_array(unsigned long init_key[], int key_length)
 {
-    return mt_genrand_int32()*(1.0/4294967296.0); 
-    /* divided by 2^32 */
+    generator.init_by_array(init_key, key_length);
 }
 
-/* generates a random number on (0,1)-real-interval */
-double mt_genrand_real3(void)
-{
-    return (((double) mt_genrand_int32()) + 0.5)*(1.0/4294967296.0); 
-    /* divided by 2^32 */
-}
+unsigned long mt_genrand_int32(void) { return generator.genrand_int32(); }
+
+long mt_genrand_int31(void) { return generator.genrand_int31(); }
+
+double mt_genrand_real1(void) { return generator.genrand_real1(); }
+
+double mt_genrand_real2(void) { return generator.genrand_real2(); }
+
+double mt_genrand_real3(void) { return generator.genrand_real3(); }
 
-/* generates a random number on [0,1) with 53-bit resolution*/
-double mt_genrand_res53(void) 
-{ 
-    unsigned long a=mt_genrand_int32()>>5, b=mt_genrand_int32()>>6; 
-    return(a*67108864.0+b)*(1.0/9007199254740992.0); 
-} 
+double mt_genrand_res53(void) { return generator.genrand_res53(); }
 /* These real versions are due to Isaku Wada, 2002/01/09 added */
 
 /*
@@ -14,7 +14,10 @@ See Goldwater, Griffiths, Johnson (2010) and Phillips & Pearl (2014).
    segmentation of each utterance rather than a sample. The latter
    two algorithms can be run either in batch mode or in online mode.
    If in online mode, they can also be set to "forget" parts of the
-   previously analysis. This is described in more detail below.
+   previously analysis. This is described in more detail below. In
+   batch mode the unigram model can also be estimated by a type-based
+   sampler (*block sampler*, Liang, Jordan & Klein, 2010) that samples
+   jointly all the boundaries sharing the same surrounding words.
 
 3. Functionality for using separate training and testing files.  If
    you provide an evaluation file, the program will first run through
@@ -71,12 +74,21 @@ DPSEG_ARGUMENTS = [
               '0 (default) means to only evaluate the test set after all'
               'iterations are complete')),
 
+    utils.Argument(
+        name='--eval-threads', type=int,
+        help=('number of threads segmenting the test set in parallel, '
+              'default = 1. With more than 1 thread each test utterance is '
+              'sampled from its own random stream, so the sampled test '
+              'segmentation differs from the single-threaded one')),
+
     utils.Argument(
         short_name='-E', name='--estimator',
-        type=['viterbi', 'flip', 'tree', 'decayed-flip'],
+        type=['viterbi', 'flip', 'tree', 'decayed-flip', 'block'],
         help=('Viterbi does dynamic programming maximization, '
               'Tree does dynamic programming sampling, '
-              'Flip does original Gibbs sampler (default)')),
+              'Flip does original Gibbs sampler (default), '
+              'Block samples jointly the boundaries sharing the same '
+              'surrounding words (batch unigram only)')),
 
     utils.Argument(
         short_name='-D', name='--decay-rate', type=float,
@@ -138,6 +150,12 @@ DPSEG_ARGUMENTS = [
         help='initial segmentation boundary probability (-1 = gold, '
         'default = 0)'),
 
+    utils.Argument(
+        name='--max-word-length', type=int,
+        help=('maximum number of units in a word for the viterbi and tree '
+              'estimators, bounds the dynamic programs to O(n.L^2) '
+              '(0 = no limit), default = 0')),
+
     utils.Argument(
         name='--pya-beta-a', type=float,
         help='if non-zero, a parameter of Beta prior on pya, default = 1.0'),
@@ -163,6 +181,12 @@ DPSEG_ARGUMENTS = [
         short_name='-s', name='--nsubjects', type=int,
         help='number of subjects to simulate, default = 1'),
 
+    utils.Argument(
+        name='--threads', type=int,
+        help=('number of subjects simulated in parallel by the dpseg '
+              'binary on each fold, default = 1. The folds themselves '
+              'are run in parallel processes, see --njobs')),
+
     utils.Argument(
         short_name='-F', name='--forget-rate', type=int,
         help='number of utterances whose words can be remembered, '
@@ -308,7 +332,14 @@ def segment(text, nfolds=5, njobs=1,
             args='--ngram 1 --a1 0 --b1 1',
             log=utils.null_logger(),
             binary=utils.get_binary('dpseg')):
-    """Run the 'dpseg' binary on `nfolds` folds"""
+    """Run the 'dpseg' binary on `nfolds` folds
+
+    Each fold is a different text, segmented by its own dpseg process,
+    and the processes are run on `njobs` parallel jobs. The subjects
+    (--nsubjects) of a fold are chains over the same text, run within its
+    process on --threads threads.
+
+    """
     # force the text to be a list of utterances
     text = list(text)
 
@@ -473,7 +504,7 @@ def main():
 
         if k == 'estimator':
             v = {'viterbi': 'V', 'flip': 'F',
-                 'decayed-flip': 'D', 'tree': 'T'}[v]
+                 'decayed-flip': 'D', 'tree': 'T', 'block': 'B'}[v]
 
         if k == 'ngram':
             v = {'unigram': 1, 'bigram': 2}[v]
@@ -5,17 +5,24 @@
 // characters all over by simply storing pointers to begin/end indices
 // in the global string storing the entire data set.
 //
+// S are hashed with a polynomial rolling hash. Once index() has
+// precomputed the hashes of all the prefixes of data, the hash of any
+// substring is computed in constant time instead of walking its
+// characters, which makes the lexicon lookups independent of the word
+// length.
+//
 // All other classes are various base distributions to generate
 // lexical items.
 
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 #include "mhs.h"
 
 
-extern uniform01_type unif01;
+extern thread_local uniform01_type unif01;
 
 
 class S
@@ -27,7 +34,31 @@ public:
 
     static std::wstring data;
 
+    //! index() precomputes the prefix hashes of data. It must be
+    //! called again whenever data is modified.
+    static void index()
+        {
+            _prefix_hashes.resize(data.size() + 1);
+            _prefix_hashes[0] = 0;
+            std::size_t longest = 0, length = 0;
+            for (std::size_t i = 0; i < data.size(); ++i)
+            {
+                _prefix_hashes[i+1] = _prefix_hashes[i] * hash_base + data[i];
+                length = (data[i] == L'\n') ? 0 : length + 1;
+                longest = std::max(longest, length);
+            }
+
+            // a word spans at most a whole sentence plus its two
+            // boundary markers
+            _powers.resize(longest + 3);
+            _powers[0] = 1;
+            for (std::size_t i = 1; i < _powers.size(); ++i)
+                _powers[i] = _powers[i-1] * hash_base;
+        }
+
     S()
+        : _start(0),
+          _length(0)
         {}
 
     S(std::size_t start, std::size_t end)
@@ -80,6 +111,8 @@ public:
 
     int compare(const S& s) const
         {
+            if (_start == s._start and _length == s._length)
+                return 0;
             return data.compare(_start, _length, data, s._start, s._length);
         }
 
@@ -100,32 +133,52 @@ public:
 
     friend std::wostream& operator<< (std::wostream& os, const S& s);
 
+    //! hash() is sum_i s[i] * hash_base^(size-1-i), modulo 2^64, read
+    //! from the prefix hashes when data is indexed
     size_t hash() const
         {
-            size_t h = 0;
-            size_t g;
-            const_iterator p = begin();
-            const_iterator end = p + _length;
+            const std::size_t end = _start + _length;
+            if (end < _prefix_hashes.size() and _length < _powers.size())
+                return _prefix_hashes[end] - _prefix_hashes[_start] * _powers[_length];
 
-            while (p != end)
-            {
-                h = (h << 4) + (*p++);
-                if ((g = h&0xf0000000))
-                {
-                    h = h ^ (g >> 24);
-                    h = h ^ g;
-                }
-            }
+            size_t h = 0;
+            for (const_iterator p = begin(); p != this->end(); ++p)
+                h = h * hash_base + *p;
 
-            return size_t(h);
+            return h;
         }
 
 private:
     std::size_t _start;
     std::size_t _length;
+
+    static const std::size_t hash_base = 1099511628211ul;  // FNV prime
+    static std::vector<std::size_t> _prefix_hashes;
+    static std::vector<std::size_t> _powers;
 };
 
 
+//! write_binary() writes a substring of S::data as its position
+inline void write_binary(std::ostream& os, const S& s)
+{
+    write_binary(os, s.begin_index());
+    write_binary(os, s.size());
+}
+
+//! read_binary() reads a substring written by write_binary(), S::data
+//! must be the same as when it was written
+inline void read_binary(std::istream& is, S& s)
+{
+    std::size_t start = 0, length = 0;
+    read_binary(is, start);
+    read_binary(is, length);
+    if (is and length > 0 and start + length <= S::data.size())
+        s = S(start, start + length);
+    else
+        is.setstate(std::ios::failbit);
+}
+
+
 namespace std
 {
     template <> struct hash<S> : public std::unary_function<S, std::size_t>
@@ -392,6 +445,7 @@ private:
     F _logprob;
     Char _base;
     CharProbs _char_probs;
+    Interner<Xs> _ids;  //!< ids of the words of the restaurants over this base
 
 public:
     typedef Xs argument_type;
@@ -424,6 +478,19 @@ public:
         return nstrings;
     }
 
+    //! ids() gives dense ids to the words generated by this base, so
+    //! that the restaurants over it index their tables by id, see
+    //! LabelTables below
+    Interner<Xs>& ids()
+        {
+            return _ids;
+        }
+
+    const Interner<Xs>& ids() const
+        {
+            return _ids;
+        }
+
     //! operator() returns the probability of a substring.  TODO
     // sgwater: need to modify this to more correctly deal with
     // utterance boundaries in bigram model. (Also insert/delete)
@@ -493,6 +560,24 @@ public:
             _char_probs.clear();
         }
 
+    //! save() writes the learned character probabilities in binary
+    void save(std::ostream& os) const
+        {
+            write_binary(os, p_nl);
+            write_binary(os, nstrings);
+            write_binary(os, _logprob);
+            _char_probs.save(os);
+        }
+
+    //! load() restores the state written by save()
+    void load(std::istream& is)
+        {
+            read_binary(is, p_nl);
+            read_binary(is, nstrings);
+            read_binary(is, _logprob);
+            _char_probs.load(is);
+        }
+
     F logprob() const
         {
             return _logprob;
@@ -640,6 +725,44 @@ public:
 };
 
 
+// The word lexicons index their tables by word id: a flat array for
+// the unigram lexicon and the contexts of the bigram lexicon, which
+// hold most of the words, a hash map of the ids for each bigram
+// restaurant, which holds a few of them.
+template <typename Xs, typename T>
+struct LabelTables<CharSeqLearned<Xs>,T>
+{
+    typedef IdTables<Xs,T,DenseSlots> type;
+
+    static type make(CharSeqLearned<Xs>& base)
+        {
+            return type(base.ids());
+        }
+};
+
+template <typename Xs, typename T>
+struct LabelTables<UnigramsT<CharSeqLearned<Xs> >,T>
+{
+    typedef IdTables<Xs,T,SparseSlots> type;
+
+    static type make(UnigramsT<CharSeqLearned<Xs> >& base)
+        {
+            return type(base.ids());
+        }
+};
+
+template <typename Xs, typename R>
+struct ContextTables<UnigramsT<CharSeqLearned<Xs> >,R>
+{
+    typedef IdTables<Xs,R,DenseSlots> type;
+
+    static type make(UnigramsT<CharSeqLearned<Xs> >& base)
+        {
+            return type(base.ids());
+        }
+};
+
+
 typedef CharSeqLearned<S> P0;
 typedef UnigramsT<P0> Unigrams;
 typedef BigramsT<Unigrams> Bigrams;
@@ -0,0 +1,200 @@
+#ifndef _CHART_H_
+#define _CHART_H_
+
+#include <vector>
+
+#include "mhs.h"
+
+
+// Chart{} is the scratch space used by the dynamic programs of
+// Sentence::maximize() and Sentence::sample_tree(). Each model owns
+// a single chart that is reused from one sentence to the next. The
+// arrays only grow (up to the size of the longest sentence seen so
+// far), so once the chart is warm the dynamic programs do not
+// allocate any memory.
+//
+// The chart spans a list of positions (the boundaries the dynamic
+// program may go through) and all the scores are stored in log
+// space, so long utterances cannot underflow. A cell (i, j) stands
+// for the word between positions i < j. When a maximum word length
+// is given, only the cells with j - i <= width() are stored (a
+// banded lower triangle), so memory is linear in the number of
+// positions.
+class Chart
+{
+public:
+    Chart()
+        : _max_word_length(0), _width(0), _computed(0), _lookups(0)
+        {}
+
+    //! positions() is the list of character indices the dynamic
+    //! program goes through. Fill it before calling reset().
+    std::vector<U>& positions()
+        {
+            return _positions;
+        }
+
+    const std::vector<U>& positions() const
+        {
+            return _positions;
+        }
+
+    U size() const
+        {
+            return _positions.size();
+        }
+
+    //! reset() prepares the chart for the current positions. If
+    //! max_word_length is not zero, words are limited to that many
+    //! characters.
+    void reset(U max_word_length)
+        {
+            const U n = size();
+            _max_word_length = max_word_length;
+            _width = (max_word_length == 0 || max_word_length >= n) ? n - 1 : max_word_length;
+
+            grow(_forward, n);
+            grow(_backpointers, n);
+            grow(_cells, offset(n));
+            grow(_cell_backpointers, offset(n));
+            grow(_cell_probs, offset(n));
+            grow(_cell_ids, offset(n));
+        }
+
+    //! width() is the maximal distance j - i of a cell (i, j)
+    U width() const
+        {
+            return _width;
+        }
+
+    //! first() is the smallest i such that the cell (i, j) exists
+    U first(U j) const
+        {
+            return j > _width ? j - _width : 0;
+        }
+
+    //! allowed() is true if the word between positions i and j is
+    //! short enough. Words between consecutive positions are always
+    //! allowed, so that a segmentation always exists.
+    bool allowed(U i, U j) const
+        {
+            return _max_word_length == 0
+                or j - i == 1
+                or _positions[j] - _positions[i] <= _max_word_length;
+        }
+
+    //! forward() is the log score of the best (Viterbi) or of all
+    //! (sampler) segmentations of the sentence prefix ending at j
+    F& forward(U j)
+        {
+            return _forward[j];
+        }
+
+    //! backpointer() is the start position of the last word in the
+    //! best segmentation of the prefix ending at j
+    U& backpointer(U j)
+        {
+            return _backpointers[j];
+        }
+
+    //! cell() is a log score attached to the word spanning positions
+    //! i to j, with first(j) <= i < j
+    F& cell(U i, U j)
+        {
+            return _cells[offset(j) + i - first(j)];
+        }
+
+    //! cell_backpointer() is a position attached to the word
+    //! spanning positions i to j, with first(j) <= i < j
+    U& cell_backpointer(U i, U j)
+        {
+            return _cell_backpointers[offset(j) + i - first(j)];
+        }
+
+    //! cell_prob() is the probability of the word spanning positions
+    //! i to j, memoized for the duration of a dynamic program (the
+    //! lexicon does not change meanwhile), with first(j) <= i < j
+    F& cell_prob(U i, U j)
+        {
+            return _cell_probs[offset(j) + i - first(j)];
+        }
+
+    //! cell_id() is the id of the word spanning positions i to j in
+    //! the interner of the lexicon, memoized alongside cell_prob()
+    U& cell_id(U i, U j)
+        {
+            return _cell_ids[offset(j) + i - first(j)];
+        }
+
+    //! count_computed() and count_lookup() record the memoized
+    //! probabilities computed and read by the dynamic programs
+    void count_computed()
+        {
+            ++_computed;
+        }
+
+    void count_lookup()
+        {
+            ++_lookups;
+        }
+
+    //! lookups_per_value() is the mean number of times a memoized
+    //! probability is read by the dynamic programs, that is the
+    //! number of times it would have been computed without the chart
+    F lookups_per_value() const
+        {
+            return _computed ? F(_lookups) / _computed : 0;
+        }
+
+    std::size_t computed() const
+        {
+            return _computed;
+        }
+
+    std::size_t lookups() const
+        {
+            return _lookups;
+        }
+
+    //! merge_statistics() moves the values and lookups counted by
+    //! other (the chart of another thread) to this chart
+    void merge_statistics(Chart& other)
+        {
+            _computed += other._computed;
+            _lookups += other._lookups;
+            other._computed = other._lookups = 0;
+        }
+
+private:
+    std::vector<U> _positions;
+    U _max_word_length;
+    U _width;
+    std::vector<F> _forward;
+    std::vector<U> _backpointers;
+    std::vector<F> _cells;
+    std::vector<U> _cell_backpointers;
+    std::vector<F> _cell_probs;
+    std::vector<U> _cell_ids;
+    std::size_t _computed;
+    std::size_t _lookups;
+
+    //! offset() is the index of the first cell ending at j, each
+    //! row j' < j storing min(j', width) cells
+    std::size_t offset(U j) const
+        {
+            if (j <= _width + 1)
+                return std::size_t(j) * (j - 1) / 2;
+            return std::size_t(_width) * (_width + 1) / 2
+                + std::size_t(j - 1 - _width) * _width;
+        }
+
+    template <typename T>
+    static void grow(std::vector<T>& v, std::size_t n)
+        {
+            if (v.size() < n)
+                v.resize(n);
+        }
+};
+
+
+#endif  // _CHART_H_
@@ -19,6 +19,13 @@ typedef std::vector<S_U> S_Us;
 typedef std::pair<S,S> SS;
 typedef std::vector<SS> TestPairs;
 
+//! read_utf8() reads the whole stream `is` in a single block and
+//! decodes it from UTF-8, with a fast path for ASCII. This is much
+//! faster than reading a std::wistream char by char through the
+//! codecvt facet. Exits with an error on invalid UTF-8.
+std::wstring read_utf8(std::istream& is);
+
+
 //! Data{} holds training and evaluation data, as well as model
 //! parameters.  The idea is that there is one shared Data{} object,
 //! read by multiple models (perhaps being computed in multiple
@@ -36,6 +43,8 @@ public:
     F b2;
     F hypersampling_ratio; // the standard deviation for new hyperparm proposals
     F init_pboundary;      // initial prob of boundary
+    U max_word_length;     //!< longest word in the dynamic programs (0 = no limit)
+    U eval_threads;        //!< number of threads segmenting the test utterances
     F pya_beta_a;          // parm of beta prior on pya
     F pya_beta_b;          // parm of beta prior on pya
     F pyb_gamma_c;         // parm of gamma prior on pyb
@@ -48,6 +57,8 @@ public:
     F anneal_a;            //!< a parameter in annealing sigmoid function
     F anneal_b;            //!< b parameter in annealing sigmoid function
     U trace_every;         //!< Frequency with which tracing should be performed
+    std::string save_state;  //!< file where to save the sampler state (empty = don't)
+    U save_state_every;    //!< Frequency with which the state is saved (0 = at the end only)
     U nparticles;          // number of particles in filter
     U forget_rate;
     U token_memory;
@@ -110,8 +121,12 @@ public:
 
     virtual void read(std::wistream& is, U start, U ns);
 
+    //! read() from an already decoded text, see read_utf8()
+    void read(const std::wstring& text, U start, U ns);
+
     // read additional data for evaluation
     void read_eval(std::wistream& is, U start, U ns);
+    void read_eval(const std::wstring& text, U start, U ns);
 
     virtual std::vector<Sentence> get_eval_sentences() const;
 
@@ -120,7 +135,7 @@ public:
 private:
     U _evalsent_start;  // sentence # of first eval sentence
 
-    void read_data(std::wistream& is, U start, U ns);
+    void read_data(const std::wstring& text, U start, U ns);
 };
 
 
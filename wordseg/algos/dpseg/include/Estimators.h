@@ -1,6 +1,11 @@
 #ifndef _BATCHSAMPLER_H_
 #define _BATCHSAMPLER_H_
 
+#include <deque>
+#include <unordered_map>
+#include <utility>
+
+#include "Chart.h"
 #include "Sentence.h"
 #include "Unigrams.h"
 #include "Data.h"
@@ -49,7 +54,8 @@ protected:
     Sentences _sentences;
     Sentences _eval_sentences;
     U _nsentences_seen;
-    Scoring _scoring;
+    Scoring _scoring;       // tally of the training sentences
+    Scoring _eval_scoring;  // tally of the test sentences
 
     void resample_pya(Unigrams& lex);
     void resample_pyb(Unigrams& lex);
@@ -60,6 +66,7 @@ protected:
 
     F log_posterior(const Unigrams& lex) const;
     F log_posterior(const Unigrams& ulex, const Bigrams& lex) const;
+    void check_logprob(F logprob, F full_logprob) const;
 
     Fs predict_pairs(const TestPairs& test_pairs, const Unigrams& lex) const
         {
@@ -88,12 +95,11 @@ protected:
                 os << item << std::endl;
         }
 
-    void print_scores_sentences(std::wostream& os, const Sentences& sentences)
+    void print_scores_sentences(
+        std::wostream& os, const Sentences& sentences, Scoring& scoring)
         {
-            _scoring.reset();
-            for(const auto& item: sentences)
-                item.score(_scoring);
-            _scoring.print_results(os);
+            scoring.score(sentences);
+            scoring.print_results(os);
         }
 };
 
@@ -101,7 +107,8 @@ class Model: public ModelBase {
 public:
     Model(Data* constants):
         ModelBase(constants),
-        _base_dist(_constants->Pstop, _constants->nchartypes) {}
+        _base_dist(_constants->Pstop, _constants->nchartypes),
+        _niterations(0) {}
     virtual ~Model() {}
     virtual bool sanity_check() const
         {
@@ -120,7 +127,9 @@ public:
 
     //make single pass through test data, segmenting based on sampling
     //or maximization of each utt, using current counts from training
-    //data only (i.e. no new counts are added)
+    //data only (i.e. no new counts are added). The lexicon is read only
+    //meanwhile, so the utterances are segmented by --eval-threads
+    //threads
     virtual void run_eval(std::wostream& os, F temperature = 1, bool maximize=false);
 
     virtual void print_segmented(std::wostream& os) const
@@ -136,20 +145,47 @@ public:
     //recomputes and prints precision, recall, etc. on training data
     void print_scores(std::wostream& os)
         {
-            print_scores_sentences(os, _sentences);
+            print_scores_sentences(os, _sentences, _scoring);
         }
 
     //recomputes and prints precision, recall, etc. on training data
     void print_eval_scores(std::wostream& os)
         {
-            print_scores_sentences(os, _eval_sentences);
+            print_scores_sentences(os, _eval_sentences, _eval_scoring);
+        }
+
+    //prints how many word probabilities were memoized in the chart
+    //and read by the dynamic programs (only the bigram ones memoize them)
+    void print_chart_statistics(std::wostream& os) const
+        {
+            if (_chart.computed() == 0)
+                return;
+            os << "memoized word probabilities: " << _chart.computed() << " computed, "
+               << _chart.lookups() << " lookups, " << _chart.lookups_per_value()
+               << " lookups per value" << std::endl;
         }
 
+    //! save_state() writes the state of the chain to a binary file:
+    //! the segmentation, the restaurants and their hyperparameters,
+    //! the random number generator and the number of iterations done
+    void save_state(const std::string& filename) const;
+
+    //! load_state() restores a state written by save_state() on the
+    //! same data, so that estimate() resumes the saved chain exactly
+    void load_state(const std::string& filename);
+
 protected:
     P0 _base_dist;
+    Chart _chart;  // scratch space for the dynamic programs, reused across sentences
+    std::vector<Chart> _eval_charts;  // scratch space of the other threads of run_eval()
+    U _niterations;  // number of training iterations done so far
+    virtual void save_lexicons(std::ostream& os) const = 0;
+    virtual void load_lexicons(std::istream& is) = 0;
+    void checkpoint(U iteration);
     virtual void print_statistics(std::wostream& os, U iters, F temp, bool do_header=false) = 0;
     virtual void estimate_sentence(Sentence& s, F temperature) = 0;
-    virtual void estimate_eval_sentence(Sentence& s, F temperature, bool maximize = false) = 0;
+    virtual void estimate_eval_sentence(
+        Sentence& s, Chart& chart, F temperature, bool maximize = false) = 0;
 };
 
 class UnigramModel: public Model {
@@ -193,6 +229,8 @@ public:
 
 protected:
     Unigrams _lex;
+    virtual void save_lexicons(std::ostream& os) const;
+    virtual void load_lexicons(std::istream& is);
     virtual void print_statistics(std::wostream& os, U iters, F temp, bool do_header=false);
     virtual Bs hypersample(F temperature)
         {
@@ -200,7 +238,8 @@ protected:
         }
 
     virtual void estimate_sentence(Sentence& s, F temperature) = 0;
-    virtual void estimate_eval_sentence(Sentence& s, F temperature, bool maximize = false);
+    virtual void estimate_eval_sentence(
+        Sentence& s, Chart& chart, F temperature, bool maximize = false);
 };
 
 
@@ -235,12 +274,15 @@ public:
 protected:
   Unigrams _ulex;
   Bigrams _lex;
+  virtual void save_lexicons(std::ostream& os) const;
+  virtual void load_lexicons(std::istream& is);
   virtual void print_statistics(std::wostream& os, U iters, F temp, bool do_header=false);
   virtual Bs hypersample(F temperature){
     return ModelBase::hypersample(_ulex, _lex, temperature);
   }
   virtual void estimate_sentence(Sentence& s, F temperature) = 0;
-  virtual void estimate_eval_sentence(Sentence& s, F temperature, bool maximize = false);
+  virtual void estimate_eval_sentence(
+    Sentence& s, Chart& chart, F temperature, bool maximize = false);
 };
 
 class BatchUnigram: public UnigramModel {
@@ -281,6 +323,85 @@ protected:
   virtual void estimate_sentence(Sentence& s, F temperature);
 };
 
+//! BatchUnigramTypeSampler is a type-based block sampler (Liang,
+//! Jordan & Klein, 2010). The type of a possible boundary is the pair
+//! of words on each side of it. All the sites sharing the type of the
+//! visited site are sampled jointly: only the number of boundaries
+//! among them is drawn, and then the sites getting one. The sites of
+//! each type are indexed across the iterations, and reindexed when a
+//! flip changes the words around them.
+class BatchUnigramTypeSampler: public BatchUnigram {
+public:
+  BatchUnigramTypeSampler(Data* constants)
+      : BatchUnigram(constants), _indexed(false), _sweep(0), _nblocks(0) {}
+  virtual ~BatchUnigramTypeSampler() {}
+  virtual bool sanity_check() const;
+protected:
+  virtual void estimate_sentence(Sentence& s, F temperature);
+private:
+  typedef std::pair<S, S> SiteType;
+
+  struct SiteTypeHash
+  {
+      std::size_t operator()(const SiteType& t) const
+          {
+              return t.first.hash() * 1099511628211ul + t.second.hash();
+          }
+  };
+
+  //! a site of the current block with the word boundaries around it
+  struct BlockSite
+  {
+      U site, left, right;
+  };
+
+  bool _indexed;
+  U _sweep;     // number of sweeps started over the training sentences
+  U _nblocks;   // number of blocks sampled so far
+  Us _site_sentence;  // sentence and position of each site
+  Us _site_position;
+  Us _first_site;     // index of the first site of each sentence
+  std::vector<SiteType> _site_types;
+  Us _site_slot;   // position of each site in the list of its type
+  Us _site_sweep;  // last sweep each site was sampled in
+  Us _site_block;  // last block each site was a member of
+  std::unordered_map<SiteType, Us, SiteTypeHash> _sites_of_type;
+  Us _candidates;
+  std::vector<BlockSite> _block;
+  Fs _logp;
+
+  void index_sites();
+  SiteType site_type(U site, U& left, U& right) const;
+  void index_site(U site);
+  void unindex_site(U site);
+  void reindex_sites(U sentence, U left, U right);
+  bool conflicts(U sentence, U left, U right) const;
+  void sample_block(U site, F temperature);
+  void log_numerators(const S& word, U count, Fs& sums);
+  bool flip_agrees(const S& w1, const S& w2, F temperature);
+};
+
+//! SentencesSeen{} is the sequence of the utterance tokens seen so far
+//! by an online estimator. Each pass over the corpus adds a new token
+//! of every utterance, whose words are added to the lexicon. The
+//! sentence of the corpus is the token of the latest pass, the tokens
+//! of the earlier passes are copies keeping their own segmentation, so
+//! the decayed MCMC estimators can still resample them.
+class SentencesSeen {
+public:
+  //! push() adds the token of the current pass of *iter, to be
+  //! estimated in place in the corpus. The previous token of the same
+  //! utterance, if any, is moved to a copy.
+  void push(Sentences& sentences, Sentences::iterator iter);
+
+  U size() const {return _tokens.size();}
+  Sentence& operator[](U i) const {return *_tokens[i];}
+private:
+  std::vector<Sentence*> _tokens;
+  Us _latest;                     //!< [i] = index in _tokens of the latest token of utterance i
+  std::deque<Sentence> _earlier;  //!< tokens of the earlier passes, addresses are stable
+};
+
 class OnlineUnigram: public UnigramModel {
 public:
   OnlineUnigram(Data* constants, F forget_rate = 0):
@@ -289,9 +410,10 @@ public:
   virtual ~OnlineUnigram() {}
   virtual void estimate(U iters, std::wostream& os, U eval_iters = 0,
 						F temperature = 1, bool maximize = false, bool is_decayed = false);
+  virtual bool sanity_check() const;
 protected:
   F _forget_rate;
-  Sentences _sentences_seen; // for use with DeacyedMCMC model in particular
+  SentencesSeen _sentences_seen;  // for use with DeacyedMCMC model in particular
   virtual void estimate_sentence(Sentence& s, F temperature) = 0;
   void forget_items(Sentences::iterator i);
 };
@@ -323,18 +445,19 @@ public:
 protected:
   F _decay_rate;
   U _samples_per_utt;
-  Fs _decay_offset_probs;
+  Fs _decay_cum_probs;       //!< [i] = sum of the decay probs of offsets 0 to i-1
   F _cum_decay_prob;
   U _num_total_pot_boundaries;
   U _num_curr_pot_boundaries;
   Us _boundaries_num_sampled;
+  Us _sentence_offsets;      //!< [i] = # of potential boundaries before the ith seen sentence
   U _boundary_within_sentence;
-  Sentences::iterator _sentence_sampled;
-  virtual void decayed_initialization(Sentences _sentences);
+  U _sentence_sampled;       //!< index of the last sampled token in the sentences seen
+  virtual void decayed_initialization(const Sentences& sentences);
+  void extend_cum_probs(U noffsets);
   virtual void calc_new_cum_prob(Sentence& s, U num_boundaries);
   virtual U find_boundary_to_sample();
-  virtual void find_sent_to_sample(U b_to_sample, Sentence& to_sample, Sentences& sentences_seen);
-  void replace_sampled_sentence(Sentence s, Sentences& sentences_seen);
+  virtual Sentence& find_sent_to_sample(U b_to_sample, const SentencesSeen& sentences_seen);
 };
 
 
@@ -390,9 +513,10 @@ public:
   virtual void estimate(
       U iters, std::wostream& os, U eval_iters = 0,
       F temperature = 1, bool maximize = false, bool is_decayed = false);
+  virtual bool sanity_check() const;
 protected:
   F _forget_rate;
-  Sentences _sentences_seen; // for use with DeacyedMCMC model in particular
+  SentencesSeen _sentences_seen;  // for use with DeacyedMCMC model in particular
   virtual void estimate_sentence(Sentence& s, F temperature) = 0;
   void forget_items(Sentences::iterator i);
 };
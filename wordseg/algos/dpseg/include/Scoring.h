@@ -10,6 +10,9 @@
   Scoring class calculates number of words correct
   in each sentence and keeps a running tally.
   Calculates precision and recall, and lexicon precision.
+  The tally is kept up to date incrementally: once a set of sentences
+  has been scored, scoring it again only rescores the sentences whose
+  segmentation changed in the meantime.
 */
 class Scoring
 {
@@ -18,7 +21,8 @@ public:
         :
         _sentences(0), _words_correct(0),
         _segmented_words(0), _reference_words(0),
-        _bs_correct(0), _segmented_bs(0), _reference_bs(0)
+        _bs_correct(0), _segmented_bs(0), _reference_bs(0),
+        _lexicon_correct(0)
         {}
 
     double precision() const
@@ -69,6 +73,13 @@ public:
 
     void reset();
 
+    //! score() brings the tally up to date with the segmentation of
+    //! the sentences, which must be the same ones at each call (until
+    //! reset()). The reference words are counted the first time only,
+    //! afterwards a sentence is rescored only if its boundaries differ
+    //! from the ones it was last scored with.
+    void score(const Sentences& sentences);
+
     void print_results(std::wostream& os=std::wcout) const;
     void print_segmented_lexicon(std::wostream& os=std::wcout) const;
     void print_reference_lexicon(std::wostream& os=std::wcout) const;
@@ -85,7 +96,8 @@ public:
     typedef SGLexicon<S, Count> Lexicon;
 
     int lexicon_correct() const;
-    void add_words_to_lexicon(const Sentence::Words& words, Lexicon& lex);
+    void add_segmented_word(const S& word);
+    void remove_segmented_word(const S& word);
 
     int _sentences;      // number of sentences so far in block
     int _words_correct;  // tokens
@@ -96,6 +108,8 @@ public:
     int _reference_bs;
     Lexicon _segmented_lex;
     Lexicon _reference_lex;
+    int _lexicon_correct;  // segmented types also in the reference lexicon
+    std::vector<Bs> _scored_boundaries;  // segmentation of each sentence when last scored
 };
 
 
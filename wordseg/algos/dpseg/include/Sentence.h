@@ -2,6 +2,7 @@
 #define _SENTENCE_H_
 
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 
 #include "Unigrams.h"
@@ -15,6 +16,7 @@ typedef std::vector<U> Us;
 typedef std::vector<B> Bs;
 typedef std::vector<I> Is;
 
+class Chart;
 class Data;
 class Scoring;
 
@@ -53,6 +55,13 @@ public:
     // remove counts of whole sentence
     void erase_words(Bigrams& lex);
 
+    // add the words (unigram) or the pairs of consecutive words
+    // (bigram) of the segmentation to counts, as insert_words() adds
+    // them to a lexicon
+    typedef std::unordered_map<S, U> WordCounts;
+    void count_words(WordCounts& counts) const;
+    void count_words(std::unordered_map<S, WordCounts>& counts) const;
+
     U sample_by_flips(Unigrams& lex, F temperature);
     U sample_by_flips(Bigrams& lex, F temperature);
 
@@ -60,41 +69,56 @@ public:
     void sample_one_flip(Unigrams& lex, F temperature, U boundary_within_sentence);
     void sample_one_flip(Bigrams& lex, F temperature, U boundary_within_sentence);
 
-    void maximize(Unigrams& lex, U nsentences, F temperature, bool do_mbdp = 0);
-    void maximize(Bigrams& lex, U nsentences, F temperature);
+    void maximize(Unigrams& lex, Chart& chart, U nsentences, F temperature, bool do_mbdp = 0);
+    void maximize(Bigrams& lex, Chart& chart, U nsentences, F temperature);
+
+    void sample_tree(Unigrams& lex, Chart& chart, U nsentences, F temperature, bool do_mbdp = 0);
+    void sample_tree(Bigrams& lex, Chart& chart, U nsentences, F temperature);
 
-    void sample_tree(Unigrams& lex, U nsentences, F temperature, bool do_mbdp = 0);
-    void sample_tree(Bigrams& lex, U nsentences, F temperature);
+    // add the reference words and boundaries to the tally
+    void score_reference(Scoring& scoring) const;
 
-    void score(Scoring& scoring) const;
+    // add (sign = 1) or remove (sign = -1) the words and boundaries of
+    // a segmentation of the sentence to the tally
+    void score_segmentation(Scoring& scoring, const Bs& boundaries, I sign) const;
 
     friend std::wostream& operator<< (std::wostream& os, const Sentence& s);
 
-    Us get_possible_boundaries(){return _possible_boundaries;};
+    const Us& get_possible_boundaries() const {return _possible_boundaries;};
 
     Bs _boundaries;
 
+    S word_at(U left, U right) const
+        {
+            return S(left + begin_index(), right + begin_index());
+        }
+
+    // returns the two word boundaries on each side of position i
+    // (i1 and i2 delimit the words next to i, i0 and i3 their neighbours)
+    void surrounding_boundaries(U i, U& i0, U& i1, U& i2, U& i3) const;
+
+    // returns the probability of a boundary at position i, between
+    // the boundaries i1 and i2, as drawn by the unigram flip sampler
+    F prob_boundary(U i1, U i, U i2, const Unigrams& lex, F temperature) const;
+
 private:
     Us _possible_boundaries;
     Us _padded_possible;  // for use with dynamic programming
     Bs _true_boundaries;
     const Data* _constants;
 
-    S word_at(U left, U right) const
-        {
-            return S(left + begin_index(), right + begin_index());
-        }
-
     Words get_words(const Bs& boundaries) const;
     void insert(U left, U right, Unigrams& lex) const;
     void erase(U left, U right, Unigrams& lex) const;
     void insert(U i0, U i1, U i2, Bigrams& lex) const;
     void erase(U i0, U i1, U i2, Bigrams& lex) const;
-    F prob_boundary(U i1, U i, U i2, const Unigrams& lex, F temperature) const;
     F p_bigram(U i1, U i, U i2, const Bigrams& lex) const;
     F prob_boundary(U i0, U i1, U i, U i2, U i3, const Bigrams& lex, F temperature) const;
-    void surrounding_boundaries(U i, U& i0, U& i1, U& i2, U& i3) const;
     F mbdp_prob(Unigrams& lex, const S& word, U nsentences) const;
+    F unigram_logscore(Unigrams& lex, U i, U j, U nsentences,
+                       F log_p_continue, F temperature, bool do_mbdp) const;
+    F bigram_logscore(const Bigrams& lex, Chart& chart, U i, U j, U k, F temperature) const;
+    U bigram_positions(const Bigrams& lex, Chart& chart) const;
 };
 
 
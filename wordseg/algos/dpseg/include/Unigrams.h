@@ -14,17 +14,29 @@ private:
     typedef typename Base::argument_type V;
 
 public:
-    typedef std::unordered_map<V,typename parent::T> WordTypes;
+    typedef typename parent::V_T WordTypes;
 
     UnigramsT(Base& base, uniform01_type& u01, F a=0, F b=1)
         : parent(base, u01, a, b)
         {}
 
-    const WordTypes& types()
+    const WordTypes& types() const
         {
             return parent::label_tables;
         }
 
+    //! ids() is the interner of the words of the base distribution,
+    //! shared by the restaurants having this one as base
+    Interner<V>& ids()
+        {
+            return parent::base.ids();
+        }
+
+    const Interner<V>& ids() const
+        {
+            return parent::base.ids();
+        }
+
     std::wostream& print(std::wostream& os) const
         {
             os << "types = " << parent::ntypes()
@@ -44,19 +56,36 @@ public:
 };
 
 
+//! ContextTables{} is the type of the bigram restaurants of a
+//! BigramsT over Base, indexed by their context, R being a single
+//! restaurant. This is an unordered_map unless Base interns its
+//! labels, see Base.h.
+template <typename Base, typename R>
+struct ContextTables
+{
+    typedef std::unordered_map<typename Base::argument_type,R> type;
+
+    static type make(Base&)
+        {
+            return type();
+        }
+};
+
+
 //a set of bigram rest's
 template <typename Base>
-class BigramsT: public std::unordered_map<typename Base::argument_type,PYAdaptor<Base> >
+class BigramsT: public ContextTables<Base,PYAdaptor<Base> >::type
 {
     typedef typename Base::argument_type V;
-    typedef typename std::unordered_map<typename Base::argument_type,PYAdaptor<Base> > parent;
+    typedef typename ContextTables<Base,PYAdaptor<Base> >::type parent;
 
 public:
     typedef PYAdaptor<Base> BigramR;  // single bigram restaurant
     typedef typename Base::argument_type argument_type;
 
     BigramsT(Base& u, uniform01_type& u01, F a=0, F b=1)
-        : _base(u), _empty_bigram(_base, u01, a, b)
+        : parent(ContextTables<Base,BigramR>::make(u)),
+          _base(u), _empty_bigram(_base, u01, a, b), _logprob(0)
         {}
 
     const Base& base_dist() const
@@ -75,24 +104,41 @@ public:
         }
 
     F operator() (const V& w1, const V& w2) const
+        {
+            return (*this)(w1, w2, _base(w2));
+        }
+
+    //! operator() returns the probability of w2 following w1, given
+    //! the probability p_base of w2 under the unigram distribution
+    //! (when the caller has it memoized)
+    F operator() (const V& w1, const V& w2, F p_base) const
         {
             // if (debug_level >= 1000000) TRACE1(v);
             typename BigramsT::const_iterator it = this->find(w1);
             F prob;
             if (it == parent::end())
             {
-                prob = _base(w2);
+                prob = p_base;
                 if (debug_level >= 100000) TRACE2(w2,prob);
             }
             else
             {
-                prob = it->second(w2);
+                prob = it->second(w2, p_base);
                 if (debug_level >= 100000) TRACE2(w2,prob);
             }
 
             return prob;
         }
 
+    //! prob() is operator() for the words of ids id1 and id2, when
+    //! Base interns its words (see IdTables) and the caller has the
+    //! ids memoized
+    F prob(U id1, U id2, F p_base) const
+        {
+            typename BigramsT::const_iterator it = this->find_id(id1);
+            return it == parent::end() ? p_base : it->second.prob(id2, p_base);
+        }
+
     F insert(const V& w1, const V& w2)
         {
             assert(_empty_bigram.empty());
@@ -103,16 +149,42 @@ public:
                 typename BigramsT::value_type(w1, _empty_bigram)).first->second;
 
             assert(&b.base_dist() == &_empty_bigram.base_dist());
-            return b.insert(w2);
+            F lp0 = b.logprob();
+            F p = b.insert(w2);
+            _logprob += b.logprob() - lp0;
+            return p;
         }
 
     void erase(const V& w1, const V& w2)
         {
             typename BigramsT::iterator it = this->find(w1);
             assert(it != parent::end());
+            F lp0 = it->second.logprob();
             it->second.erase(w2);
+            _logprob += it->second.logprob() - lp0;
             if (it->second.empty())
-                std::unordered_map<V,BigramR>::erase(it);
+                parent::erase(it);
+        }
+
+    //! logprob() returns the log probability of the table assignments
+    //! of all the bigram restaurants, kept up to date by insert() and
+    //! erase()
+    F logprob() const
+        {
+            return _logprob;
+        }
+
+    //! full_logprob() recomputes logprob() from the tables of each
+    //! restaurant, see PYAdaptor::full_logprob()
+    F full_logprob() const
+        {
+            F logp = 0;
+            for(const auto& item: *this)
+            {
+                logp += item.second.full_logprob();
+                if (debug_level >= 125000) TRACE2(item.first, logp);
+            }
+            return logp;
         }
 
     bool sanity_check() const
@@ -126,6 +198,46 @@ public:
             return sane;
         }
 
+    //! save() writes the bigram restaurants in binary, see
+    //! PYAdaptor::save()
+    void save(std::ostream& os) const
+        {
+            _empty_bigram.save(os);
+            write_binary(os, parent::bucket_count());
+            write_binary(os, parent::size());
+            for(const auto& item: *this)
+            {
+                write_binary(os, item.first);
+                item.second.save(os);
+            }
+        }
+
+    //! load() replaces the bigram restaurants by the ones written by
+    //! save(), see PYAdaptor::load()
+    void load(std::istream& is)
+        {
+            _empty_bigram.load(is);
+
+            typename parent::size_type nbuckets = 0, nrestaurants = 0;
+            read_binary(is, nbuckets);
+            read_binary(is, nrestaurants);
+
+            std::vector<std::pair<V,BigramR> > items;
+            for (typename parent::size_type i = 0; i < nrestaurants and is; ++i)
+            {
+                V w1;
+                read_binary(is, w1);
+                items.push_back(std::pair<V,BigramR>(w1, _empty_bigram));
+                items.back().second.load(is);
+            }
+
+            restore_items(static_cast<parent&>(*this), nbuckets, items);
+
+            _logprob = 0;
+            for(const auto& item: *this)
+                _logprob += item.second.logprob();
+        }
+
     friend std::wostream& operator<< (std::wostream& os, const BigramsT& b)
         {
             os << "unigrams: " << b._base << std::endl;
@@ -141,6 +253,7 @@ public:
 private:
     Base& _base;
     BigramR _empty_bigram;
+    F _logprob;  //!< running sum of the log probabilities of the restaurants
 };
 
 #endif
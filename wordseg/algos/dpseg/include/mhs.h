@@ -24,16 +24,20 @@
 //! F erase(const V& v, S& s)             -- removes (v,s), returns exact prob of insert(v,s)
 //!
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <numeric>
 #include <functional>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <boost/iterator/indirect_iterator.hpp>
 
 #include "random-mt19937ar.h"
 #include "util.h"
@@ -43,6 +47,451 @@ typedef unsigned int U;  //!< 32-bit unsigned integers
 typedef double F;        //!< floating-point numbers
 extern U debug_level;
 
+//! TableSizes{} is the histogram of the tables of a label (or of all
+//! the labels) in a restaurant, mapping a number of customers at a table to the number
+//! of tables of that size. Entries are sorted by table size. Most
+//! labels only have one or two distinct table sizes, so these are
+//! stored inline and no memory is allocated for them. A label with
+//! more distinct sizes moves its entries to a sorted array on the
+//! heap, where finding a size is a binary search.
+class TableSizes
+{
+public:
+    typedef std::pair<U,U> value_type;  //!< table size, number of tables
+    typedef value_type* iterator;
+    typedef const value_type* const_iterator;
+
+    TableSizes()
+        : _size(0), _on_heap(false)
+        {}
+
+    iterator begin()
+        {
+            return _on_heap ? _heap.data() : _inline;
+        }
+
+    iterator end()
+        {
+            return begin() + _size;
+        }
+
+    const_iterator begin() const
+        {
+            return _on_heap ? _heap.data() : _inline;
+        }
+
+    const_iterator end() const
+        {
+            return begin() + _size;
+        }
+
+    //! size() is the number of distinct table sizes
+    U size() const
+        {
+            return _size;
+        }
+
+    bool empty() const
+        {
+            return _size == 0;
+        }
+
+    //! add() adds delta tables of the given size, removing the entry
+    //! when no table of that size is left
+    void add(U table_size, I delta)
+        {
+            iterator it = std::lower_bound(
+                begin(), end(), value_type(table_size, 0),
+                [](const value_type& x, const value_type& y){return x.first < y.first;});
+
+            if (it != end() and it->first == table_size)
+            {
+                assert(delta >= 0 or it->second >= U(-delta));
+                it->second += delta;
+                if (it->second == 0)
+                {
+                    std::copy(it + 1, end(), it);
+                    --_size;
+                }
+                return;
+            }
+
+            assert(delta > 0);
+            const std::ptrdiff_t index = it - begin();
+            if (not _on_heap and _size == inline_capacity)
+            {
+                _heap.assign(_inline, _inline + _size);
+                _on_heap = true;
+            }
+            if (_on_heap)
+                _heap.resize(_size + 1);
+
+            it = begin() + index;
+            std::copy_backward(it, end(), end() + 1);
+            *it = value_type(table_size, delta);
+            ++_size;
+        }
+
+    void clear()
+        {
+            _size = 0;
+            _on_heap = false;
+            _heap.clear();
+        }
+
+    friend std::wostream& operator<< (std::wostream& os, const TableSizes& t)
+        {
+            os << L'(';
+            const wchar_t* sep = L"";
+            for(const auto& item: t)
+            {
+                os << sep << L'(' << item.first << L' ' << item.second << L')';
+                sep = L" ";
+            }
+            return os << L')';
+        }
+
+private:
+    static const U inline_capacity = 2;
+
+    U _size;                          //!< number of distinct table sizes
+    bool _on_heap;                    //!< true if entries are in _heap
+    value_type _inline[inline_capacity];
+    std::vector<value_type> _heap;
+};
+
+
+//! no_id is the id of the labels never inserted in an Interner{}
+const U no_id = U(-1);
+
+//! Interner{} maps each distinct label it is given to a dense id.
+//! The tables holding a label acquire() its id and release() it, and
+//! the id of a label no table holds any more is given to the next new
+//! label, so the ids stay below the number of labels in use at once
+//! (rather than the number of labels ever seen, which grows without
+//! bound with the substrings visited by a long run).
+template <typename V>
+class Interner
+{
+public:
+    //! find() returns the id of v, or no_id
+    U find(const V& v) const
+        {
+            typename std::unordered_map<V,U>::const_iterator it = _ids.find(v);
+            return it == _ids.end() ? no_id : it->second;
+        }
+
+    //! insert() returns the id of v, giving it a free id if it is
+    //! new. The id of a new label is freed by its first release().
+    U insert(const V& v)
+        {
+            std::pair<typename std::unordered_map<V,U>::iterator, bool> it =
+                _ids.insert(std::make_pair(v, U(_labels.size())));
+            if (not it.second)
+                return it.first->second;
+
+            if (_free.empty())
+            {
+                _labels.push_back(v);
+                _refs.push_back(0);
+            }
+            else
+            {
+                it.first->second = _free.back();
+                _free.pop_back();
+                _labels[it.first->second] = v;
+            }
+            return it.first->second;
+        }
+
+    //! acquire() records one more table holding the label of id
+    void acquire(U id)
+        {
+            ++_refs[id];
+        }
+
+    //! release() records one table less holding the label of id, and
+    //! frees the id when no table holds it any more
+    void release(U id)
+        {
+            assert(_refs[id] > 0);
+            if (--_refs[id] == 0)
+            {
+                _ids.erase(_labels[id]);
+                _free.push_back(id);
+            }
+        }
+
+    //! size() is the number of ids given so far, an upper bound on
+    //! the ids in use
+    U size() const
+        {
+            return _labels.size();
+        }
+
+private:
+    std::unordered_map<V,U> _ids;
+    std::vector<V> _labels;  //!< label of each id
+    std::vector<U> _refs;    //!< number of tables holding each label
+    std::vector<U> _free;    //!< ids free to be given again
+};
+
+//! DenseSlots{} maps label ids to slots with a flat array indexed
+//! by id, for tables holding most of the labels of their interner
+class DenseSlots
+{
+public:
+    U find(U id) const
+        {
+            return id < _slots.size() ? _slots[id] : no_id;
+        }
+
+    void set(U id, U slot)
+        {
+            if (id >= _slots.size())
+                _slots.resize(id + 1, no_id);
+            _slots[id] = slot;
+        }
+
+    void unset(U id)
+        {
+            _slots[id] = no_id;
+        }
+
+    void clear()
+        {
+            _slots.clear();
+        }
+
+private:
+    std::vector<U> _slots;
+};
+
+//! SparseSlots{} maps label ids to slots with a hash map, for tables
+//! holding a few of the labels of their interner
+class SparseSlots
+{
+public:
+    U find(U id) const
+        {
+            std::unordered_map<U,U>::const_iterator it = _slots.find(id);
+            return it == _slots.end() ? no_id : it->second;
+        }
+
+    void set(U id, U slot)
+        {
+            _slots[id] = slot;
+        }
+
+    void unset(U id)
+        {
+            _slots.erase(id);
+        }
+
+    void clear()
+        {
+            _slots.clear();
+        }
+
+private:
+    std::unordered_map<U,U> _slots;
+};
+
+//! IdTables{} is the subset of the std::unordered_map interface used
+//! by PYAdaptor and BigramsT, for labels with ids in an Interner{}.
+//! The items are stored in an array, iterated in insertion order (an
+//! erased item is replaced by the last one), and found from the id of
+//! their label through Slots (DenseSlots or SparseSlots). Callers
+//! holding the id of a label use find_id() and skip hashing it.
+template <typename V, typename T, typename Slots>
+class IdTables
+{
+    typedef std::vector<std::unique_ptr<std::pair<const V,T> > > Items;
+
+public:
+    typedef V key_type;
+    typedef T mapped_type;
+    typedef std::pair<const V,T> value_type;
+    typedef std::size_t size_type;
+    typedef boost::indirect_iterator<typename Items::iterator> iterator;
+    typedef boost::indirect_iterator<typename Items::const_iterator, const value_type> const_iterator;
+
+    explicit IdTables(Interner<V>& ids)
+        : _ids(&ids)
+        {}
+
+    IdTables(const IdTables& other)
+        : _ids(other._ids), _slots(other._slots), _item_ids(other._item_ids)
+        {
+            _items.reserve(other._items.size());
+            for(const auto& item: other._items)
+                _items.emplace_back(new value_type(*item));
+            for(const auto& id: _item_ids)
+                _ids->acquire(id);
+        }
+
+    IdTables(IdTables&&) = default;
+
+    ~IdTables()
+        {
+            for(const auto& id: _item_ids)
+                _ids->release(id);
+        }
+
+    IdTables& operator=(const IdTables&) = delete;
+
+    iterator begin()
+        {
+            return iterator(_items.begin());
+        }
+
+    iterator end()
+        {
+            return iterator(_items.end());
+        }
+
+    const_iterator begin() const
+        {
+            return const_iterator(_items.begin());
+        }
+
+    const_iterator end() const
+        {
+            return const_iterator(_items.end());
+        }
+
+    size_type size() const
+        {
+            return _items.size();
+        }
+
+    bool empty() const
+        {
+            return _items.empty();
+        }
+
+    //! bucket_count() and rehash() only exist for compatibility with
+    //! std::unordered_map, see restore_items()
+    size_type bucket_count() const
+        {
+            return _items.size();
+        }
+
+    void rehash(size_type)
+        {}
+
+    //! find_id() returns the item of the label of the given id
+    iterator find_id(U id)
+        {
+            const U slot = _slots.find(id);
+            return slot == no_id ? end() : begin() + slot;
+        }
+
+    const_iterator find_id(U id) const
+        {
+            const U slot = _slots.find(id);
+            return slot == no_id ? end() : begin() + slot;
+        }
+
+    iterator find(const V& v)
+        {
+            return find_id(_ids->find(v));
+        }
+
+    const_iterator find(const V& v) const
+        {
+            return find_id(_ids->find(v));
+        }
+
+    //! insert() adds item if its label is new, returns the item of
+    //! that label and true if it was added
+    std::pair<iterator,bool> insert(const value_type& item)
+        {
+            const U id = _ids->insert(item.first);
+            const U slot = _slots.find(id);
+            if (slot != no_id)
+                return std::make_pair(begin() + slot, false);
+
+            _ids->acquire(id);
+            _slots.set(id, _items.size());
+            _item_ids.push_back(id);
+            _items.emplace_back(new value_type(item));
+            return std::make_pair(end() - 1, true);
+        }
+
+    T& operator[](const V& v)
+        {
+            iterator it = find(v);
+            return it == end() ? insert(value_type(v, T())).first->second : it->second;
+        }
+
+    //! erase() removes the item at it, moving the last item in its place
+    void erase(iterator it)
+        {
+            const std::size_t slot = it - begin();
+            _slots.unset(_item_ids[slot]);
+            _ids->release(_item_ids[slot]);
+            if (slot + 1 != _items.size())
+            {
+                _items[slot] = std::move(_items.back());
+                _item_ids[slot] = _item_ids.back();
+                _slots.set(_item_ids[slot], slot);
+            }
+            _items.pop_back();
+            _item_ids.pop_back();
+        }
+
+    void clear()
+        {
+            for(const auto& id: _item_ids)
+                _ids->release(id);
+            _items.clear();
+            _item_ids.clear();
+            _slots.clear();
+        }
+
+private:
+    Interner<V>* _ids;     //!< ids of the labels, shared by all the tables
+    Slots _slots;          //!< label id -> index in _items
+    Items _items;
+    std::vector<U> _item_ids;  //!< label id of each item
+};
+
+//! restore_items() fills tables with the items saved from tables of
+//! the same type, that had nbuckets buckets, so that they are iterated
+//! in the same order as when saved. An unordered_map gets the items in
+//! reverse order in as many buckets, IdTables{} in their saved order.
+template <typename V, typename T, typename Items>
+void restore_items(std::unordered_map<V,T>& tables, std::size_t nbuckets, const Items& items)
+{
+    tables.clear();
+    tables.rehash(nbuckets);
+    for (auto it = items.rbegin(); it != items.rend(); ++it)
+        tables.insert(*it);
+}
+
+template <typename V, typename T, typename Slots, typename Items>
+void restore_items(IdTables<V,T,Slots>& tables, std::size_t, const Items& items)
+{
+    tables.clear();
+    for(const auto& item: items)
+        tables.insert(item);
+}
+
+//! LabelTables{} is the type of the tables of each label of a
+//! PYAdaptor over Base, T being the tables of one label. This is an
+//! unordered_map unless Base interns its labels, see Base.h.
+template <typename Base, typename T>
+struct LabelTables
+{
+    typedef std::unordered_map<typename Base::argument_type,T> type;
+
+    static type make(Base&)
+        {
+            return type();
+        }
+};
+
 // Note that in this class, both the base distribution and the
 // parameters are actually reference variables, which means they must
 // exist *outside* the class.  For base distrib, this is so that
@@ -68,36 +517,55 @@ protected:
     U m;                  //!< number of occupied tables
     U n;                  //!< number of customers in restaurant
 
+    //! histogram of the tables of all the labels, so that logprob()
+    //! is a sum over the distinct table sizes rather than over the
+    //! labels
+    TableSizes table_sizes;
+
+    //! logprob() caches the table size term of the last a it was
+    //! evaluated at, until the tables change
+    mutable bool table_lp_valid;
+    mutable F table_lp_a;
+    mutable F table_lp;
+
+    //! running log probability of the tables, updated by insert()
+    //! and erase() as long as the parameters are still lp_a and lp_b
+    mutable bool lp_valid;
+    mutable F lp_a;
+    mutable F lp_b;
+    mutable F lp;
+
     typedef argument_type V;
-    typedef std::map<U,U> U_U;
 
     struct T
     {
-        U n;      //!< total number of customers at tables with this label
-        U m;      //!< number of tables with this label
-        U_U n_m;  //!< number of customers at table -> number of tables
+        U n;             //!< total number of customers at tables with this label
+        U m;             //!< number of tables with this label
+        TableSizes n_m;  //!< number of customers at table -> number of tables
 
         T() : n(), m() {}
 
         //! insert_old() inserts a customer at a random old table
-        //! using PY sampling distribution
+        //! using PY sampling distribution, returns the old size of
+        //! that table
         //
-        void insert_old(F r, F a) {
+        U insert_old(F r, F a) {
             // when r is not positive, we have reached our table
-            for (U_U::iterator it = n_m.begin(); it != n_m.end(); ++it)
+            for (TableSizes::iterator it = n_m.begin(); it != n_m.end(); ++it)
             {
                 if ((r -= it->second * (it->first - a)) <= 0)
                 {
-                    U n1 = it->first+1;  // new table size
-                    if (--it->second == 0)
-                        n_m.erase(it);
-                    ++n_m[n1];           // add customer to new table
-                    break;
+                    U n0 = it->first;    // old table size
+                    n_m.add(n0, -1);
+                    n_m.add(n0 + 1, 1);  // add customer to new table
+                    ++n;                 // increment no of customers with this label
+                    return n0;
                 }
             }
 
-            assert(r <= 0);          // check that we actually updated a table
-            ++n;                     // increment no of customers with this label
+            // shouldn't ever get here
+            assert(r <= 0);
+            return 0;
         }
 
         //! insert_new() inserts a customer at a new table
@@ -105,7 +573,7 @@ protected:
             {
                 ++n;
                 ++m;
-                ++n_m[1];
+                n_m.add(1, 1);
             }
 
         //! empty() is true if there are no customers left with this
@@ -121,17 +589,16 @@ protected:
         U erase(I r)
             {
                 --n;
-                for (U_U::iterator it = n_m.begin(); it != n_m.end(); ++it)
+                for (TableSizes::iterator it = n_m.begin(); it != n_m.end(); ++it)
                 {
                     if ((r -= it->first * it->second) <= 0)
                     {
                         U n1 = it->first-1;  //!< new table size
-                        if (--it->second == 0)
-                            n_m.erase(it);
+                        n_m.add(it->first, -1);
                         if (n1 == 0)
                             --m;
                         else
-                            ++n_m[n1];
+                            n_m.add(n1, 1);
                         return n1;
                     }
                 }
@@ -171,12 +638,14 @@ protected:
             }
     };
 
-    typedef std::unordered_map<V,T> V_T;
+    typedef typename LabelTables<Base,T>::type V_T;
     V_T label_tables;
 
 public:
     PYAdaptor(Base& base, uniform01_type& u01, F a, F b)
-        : base(base), u01(u01), a(a), b(b), m(), n()
+        : base(base), u01(u01), a(a), b(b), m(), n(), table_lp_valid(false),
+          lp_valid(true), lp_a(a), lp_b(b), lp(0),
+          label_tables(LabelTables<Base,T>::make(base))
         {}
 
     // note that copies of the adaptor will have a reference to the
@@ -240,6 +709,12 @@ public:
             return (tit == label_tables.end()) ? 0 : tit->second.n;
         }
 
+    U ntables(const V& v) const
+        {
+            typename V_T::const_iterator tit = label_tables.find(v);
+            return (tit == label_tables.end()) ? 0 : tit->second.m;
+        }
+
     const Base& base_dist() const
         {
             return base;
@@ -254,15 +729,24 @@ public:
     //! v, with context
     F operator() (const V& v) const
         {
-            if (debug_level >= 1000000) TRACE1(v);
-            typename V_T::const_iterator tit = label_tables.find(v);
-            F p_old = (tit == label_tables.end()) ? 0 : (tit->second.n - tit->second.m*a) / (n + b);
-            F p_new = base(v) * (m*a + b) / (n + b);
+            return (*this)(v, base(v));
+        }
 
-            assert(p_new > 0);
+    //! operator() returns the approximate probability for inserting
+    //! v, given its probability p_base under the base distribution
+    //! (when the caller has it memoized)
+    F operator() (const V& v, F p_base) const
+        {
+            if (debug_level >= 1000000) TRACE1(v);
+            return predictive(label_tables.find(v), p_base);
+        }
 
-            F sum_p = p_old + p_new;
-            return sum_p;
+    //! prob() is operator() for the label of the given id, when the
+    //! labels are interned (see IdTables) and the caller has the id
+    //! memoized
+    F prob(U id, F p_base) const
+        {
+            return predictive(label_tables.find_id(id), p_base);
         }
 
     //! insert() adds a customer to a table, and returns its
@@ -278,21 +762,28 @@ public:
 
             assert(p > 0);
             F r = p*u01();
+            F p_table;  // probability of the table chosen, up to (n + b)
             if (r <= p_old && tit != label_tables.end())
             {
                 // insert at an old table
                 assert(tit != label_tables.end());
-                tit->second.insert_old(r, a);
+                U n0 = tit->second.insert_old(r, a);
+                table_sizes.add(n0, -1);
+                table_sizes.add(n0 + 1, 1);
+                p_table = n0 - a;
             }
             else
             {
                 // insert customer at a new table
                 T& t = (tit == label_tables.end()) ? label_tables[v] : tit->second;
                 t.insert_new();
+                table_sizes.add(1, 1);
+                p_table = m*a + b;
                 ++m;    // one more table
                 base.insert(v);
             }
 
+            update_logprob(log(p_table / (n+b)));
             p /= (n+b); // normalize
             ++n;    // one more customer
             return p;
@@ -306,7 +797,12 @@ public:
             I r = (I) tit->second.n*u01();
             --n;  // one less customer
 
-            if (tit->second.erase(r) == 0)
+            U n1 = tit->second.erase(r);
+            table_sizes.add(n1 + 1, -1);
+            if (n1 > 0)
+                table_sizes.add(n1, 1);
+
+            if (n1 == 0)
             {
                 --m;
                 base.erase(v);
@@ -314,6 +810,8 @@ public:
                     label_tables.erase(tit);
             }
 
+            // the customer would have been inserted at that table
+            update_logprob(-log((n1 == 0 ? m*a + b : n1 - a) / (n+b)));
             return n;
         }
 
@@ -402,12 +900,60 @@ public:
         {
             m = n = 0;
             label_tables.clear();
+            table_sizes.clear();
+            table_lp_valid = false;
+            lp_valid = false;
         }
 
     //! logprob() returns the log probability of the table assignment in
     //! the adaptor.  You'll need to compute the base probability
-    //! yourself
+    //! yourself. This is the running log probability, only recomputed
+    //! when the parameters changed since it was last updated
     F logprob() const
+        {
+            if (not lp_valid or lp_a != a or lp_b != b)
+            {
+                lp = logprob(a, b);
+                lp_a = a;
+                lp_b = b;
+                lp_valid = true;
+            }
+            return lp;
+        }
+
+    //! logprob() returns the log probability of the table assignment
+    //! in the adaptor if its parameters were a and b, without
+    //! changing them. This only depends on the histogram of the table
+    //! sizes, so it is cheap enough to be called for each proposal of
+    //! the hyperparameter samplers
+    F logprob(F a, F b) const
+        {
+            if (not table_lp_valid or table_lp_a != a)
+            {
+                const F lgamma1 = lgamma(1 - a);
+                table_lp = 0;
+                for(const auto& item: table_sizes)
+                {
+                    table_lp += item.second * (lgamma(item.first - a) - lgamma1);
+                }
+                table_lp_a = a;
+                table_lp_valid = true;
+            }
+
+            F logp = table_lp;
+            if (a > 0)
+                logp += m*log(a) + lgamma(m + b/a) - lgamma(b/a);
+            else
+                logp += m*log(b);
+
+            logp -= lgamma(n + b) - lgamma(b);
+            return logp;
+        }
+
+    //! full_logprob() recomputes the log probability of the table
+    //! assignment from the tables of each label, to cross-check
+    //! logprob() when debugging
+    F full_logprob() const
         {
             F logp = 0;
             for(const auto& it0: label_tables)
@@ -427,6 +973,75 @@ public:
             return logp;
         }
 
+    //! save() writes the parameters and the tables of the adaptor in
+    //! binary, the labels in iteration order
+    void save(std::ostream& os) const
+        {
+            write_binary(os, a);
+            write_binary(os, b);
+            write_binary(os, m);
+            write_binary(os, n);
+            write_binary(os, label_tables.bucket_count());
+            write_binary(os, label_tables.size());
+            for(const auto& item: label_tables)
+            {
+                write_binary(os, item.first);
+                write_binary(os, item.second.n);
+                write_binary(os, item.second.m);
+                write_binary(os, item.second.n_m.size());
+                for(const auto& it1: item.second.n_m)
+                {
+                    write_binary(os, it1.first);
+                    write_binary(os, it1.second);
+                }
+            }
+        }
+
+    //! load() replaces the adaptor by the one written by save(). The
+    //! labels are restored so that they are iterated in the same order
+    //! (and logprob() sums them in the same order) as in the saved
+    //! adaptor, see restore_items()
+    void load(std::istream& is)
+        {
+            read_binary(is, a);
+            read_binary(is, b);
+            read_binary(is, m);
+            read_binary(is, n);
+
+            typename V_T::size_type nbuckets = 0, nlabels = 0;
+            read_binary(is, nbuckets);
+            read_binary(is, nlabels);
+
+            std::vector<std::pair<V,T> > items;
+            for (typename V_T::size_type i = 0; i < nlabels and is; ++i)
+            {
+                items.push_back(std::pair<V,T>());
+                read_binary(is, items.back().first);
+                read_binary(is, items.back().second.n);
+                read_binary(is, items.back().second.m);
+
+                U nsizes = 0;
+                read_binary(is, nsizes);
+                for (U j = 0; j < nsizes and is; ++j)
+                {
+                    U table_size = 0, ntables = 0;
+                    read_binary(is, table_size);
+                    read_binary(is, ntables);
+                    items.back().second.n_m.add(table_size, ntables);
+                }
+            }
+
+            restore_items(label_tables, nbuckets, items);
+            table_sizes.clear();
+            table_lp_valid = false;
+            lp_valid = false;
+            for(const auto& it0: items)
+            {
+                for(const auto& item: it0.second.n_m)
+                    table_sizes.add(item.first, item.second);
+            }
+        }
+
     //! prints the PY adaptor
     std::wostream& print(std::wostream& os) const
         {
@@ -456,20 +1071,51 @@ public:
 
             U nn = 0, mm = 0;
             bool sane_tables = true;
+            TableSizes sizes;
             for(const auto& item: label_tables)
             {
                 nn += item.second.n;
                 mm += item.second.m;
                 sane_tables = (sane_tables && item.second.sanity_check());
+                for(const auto& it1: item.second.n_m)
+                    sizes.add(it1.first, it1.second);
             }
 
             bool sane_n = (n == nn);
             bool sane_m = (m == mm);
+            bool sane_sizes = (sizes.size() == table_sizes.size()
+                               and std::equal(sizes.begin(), sizes.end(), table_sizes.begin()));
             assert(sane_n);
             assert(sane_m);
-            return sane_n && sane_m;
+            assert(sane_sizes);
+            return sane_n && sane_m && sane_sizes;
+        }
+
+private:
+    //! update_logprob() adds dlp, the change in log probability of an
+    //! insertion or erasure, to the running log probability. The table
+    //! size term at table_lp_a no longer holds after it.
+    void update_logprob(F dlp)
+        {
+            table_lp_valid = false;
+            if (lp_valid and lp_a == a and lp_b == b)
+                lp += dlp;
+            else
+                lp_valid = false;
         }
 
+    //! predictive() is the probability of inserting the label of the
+    //! tables at tit, given its base probability p_base
+    F predictive(typename V_T::const_iterator tit, F p_base) const
+        {
+            F p_old = (tit == label_tables.end()) ? 0 : (tit->second.n - tit->second.m*a) / (n + b);
+            F p_new = p_base * (m*a + b) / (n + b);
+
+            assert(p_new > 0);
+
+            F sum_p = p_old + p_new;
+            return sum_p;
+        }
 };
 
 template <typename Base>
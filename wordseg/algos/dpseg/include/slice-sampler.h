@@ -199,9 +199,9 @@ struct resample_pyb_type
         {
             // prior for pyb
             F logPrior = 0;
-            logPrior += pyb_logPrior(lex.pyb(), pyb_gamma_c, pyb_gamma_s);
+            logPrior += pyb_logPrior(pyb, pyb_gamma_c, pyb_gamma_s);
 
-            F logProb = lex.logprob();
+            F logProb = lex.logprob(lex.pya(), pyb);
             TRACE2(logPrior, logProb);
 
             return logProb+logPrior;
@@ -227,8 +227,8 @@ struct resample_pya_type
     F operator() (F pya) const
         {
             // prior for pya
-            F logPrior = pya_logPrior(lex.pya(), pya_beta_a, pya_beta_b);
-            F logProb = lex.logprob();
+            F logPrior = pya_logPrior(pya, pya_beta_a, pya_beta_b);
+            F logProb = lex.logprob(pya, lex.pyb());
             TRACE2(logPrior, logProb);
             return logPrior + logProb;
         }
@@ -56,6 +56,39 @@ std::wostream& operator<< (std::wostream& os, const std::vector<Value>& vs)
 
 
 
+//! write_binary() writes a value in the raw binary representation of
+//! the host. This is used for the sampler state files, which are not
+//! meant to be portable across architectures.
+template <typename T>
+void write_binary(std::ostream& os, const T& value)
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void write_binary(std::ostream& os, const std::vector<T>& values)
+{
+    write_binary(os, values.size());
+    os.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+//! read_binary() reads a value written by write_binary()
+template <typename T>
+void read_binary(std::istream& is, T& value)
+{
+    is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void read_binary(std::istream& is, std::vector<T>& values)
+{
+    typename std::vector<T>::size_type size = 0;
+    read_binary(is, size);
+    values.resize(is ? size : 0);
+    is.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T));
+}
+
+
 #define HERE   __FILE__ << ":" << __LINE__ << " in " << __func__
 
 #ifndef __STRING
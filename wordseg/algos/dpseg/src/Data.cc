@@ -1,5 +1,7 @@
 #include "Data.h"
 
+#include <iterator>
+
 using namespace std;
 
 
@@ -15,6 +17,91 @@ inline void error(const std::string s)
     error(s.c_str());
 }
 
+std::wstring read_utf8(std::istream& is)
+{
+    // read all the bytes at once, pre-sizing the buffer when the
+    // stream is seekable (i.e. a file, not stdin)
+    std::string bytes;
+    is.seekg(0, std::ios::end);
+    if (is)
+    {
+        std::streamoff size = is.tellg();
+        is.seekg(0, std::ios::beg);
+        bytes.resize(size);
+        is.read(&bytes[0], size);
+        bytes.resize(is.gcount());
+    }
+    else
+    {
+        is.clear();
+        bytes.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    }
+
+    // the number of bytes bounds the number of code points
+    std::wstring text;
+    text.reserve(bytes.size());
+
+    const unsigned char* it = reinterpret_cast<const unsigned char*>(bytes.data());
+    const unsigned char* end = it + bytes.size();
+    while (it != end)
+    {
+        // fast path for ASCII
+        if (*it < 0x80)
+        {
+            text.push_back(*it++);
+            continue;
+        }
+
+        const unsigned char* start = it;
+        unsigned int c;
+        U ncont;
+        if ((*it & 0xE0) == 0xC0)
+        {
+            c = *it & 0x1F;
+            ncont = 1;
+        }
+        else if ((*it & 0xF0) == 0xE0)
+        {
+            c = *it & 0x0F;
+            ncont = 2;
+        }
+        else if ((*it & 0xF8) == 0xF0)
+        {
+            c = *it & 0x07;
+            ncont = 3;
+        }
+        else
+        {
+            error("invalid UTF-8 byte in input at offset "
+                  + std::to_string(it - reinterpret_cast<const unsigned char*>(bytes.data())));
+        }
+
+        if (U(end - it) <= ncont)
+            error("truncated UTF-8 sequence at end of input");
+
+        ++it;
+        for (U k = 0; k < ncont; ++k, ++it)
+        {
+            if ((*it & 0xC0) != 0x80)
+                error("invalid UTF-8 continuation byte in input at offset "
+                      + std::to_string(it - reinterpret_cast<const unsigned char*>(bytes.data())));
+            c = (c << 6) | (*it & 0x3F);
+        }
+
+        // reject the overlong encodings (a code point encoded on more
+        // bytes than needed), the UTF-16 surrogates and the code points
+        // beyond U+10FFFF
+        static const unsigned int min_code_point[] = {0, 0x80, 0x800, 0x10000};
+        if (c < min_code_point[ncont] or (c >= 0xD800 and c <= 0xDFFF) or c > 0x10FFFF)
+            error("invalid UTF-8 sequence in input at offset "
+                  + std::to_string(start - reinterpret_cast<const unsigned char*>(bytes.data())));
+
+        text.push_back(static_cast<wchar_t>(c));
+    }
+
+    return text;
+}
+
 Data::Data() {}
 
 Data::~Data() {}
@@ -41,11 +128,27 @@ void Data::initialize_chars()
     // may have been set on commandline
     if (! nchartypes)
     {
+        // flags for the unicode range, a set for anything beyond
+        std::vector<bool> seen(0x110000, false);
         std::set<wchar_t> sc;   //!< used to calculate nchartypes
         for (U i = 0; i < S::data.size(); ++i)
-            if (S::data[i] != L'\n')
-                sc.insert(S::data[i]);
-        nchartypes = sc.size();
+        {
+            const wchar_t c = S::data[i];
+            if (c == L'\n')
+                continue;
+
+            if (U(c) < seen.size())
+            {
+                if (! seen[c])
+                {
+                    seen[c] = true;
+                    ++nchartypes;
+                }
+            }
+            else
+                sc.insert(c);
+        }
+        nchartypes += sc.size();
     }
 }
 
@@ -179,6 +282,12 @@ Sentences CorpusData::get_eval_sentences() const
 }
 
 void CorpusData::read(std::wistream& is, U start, U ns)
+{
+    read(std::wstring(std::istreambuf_iterator<wchar_t>(is),
+                      std::istreambuf_iterator<wchar_t>()), start, ns);
+}
+
+void CorpusData::read(const std::wstring& text, U start, U ns)
 {
     S::data.clear();
     sentenceboundaries.clear();
@@ -194,7 +303,7 @@ void CorpusData::read(std::wistream& is, U start, U ns)
 
     if (debug_level >= 99000) TRACE2(_true_boundaries, _possible_boundaries);
 
-    read_data(is, start, ns);
+    read_data(text, start, ns);
     if (debug_level >= 99000) TRACE(sentenceboundaries.size());
 
     ntrainsentences = ns;
@@ -213,30 +322,41 @@ void CorpusData::read(std::wistream& is, U start, U ns)
 // read additional data for evaluation. This will go into the same
 // S::data as the training data.
 void CorpusData::read_eval(std::wistream& is, U start, U ns)
+{
+    read_eval(std::wstring(std::istreambuf_iterator<wchar_t>(is),
+                           std::istreambuf_iterator<wchar_t>()), start, ns);
+}
+
+void CorpusData::read_eval(const std::wstring& text, U start, U ns)
 {
     _evalsent_start = sentenceboundaries.size()-1;
-    read_data(is, start, ns);
+    read_data(text, start, ns);
 }
 
-void CorpusData::read_data(std::wistream& is, U start, U ns)
+void CorpusData::read_data(const std::wstring& text, U start, U ns)
 {
     assert(S::data.size() >0);
     assert(*(S::data.end()-1) == L'\n');
     assert(*(sentenceboundaries.end()-1) == S::data.size());
 
-    U i = sentenceboundaries.size()-1;
-    U offset = i;
-    wchar_t c;
-    while (start > i- offset && is.get(c))
+    // skip the first start lines
+    std::size_t pos = 0;
+    for (U i = 0; i < start and pos < text.size(); ++i)
     {
-        if (c == L'\n')
-            i++;
+        pos = text.find(L'\n', pos);
+        pos = (pos == std::wstring::npos ? text.size() : pos + 1);
     }
-    i=0;
+
+    // the remaining text bounds the size of the data to be read
+    const std::size_t capacity = S::data.size() + (text.size() - pos) + 1;
+    S::data.reserve(capacity);
+    _true_boundaries.reserve(capacity);
+    _possible_boundaries.reserve(capacity);
 
     //ns == 0 means read all data
-    while (is.get(c) && (ns==0 || i < ns))
+    for (U i = 0; pos < text.size() && (ns==0 || i < ns); ++pos)
     {
+        const wchar_t c = text[pos];
         if (c == L' ')
         {
             _true_boundaries.push_back(true);
@@ -288,6 +408,8 @@ void CorpusData::read_data(std::wistream& is, U start, U ns)
     assert(*(sentenceboundaries.end()-1) == S::data.size());
     assert(_true_boundaries.size() == _possible_boundaries.size());
     assert(S::data.size() == _possible_boundaries.size());
+
+    S::index();
 }
 
 void CorpusData::initialize(U ns)
@@ -398,6 +520,7 @@ void ExperimentalData::read(std::wistream& is, U start, U ns)
         S::data.push_back(L'\n');
         _testboundaries.push_back(S::data.size());
     }
+    S::index();
     initialize_chars();
     //  _current_pair = _test_pairs.begin();
 }
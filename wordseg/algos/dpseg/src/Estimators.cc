@@ -1,12 +1,19 @@
 #include "Estimators.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <thread>
 
 using namespace std;
 
 
 // using the random number generator defined in dpseg.cc
-extern uniform01_type unif01;
+extern thread_local uniform01_type unif01;
 
 
 // returns a random double between 0 and n, inclusive
@@ -32,6 +39,9 @@ inline double normal_density (double val, double mean=0, double std=1)
 template<typename T>
 inline std::vector<T>& operator+= (std::vector<T>& a, const std::vector<T>& b)
 {
+    // an empty vector stands for zeros
+    if (a.empty())
+        a.resize(b.size());
     assert(a.size() == b.size());
 
     for (size_t i=0; i < a.size(); i++)
@@ -75,7 +85,11 @@ F ModelBase::log_posterior(const Unigrams& lex) const
         - 2*lgamma(tau) - lgamma(lex.ntokens() + 2*tau);
     if (debug_level >= 110000) TRACE(lp2);
     F lp3 = lex.logprob(); //table probs
-    if (debug_level >= 110000) TRACE(lp3);
+    if (debug_level >= 110000)
+    {
+        TRACE(lp3);
+        check_logprob(lp3, lex.full_logprob());
+    }
     return lp1 + lp2 + lp3;
 }
 
@@ -85,19 +99,152 @@ F ModelBase::log_posterior(const Unigrams& ulex, const Bigrams& lex) const
     F lp1 = ulex.base_dist().logprob(); // word probabilities
     if (debug_level >= 110000) TRACE(lp1);
     F lp2 = ulex.logprob(); // unigram table probabilities
-    if (debug_level >= 110000) TRACE(lp2);
-    F lp3 = 0;
-    for(const auto& item: lex)
+    if (debug_level >= 110000)
     {
-        lp3 += item.second.logprob();  // bigram table probabilities
-        if (debug_level >= 125000) TRACE2(item.first, lp3);
+        TRACE(lp2);
+        check_logprob(lp2, ulex.full_logprob());
+    }
+    F lp3 = lex.logprob(); // bigram table probabilities
+    if (debug_level >= 110000)
+    {
+        TRACE(lp3);
+        check_logprob(lp3, lex.full_logprob());
     }
-
-    // = lex.logprob(); // table probs
-    if (debug_level >= 110000) TRACE(lp3);
     return lp1 + lp2 + lp3;
 }
 
+// aborts if the running log probability of a lexicon drifted away from
+// its full recomputation
+void ModelBase::check_logprob(F logprob, F full_logprob) const
+{
+    if (std::abs(logprob - full_logprob) > 1e-6 * std::max(F(1), std::abs(full_logprob)))
+    {
+        TRACE2(logprob, full_logprob);
+        error("running log probability differs from its recomputation\n");
+    }
+}
+
+// state files begin with this, followed by a format version
+static const char state_magic[] = "dpseg-state";
+static const U state_version = 1;
+
+void Model::save_state(const std::string& filename) const
+{
+    // write to a temporary file first so that a job killed while
+    // saving keeps its previous state
+    const std::string tmp = filename + ".tmp";
+    std::ofstream os(tmp.c_str(), std::ios::binary);
+    if (! os)
+        error("couldn't open state file " + tmp);
+
+    os.write(state_magic, sizeof(state_magic));
+    write_binary(os, state_version);
+
+    // check the data is the same when loading
+    write_binary(os, S::data.size());
+    write_binary(os, _sentences.size());
+
+    write_binary(os, _niterations);
+    write_binary(os, _nsentences_seen);
+    for(const auto& sent: _sentences)
+        write_binary(os, sent._boundaries);
+
+    _base_dist.save(os);
+    save_lexicons(os);
+
+    write_binary(os, unif01.mt);
+    write_binary(os, unif01.mti);
+
+    os.close();
+    if (! os or std::rename(tmp.c_str(), filename.c_str()) != 0)
+        error("couldn't write state file " + filename);
+}
+
+void Model::load_state(const std::string& filename)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary);
+    if (! is)
+        error("couldn't open state file " + filename);
+
+    char magic[sizeof(state_magic)];
+    U version = 0;
+    is.read(magic, sizeof(magic));
+    read_binary(is, version);
+    if (! is or std::memcmp(magic, state_magic, sizeof(magic)) != 0 or version != state_version)
+        error(filename + " is not a dpseg state file");
+
+    std::size_t nchars = 0, nsentences = 0;
+    read_binary(is, nchars);
+    read_binary(is, nsentences);
+    if (nchars != S::data.size() or nsentences != _sentences.size())
+        error("state file " + filename + " was saved on different data");
+
+    read_binary(is, _niterations);
+    read_binary(is, _nsentences_seen);
+    for(auto& sent: _sentences)
+    {
+        const std::size_t size = sent._boundaries.size();
+        read_binary(is, sent._boundaries);
+        if (sent._boundaries.size() != size)
+            error("state file " + filename + " was saved on different data");
+    }
+
+    _base_dist.load(is);
+    load_lexicons(is);
+
+    read_binary(is, unif01.mt);
+    read_binary(is, unif01.mti);
+
+    if (! is)
+        error("state file " + filename + " is truncated or was saved by another model");
+}
+
+//! checkpoint() saves the state after the given iteration, if asked
+//! to on the command line
+void Model::checkpoint(U iteration)
+{
+    _niterations = iteration;
+    if (! _constants->save_state.empty() and _constants->save_state_every > 0
+        and iteration % _constants->save_state_every == 0)
+        save_state(_constants->save_state);
+}
+
+void UnigramModel::save_lexicons(std::ostream& os) const
+{
+    write_binary(os, U(1));
+    _lex.save(os);
+}
+
+void UnigramModel::load_lexicons(std::istream& is)
+{
+    U ngram = 0;
+    read_binary(is, ngram);
+    if (ngram != 1)
+        is.setstate(std::ios::failbit);
+    else
+        _lex.load(is);
+}
+
+void BigramModel::save_lexicons(std::ostream& os) const
+{
+    write_binary(os, U(2));
+    _ulex.save(os);
+    _lex.save(os);
+}
+
+void BigramModel::load_lexicons(std::istream& is)
+{
+    U ngram = 0;
+    read_binary(is, ngram);
+    if (ngram != 2)
+        is.setstate(std::ios::failbit);
+    else
+    {
+        _ulex.load(is);
+        _lex.load(is);
+    }
+}
+
 void ModelBase::resample_pyb(Unigrams& lex)
 {
     // number of resampling iterations
@@ -251,12 +398,56 @@ bool ModelBase::sample_hyperparm(F& beta, bool is_prob, F temp)
 // only (i.e. no new counts are added)
 void Model::run_eval(std::wostream& os, F temp, bool maximize)
 {
-    for(auto& sent: _eval_sentences)
+    // the serial pass draws from the model's random stream, so that the
+    // test segmentation and the rest of the chain are the same as in
+    // previous versions
+    if (_constants->eval_threads <= 1)
     {
-        if (debug_level >= 10000) sent.print(std::wcerr);
-        estimate_eval_sentence(sent, temp, maximize);
+        for(auto& sent: _eval_sentences)
+        {
+            if (debug_level >= 10000) sent.print(std::wcerr);
+            estimate_eval_sentence(sent, _chart, temp, maximize);
+        }
+
+        assert(sanity_check());
+        return;
     }
 
+    const U nsentences = _eval_sentences.size();
+    const U nthreads = std::max(1u, std::min(_constants->eval_threads, nsentences));
+
+    // with several threads, each utterance draws from its own random
+    // stream, seeded from a single draw of the model's one, so that the
+    // segmentation does not depend on the number of threads
+    const U seed = maximize ? 0 : U(unif01() * std::numeric_limits<U>::max());
+    const uniform01_type model_unif01 = unif01;
+
+    // the calling thread segments with the model's chart, the others
+    // with their own, the utterances being handed out in order
+    std::atomic<U> next_sentence(0);
+    auto segment = [&](Chart& chart)
+    {
+        for(U i = next_sentence++; i < nsentences; i = next_sentence++)
+        {
+            if (debug_level >= 10000) _eval_sentences[i].print(std::wcerr);
+            if (! maximize)
+                unif01.seed(seed + i);
+            estimate_eval_sentence(_eval_sentences[i], chart, temp, maximize);
+        }
+    };
+
+    _eval_charts.resize(nthreads - 1);
+    std::vector<std::thread> workers;
+    for(U t = 0; t + 1 < nthreads; t++)
+        workers.emplace_back(segment, std::ref(_eval_charts[t]));
+    segment(_chart);
+
+    for(auto& worker: workers)
+        worker.join();
+    for(auto& chart: _eval_charts)
+        _chart.merge_statistics(chart);
+
+    unif01 = model_unif01;
     assert(sanity_check());
 }
 
@@ -278,14 +469,15 @@ void UnigramModel::print_statistics(wostream& os, U iter, F temp, bool header)
     print_scores(os);
 }
 
-void UnigramModel::estimate_eval_sentence(Sentence& s, F temperature, bool maximize)
+void UnigramModel::estimate_eval_sentence(
+    Sentence& s, Chart& chart, F temperature, bool maximize)
 {
     if (maximize)
         s.maximize(
-            _lex, _constants->nsentences()-1, temperature, _constants->do_mbdp);
+            _lex, chart, _constants->nsentences()-1, temperature, _constants->do_mbdp);
     else
         s.sample_tree(
-            _lex, _constants->nsentences()-1, temperature, _constants->do_mbdp);
+            _lex, chart, _constants->nsentences()-1, temperature, _constants->do_mbdp);
 }
 
 void BigramModel::print_statistics(wostream& os, U iter, F temp, bool header)
@@ -308,15 +500,16 @@ void BigramModel::print_statistics(wostream& os, U iter, F temp, bool header)
     print_scores(os);
 }
 
-void BigramModel::estimate_eval_sentence(Sentence& s, F temperature, bool maximize)
+void BigramModel::estimate_eval_sentence(
+    Sentence& s, Chart& chart, F temperature, bool maximize)
 {
     if (maximize)
     {
-        s.maximize(_lex, _constants->nsentences()-1, temperature);
+        s.maximize(_lex, chart, _constants->nsentences()-1, temperature);
     }
     else
     {
-        s.sample_tree(_lex, _constants->nsentences()-1, temperature);
+        s.sample_tree(_lex, chart, _constants->nsentences()-1, temperature);
     }
 }
 
@@ -341,12 +534,18 @@ void BatchUnigram::estimate(
         print_statistics(os, 0, 0, true);
     }
 
-    //number of accepts in hyperparm resampling. Init to correct length.
-    Bs accepted_anneal(hypersample(1).size());
-    Bs accepted(hypersample(1).size());
+    //number of accepts in hyperparm resampling. Init to correct
+    //length, only when starting a new chain as this samples the
+    //hyperparameters (a resumed chain must not draw more numbers).
+    Bs accepted_anneal, accepted;
+    if (_niterations == 0)
+    {
+        accepted_anneal.resize(hypersample(1).size());
+        accepted.resize(hypersample(1).size());
+    }
     U nanneal = 0;
     U n = 0;
-    for (U i=1; i <= iters; i++)
+    for (U i = _niterations + 1; i <= iters; i++)
     {
         //U nchanged = 0; // if need to print out, use later
         F temperature = _constants->anneal_temperature(i);
@@ -357,7 +556,7 @@ void BatchUnigram::estimate(
 
             // run evaluation over test set
             run_eval(os,temp,maximize);
-            print_eval_scores(wcout);
+            print_eval_scores(os);
 	}
 
         for(auto& sent: _sentences)
@@ -386,6 +585,8 @@ void BatchUnigram::estimate(
             print_statistics(os, i, temperature);
         }
         assert(sanity_check());
+
+        checkpoint(i);
     }
 
     os << "hyperparm accept rate: ";
@@ -400,7 +601,7 @@ void BatchUnigram::estimate(
 void BatchUnigramViterbi::estimate_sentence(Sentence& s, F temperature)
 {
     s.erase_words(_lex);
-    s.maximize(_lex, _constants->nsentences()-1, temperature, _constants->do_mbdp);
+    s.maximize(_lex, _chart, _constants->nsentences()-1, temperature, _constants->do_mbdp);
     s.insert_words(_lex);
 }
 
@@ -412,10 +613,310 @@ void BatchUnigramFlipSampler::estimate_sentence(Sentence& s, F temperature)
 void BatchUnigramTreeSampler::estimate_sentence(Sentence& s, F temperature)
 {
     s.erase_words(_lex);
-    s.sample_tree(_lex, _constants->nsentences()-1, temperature, _constants->do_mbdp);
+    s.sample_tree(_lex, _chart, _constants->nsentences()-1, temperature, _constants->do_mbdp);
     s.insert_words(_lex);
 }
 
+void BatchUnigramTypeSampler::estimate_sentence(Sentence& s, F temperature)
+{
+    if (not _indexed)
+        index_sites();
+
+    // a new sweep starts with the first sentence
+    U sentence = &s - &_sentences[0];
+    if (sentence == 0)
+        ++_sweep;
+
+    // sample the block of each site not already sampled in this sweep
+    for (U site = _first_site[sentence]; site < _first_site[sentence+1]; ++site)
+        if (_site_sweep[site] != _sweep)
+            sample_block(site, temperature);
+}
+
+void BatchUnigramTypeSampler::index_sites()
+{
+    _first_site.assign(1, 0);
+    _site_sentence.clear();
+    _site_position.clear();
+    for (U i = 0; i < _sentences.size(); ++i)
+    {
+        for (const auto& position: _sentences[i].get_possible_boundaries())
+        {
+            _site_sentence.push_back(i);
+            _site_position.push_back(position);
+        }
+        _first_site.push_back(_site_position.size());
+    }
+
+    const U nsites = _site_position.size();
+    _site_types.assign(nsites, SiteType());
+    _site_slot.assign(nsites, 0);
+    _site_sweep.assign(nsites, 0);
+    _site_block.assign(nsites, 0);
+    _sites_of_type.clear();
+    for (U site = 0; site < nsites; ++site)
+        index_site(site);
+
+    if (debug_level >= 1000)
+        wcout << "indexed " << nsites << " sites of "
+              << _sites_of_type.size() << " types" << endl;
+    _indexed = true;
+}
+
+BatchUnigramTypeSampler::SiteType
+BatchUnigramTypeSampler::site_type(U site, U& left, U& right) const
+{
+    const Sentence& s = _sentences[_site_sentence[site]];
+    const U i = _site_position[site];
+    U i0, i3;
+    s.surrounding_boundaries(i, i0, left, right, i3);
+    return SiteType(s.word_at(left, i), s.word_at(i, right));
+}
+
+void BatchUnigramTypeSampler::index_site(U site)
+{
+    U left, right;
+    _site_types[site] = site_type(site, left, right);
+    Us& sites = _sites_of_type[_site_types[site]];
+    _site_slot[site] = sites.size();
+    sites.push_back(site);
+}
+
+void BatchUnigramTypeSampler::unindex_site(U site)
+{
+    auto it = _sites_of_type.find(_site_types[site]);
+    assert(it != _sites_of_type.end());
+    Us& sites = it->second;
+    assert(sites[_site_slot[site]] == site);
+
+    // move the last site of the list in place of the removed one
+    sites[_site_slot[site]] = sites.back();
+    _site_slot[sites.back()] = _site_slot[site];
+    sites.pop_back();
+    if (sites.empty())
+        _sites_of_type.erase(it);
+}
+
+void BatchUnigramTypeSampler::reindex_sites(U sentence, U left, U right)
+{
+    // the types of the sites from left to right (included) depend
+    // on the words between left and right
+    const Us& positions = _sentences[sentence].get_possible_boundaries();
+    U site = _first_site[sentence] +
+        (std::lower_bound(positions.begin(), positions.end(), left) - positions.begin());
+    for (; site < _first_site[sentence+1] and _site_position[site] <= right; ++site)
+    {
+        unindex_site(site);
+        index_site(site);
+    }
+}
+
+bool BatchUnigramTypeSampler::conflicts(U sentence, U left, U right) const
+{
+    // two sites of the same type overlap when one of them lies in the
+    // words surrounding the other one (boundaries included)
+    const Us& positions = _sentences[sentence].get_possible_boundaries();
+    U site = _first_site[sentence] +
+        (std::lower_bound(positions.begin(), positions.end(), left) - positions.begin());
+    for (; site < _first_site[sentence+1] and _site_position[site] <= right; ++site)
+        if (_site_block[site] == _nblocks)
+            return true;
+    return false;
+}
+
+void BatchUnigramTypeSampler::log_numerators(const S& word, U count, Fs& sums)
+{
+    // sums[k] is the log of the product of the (unnormalized)
+    // predictive probabilities of k new tokens of word, the tables
+    // being kept fixed (this is exact when pya = 0)
+    const F p_new = _lex.base_dist()(word) * (_lex.ntables() * _lex.pya() + _lex.pyb());
+    const F p_old = _lex.ntokens(word) - _lex.ntables(word) * _lex.pya();
+    sums.resize(count + 1);
+    sums[0] = 0;
+    for (U k = 0; k < count; ++k)
+        sums[k+1] = sums[k] + log(p_old + k + p_new);
+}
+
+void BatchUnigramTypeSampler::sample_block(U site, F temperature)
+{
+    // gather the sites of the same type which do not overlap, starting
+    // with the visited one. The order of the lists depends on the
+    // history of the index, the sites are sorted so that a chain
+    // resumed by load_state() draws the same blocks
+    ++_nblocks;
+    _block.clear();
+    U left, right;
+    const SiteType type = site_type(site, left, right);
+    assert(type == _site_types[site]);
+    _site_block[site] = _nblocks;
+    _block.push_back({site, left, right});
+    _candidates = _sites_of_type[type];
+    std::sort(_candidates.begin(), _candidates.end());
+    for (const auto& other: _candidates)
+    {
+        site_type(other, left, right);
+        if (not conflicts(_site_sentence[other], left, right))
+        {
+            _site_block[other] = _nblocks;
+            _block.push_back({other, left, right});
+        }
+    }
+
+    // remove their words from the lexicon
+    const S& w1 = type.first;
+    const S& w2 = type.second;
+    const S w12 = _sentences[_site_sentence[_block[0].site]].word_at(
+        _block[0].left, _block[0].right);
+    for (const auto& b: _block)
+    {
+        if (_sentences[_site_sentence[b.site]]._boundaries[_site_position[b.site]])
+        {
+            _lex.erase(w1);
+            _lex.erase(w2);
+        }
+        else
+        {
+            _lex.erase(w12);
+        }
+    }
+
+    // log probability of having m boundaries among the n sites, that
+    // is (n choose m) times the probability of inserting n - m tokens
+    // of w12, m tokens of w1 and w2 and m word continuations
+    const U n = _block.size();
+    Fs l1, l2, l12;
+    log_numerators(w12, n, l12);
+    if (w1 == w2)
+    {
+        log_numerators(w1, 2*n, l1);
+    }
+    else
+    {
+        log_numerators(w1, n, l1);
+        log_numerators(w2, n, l2);
+    }
+
+    // with all the n sites merged there are ntokens + n tokens, of
+    // which ntokens + n - nsentences are followed by another word, and
+    // each boundary adds one token and one continuation
+    const F ntokens = _lex.ntokens();
+    const F pyb = _lex.pyb();
+    const F aeos = _constants->aeos;
+    const F ncontinue = ntokens - _constants->nsentences() + n;
+    _logp.resize(n + 1);
+    F denominators = 0, continuations = 0;
+    for (U k = 0; k < n; ++k)
+        denominators += log(ntokens + k + pyb);
+    for (U m = 0; m <= n; ++m)
+    {
+        F lp = l12[n-m] + (w1 == w2 ? l1[2*m] : l1[m] + l2[m])
+            + continuations - denominators;
+        _logp[m] = lp / temperature + lgamma(n + 1) - lgamma(m + 1) - lgamma(n - m + 1);
+
+        denominators += log(ntokens + n + m + pyb);
+        continuations += log((ncontinue + m + aeos/2) / (ntokens + n + m + aeos));
+    }
+    assert(n > 1 or flip_agrees(w1, w2, temperature));
+
+    // draw the number of boundaries
+    const F max_logp = *std::max_element(_logp.begin(), _logp.end());
+    F sum_p = 0;
+    for (auto& lp: _logp)
+    {
+        lp = exp(lp - max_logp);
+        sum_p += lp;
+    }
+    F r = sum_p * unif01();
+    U m = 0;
+    while (m < n and r >= _logp[m])
+        r -= _logp[m++];
+    if (debug_level >= 20000) TRACE4(w1, w2, n, m);
+
+    // the first m sites of a random permutation get a boundary
+    for (U k = 0; k < m; ++k)
+    {
+        U j = k + U((n - k) * unif01());
+        if (j >= n)
+            j = n - 1;
+        std::swap(_block[k], _block[j]);
+    }
+
+    for (U k = 0; k < n; ++k)
+    {
+        const BlockSite& b = _block[k];
+        Sentence& s = _sentences[_site_sentence[b.site]];
+        const U i = _site_position[b.site];
+        const bool boundary = k < m;
+        if (boundary)
+        {
+            _lex.insert(s.word_at(b.left, i));
+            _lex.insert(s.word_at(i, b.right));
+        }
+        else
+        {
+            _lex.insert(s.word_at(b.left, b.right));
+        }
+
+        if (s._boundaries[i] != boundary)
+        {
+            // the site keeps its type, but the words around it change
+            s._boundaries[i] = boundary;
+            reindex_sites(_site_sentence[b.site], b.left, b.right);
+        }
+        _site_sweep[b.site] = _sweep;
+    }
+}
+
+bool BatchUnigramTypeSampler::flip_agrees(const S& w1, const S& w2, F temperature)
+{
+    // a block of one site draws its boundary as the flip sampler,
+    // except that the flip sampler computes the probabilities of w1
+    // and w2 on the same lexicon, whereas the block inserts w1 before
+    // w2: this adds a token to the denominator of w2, and to its
+    // numerator when w1 == w2
+    const BlockSite& b = _block[0];
+    const Sentence& s = _sentences[_site_sentence[b.site]];
+    const F pb = s.prob_boundary(b.left, _site_position[b.site], b.right, _lex, temperature);
+
+    const F ntokens = _lex.ntokens();
+    const F pyb = _lex.pyb();
+    F shift = log((ntokens + pyb) / (ntokens + 1 + pyb));
+    if (w1 == w2)
+    {
+        const F p_w1 = _lex.base_dist()(w1) * (_lex.ntables() * _lex.pya() + pyb)
+            + _lex.ntokens(w1) - _lex.ntables(w1) * _lex.pya();
+        shift += log((p_w1 + 1) / p_w1);
+    }
+
+    const F p = 1 / (1 + exp(_logp[0] - _logp[1] + shift / temperature));
+    const bool agrees = fabs(p - pb) < 1e-9;
+    if (not agrees) TRACE5(w1, w2, p, pb, shift);
+    return agrees;
+}
+
+bool BatchUnigramTypeSampler::sanity_check() const
+{
+    bool sane = BatchUnigram::sanity_check();
+    if (not _indexed)
+        return sane;
+
+    U nindexed = 0;
+    for (const auto& item: _sites_of_type)
+    {
+        nindexed += item.second.size();
+        for (U slot = 0; slot < item.second.size(); ++slot)
+        {
+            const U site = item.second[slot];
+            U left, right;
+            sane = sane && _site_slot[site] == slot;
+            sane = sane && site_type(site, left, right) == item.first;
+        }
+    }
+    sane = sane && nindexed == _site_position.size();
+    assert(sane);
+    return sane;
+}
+
 DecayedMCMC::DecayedMCMC(F decay_rate, U samples_per_utt)
 {
     if(debug_level >= 10000)
@@ -429,14 +930,13 @@ DecayedMCMC::DecayedMCMC(F decay_rate, U samples_per_utt)
               << " and samples per utt is " << _samples_per_utt << endl;
 }
 
-void DecayedMCMC::decayed_initialization(Sentences _sentences)
+void DecayedMCMC::decayed_initialization(const Sentences& sentences)
 {
     // calculate total number of potential boundaries in training set,
     // this is needed for calculating the cumulative decay
-    // probabilities cycle through _sentences
+    // probabilities cycle through sentences
     _num_total_pot_boundaries = 0;
-    Us possible_boundaries;
-    for(auto& sent: _sentences)
+    for(const auto& sent: sentences)
     {
         _num_total_pot_boundaries += sent.get_possible_boundaries().size();
     }
@@ -452,20 +952,16 @@ void DecayedMCMC::decayed_initialization(Sentences _sentences)
 
     // create decay probabilities, uses _decay_rate and
     // _num_total_pot_potboundaries to create binned probability
-    // distribution that will be used to find potential boundaries
-    // store values in _decay_offset_probs go to one beyond total
-    // potential boundaries
-    _decay_offset_probs.resize(_num_total_pot_boundaries+2);
-    for(U index = 0; index < _num_total_pot_boundaries + 1; index++)
-    {
-        // add 1 so that current boundary (index 0) is possible
-        _decay_offset_probs[index] = pow((index+1), (-1)*_decay_rate);
-        if(debug_level >= 10000)
-        {
-            wcout << "_decay_offset_probs[" << index
-                  << "] is " << _decay_offset_probs[index] << endl;
-        }
-    }
+    // distribution that will be used to find potential boundaries.
+    // The decay probabilities are static so we store their prefix
+    // sums, going to one beyond total potential boundaries, and
+    // search them by bisection in find_boundary_to_sample()
+    _decay_cum_probs.clear();
+    _decay_cum_probs.reserve(_num_total_pot_boundaries+2);
+    _decay_cum_probs.push_back(0.0);
+    extend_cum_probs(_num_total_pot_boundaries+1);
+
+    _sentence_offsets.clear();
 
     //initialize cumulative decay probability to 0
     _cum_decay_prob = 0.0;
@@ -485,6 +981,24 @@ OnlineUnigramDecayedMCMC::OnlineUnigramDecayedMCMC(
     decayed_initialization(_sentences);
 }
 
+void SentencesSeen::push(Sentences& sentences, Sentences::iterator iter)
+{
+    const U utterance = iter - sentences.begin();
+    if (_latest.size() < sentences.size())
+        _latest.resize(sentences.size(), U(-1));
+
+    // the token of the previous pass keeps its segmentation (and its
+    // words in the lexicon) in a copy
+    if (_latest[utterance] != U(-1))
+    {
+        _earlier.push_back(*iter);
+        _tokens[_latest[utterance]] = &_earlier.back();
+    }
+
+    _latest[utterance] = _tokens.size();
+    _tokens.push_back(&*iter);
+}
+
 void OnlineUnigram::estimate(
     U iters, wostream& os, U eval_iters, F temp, bool maximize, bool is_decayed)
 {
@@ -508,7 +1022,7 @@ void OnlineUnigram::estimate(
 
                 // run evaluation over test set
                 run_eval(os,temp,maximize);
-                print_eval_scores(wcout);
+                print_eval_scores(os);
             }
 	}
 
@@ -528,11 +1042,11 @@ void OnlineUnigram::estimate(
 
 		// run evaluation over test set
 		run_eval(os,temp,maximize);
-		print_eval_scores(wcout);
+		print_eval_scores(os);
             }
 
             // add current sentence to _sentences_seen
-            _sentences_seen.push_back(*iter);
+            _sentences_seen.push(_sentences, iter);
             estimate_sentence(*iter, temperature);
             _nsentences_seen++;
 
@@ -545,7 +1059,11 @@ void OnlineUnigram::estimate(
             print_statistics(os, i, temperature);
         }
 
+        // the lexicon is checked against the utterances seen at high
+        // debug levels even when the assertions are compiled out
         assert(sanity_check());
+        if (debug_level >= 1000 and not sanity_check())
+            error("the lexicon does not match the utterances seen\n");
     }
 }
 
@@ -622,17 +1140,60 @@ void OnlineUnigram::forget_items(Sentences::iterator iter)
     }
 }
 
+// checks that the lexicon holds the words of the utterance tokens seen
+// so far, unless some of them were forgotten
+bool OnlineUnigram::sanity_check() const
+{
+    bool sane = UnigramModel::sanity_check();
+    if (_forget_rate or _constants->token_memory or _constants->type_memory)
+        return sane;
+
+    Sentence::WordCounts counts;
+    for (U i = 0; i < _sentences_seen.size(); ++i)
+        _sentences_seen[i].count_words(counts);
+
+    U ntokens = 0;
+    for (const auto& item: counts)
+    {
+        sane = sane and _lex.ntokens(item.first) == item.second;
+        ntokens += item.second;
+    }
+    sane = sane and ntokens == _lex.ntokens();
+    assert(sane);
+    return sane;
+}
+
 
-void DecayedMCMC::calc_new_cum_prob(Sentence& s, U num_boundaries)
+void DecayedMCMC::extend_cum_probs(U noffsets)
 {
-    for(U index = (_num_curr_pot_boundaries - num_boundaries);
-        index < _num_curr_pot_boundaries; index++)
+    for(U index = _decay_cum_probs.size() - 1; index < noffsets; index++)
     {
-        _cum_decay_prob = _cum_decay_prob + _decay_offset_probs[index];
+        // add 1 so that current boundary (index 0) is possible
+        F decay_offset_prob = pow((index+1), (-1)*_decay_rate);
+        _decay_cum_probs.push_back(_decay_cum_probs.back() + decay_offset_prob);
+
         if(debug_level >= 10000)
-            wcout << "New _cum_decay_prob, adding offset " << _decay_offset_probs[index]
-                  << ", for index " << index << " is " << _cum_decay_prob << endl;
+            wcout << "decay offset prob for index " << index << " is " << decay_offset_prob
+                  << ", cumulative prob is " << _decay_cum_probs.back() << endl;
+    }
+}
+
+void DecayedMCMC::calc_new_cum_prob(Sentence& s, U num_boundaries)
+{
+    // the boundaries of s are the last num_boundaries ones seen
+    _sentence_offsets.push_back(_num_curr_pot_boundaries - num_boundaries);
+
+    // only happens when iterating more than once over the corpus
+    if(_decay_cum_probs.size() <= _num_curr_pot_boundaries)
+    {
+        extend_cum_probs(_num_curr_pot_boundaries);
+        _boundaries_num_sampled.resize(_num_curr_pot_boundaries+1);
     }
+
+    _cum_decay_prob = _decay_cum_probs[_num_curr_pot_boundaries];
+    if(debug_level >= 10000)
+        wcout << "New _cum_decay_prob for " << _num_curr_pot_boundaries
+              << " boundaries is " << _cum_decay_prob << endl;
 }
 
 U DecayedMCMC::find_boundary_to_sample()
@@ -647,66 +1208,43 @@ U DecayedMCMC::find_boundary_to_sample()
     // probability p, we can determine which boundary x by the
     // following:
     //
-    // (1) Given the current boundaries seen so far, use
-    // decay_offset_probs to sum all the probabilities of the new
-    // boundary offsets.  For example, if utterance 1 has 6 boundaries
-    // and utterance 2 has 7 boundaries and we're on utterance 2, the
-    // previous tot_decay_prob = sum(decay_offset_probs(0..5)); we now
-    // want to add the 7 new ones so the new tot_decay_prob =
-    // tot_decay_prob + sum(decay_offset_probs(6..12)).  This allows
-    // us to not have to keep re-summing decay probs we've already
-    // seen. <--- This should be done on an utterance by utterance
-    // basis.
+    // (1) Given the current boundaries seen so far, the total
+    // decay probability is the sum of the decay probabilities of
+    // the offsets 0 to _npotboundaries - 1. This is read from the
+    // prefix sums in _decay_cum_probs, extended utterance by
+    // utterance in calc_new_cum_prob().
     //
     // (2) Generate a random number that = rand (between 0.0 and 1.0)
     // * tot_decay_prob.  This will determine which "bin" (offset)
     // should be selected.
     //
-    // (3) To decide which bin, start summing from
-    // decay_offset_probs(0).  For each i (starting from 0 and going
-    // until i = _npotboundaries - 1), compare
-    // sum(decay_offset_probs(0..i)) and
-    // sum(decay_offset_probs(0..i+1)).  If
-    // sum(decay_offset_probs(0..i)) <= random number <
-    // sum(decay_offset_probs(0..i+1)), then the correct offset is i =
-    // 1.  For example, suppose the random number chosen is 1.2, with
-    // decay rate 2.  decay_offset_probs[0] = 1, decay_offset_probs[1]
-    // = 0.25.  1 <= 1.2 < 1.25, so the offset chosen from the current
-    // boundary should be 1.
+    // (3) The offset is the i such that sum(decay_offset_probs(0..i))
+    // <= random number < sum(decay_offset_probs(0..i+1)), found by
+    // bisection in the prefix sums.  For example, suppose the random
+    // number chosen is 1.2, with decay rate 2.
+    // decay_offset_probs[0] = 1, decay_offset_probs[1] = 0.25.  1 <=
+    // 1.2 < 1.25, so the offset chosen from the current boundary
+    // should be 1.
 
     F rand_num = randd()*_cum_decay_prob;
     if(debug_level >= 10000)
         wcout << "random number chosen is " << rand_num << endl;
 
-    F curr_cum_sum = 0.0;
-    bool found_bin = false;
-    U index = 0;
+    // the prefix sums being increasing, the bin is the first i such
+    // that random number < sum(decay_offset_probs(0..i+1))
+    Fs::const_iterator first = _decay_cum_probs.begin() + 1;
+    Fs::const_iterator last = first + _num_curr_pot_boundaries;
+    Fs::const_iterator bin = std::upper_bound(first, last, rand_num);
 
-    // loop through until we find the right bin, summing as we go
-    while(!found_bin and (index < _num_curr_pot_boundaries))
+    if(bin != last)
     {
-        // compare rand_num with decay_offset_probs[index] and
-        // decay_offset_probs[index+1]
+        U index = bin - first;
+        to_sample = _num_curr_pot_boundaries - index;
         if(debug_level >= 10000)
-            wcout << "index is " << index << ", comparing " << rand_num << " with " << curr_cum_sum
-                  << " and " << (_decay_offset_probs[index] + curr_cum_sum) << endl;
-
-        if((curr_cum_sum <= rand_num) and
-           (rand_num < (curr_cum_sum + _decay_offset_probs[index])))
-        {
-            // found bin
-            found_bin = true;
-            to_sample = _num_curr_pot_boundaries - index;
-            if(debug_level >= 10000)
-                wcout << "found bin: belongs in offset " << index
-                      << ", so boundary to sample is " << to_sample << endl;
-        }
-
-        curr_cum_sum += _decay_offset_probs[index];
-        index++;
+            wcout << "found bin: belongs in offset " << index
+                  << ", so boundary to sample is " << to_sample << endl;
     }
-
-    if(!found_bin)
+    else
     {
         // belongs in the furthest offset away, at the very beginning
         // of the corpus
@@ -719,105 +1257,48 @@ U DecayedMCMC::find_boundary_to_sample()
     return to_sample;
 }
 
-void DecayedMCMC::find_sent_to_sample(U boundary_to_sample, Sentence &s, Sentences& sentences_seen)
+Sentence& DecayedMCMC::find_sent_to_sample(
+    U boundary_to_sample, const SentencesSeen& sentences_seen)
 {
-    Sentences::iterator si = sentences_seen.end();
-
-    // get to last element
-    si--;
-    if(debug_level >= 10000)
-        wcout << "Current sentence looking for boundary "
-              << boundary_to_sample << " in is " << *si << endl;
-
-    s = *si;
+    assert(_sentence_offsets.size() == sentences_seen.size());
 
-    // current number boundaries, start with _num_curr_pot_boundaries
-    U num_boundaries = _num_curr_pot_boundaries;
-    bool sent_found = false;
+    // to access boundary x, find the last utterance having less than
+    // x potential boundaries before it. Ex: to find x = 7, when there
+    // are 8 pot boundaries, and the last sentence has boundaries 4
+    // through 8 (so 3 before it), 7 > 3 so search this utterance.
+    // Which one?  7 - 3 = 4th one.
+    Us::const_iterator next = std::lower_bound(
+        _sentence_offsets.begin(), _sentence_offsets.end(), boundary_to_sample);
 
-    // to access boundary x, search from back (most current) to find
-    // utterance (most likely due to decay function)
-    while(!sent_found)
+    if(next != _sentence_offsets.begin())
     {
-        // see if is in current utterance ex: to find x = 7, when
-        // there are 8 pot boundaries, and sentence has boundaries 4
-        // through 8 grab most recent utterance and count how many
-        // potential boundaries are there (ex: 5 (4, 5, 6, 7, 8)). Is
-        // 7 > (8-5)?  Yes. Search this utterance. Which one?  7-
-        // (8-5) = 4th one.
-        //this_sent_boundaries = 0;
-        U this_sent_boundaries = s.get_possible_boundaries().size();
+        U index = (next - _sentence_offsets.begin()) - 1;
+        _sentence_sampled = index;
+        _boundary_within_sentence = boundary_to_sample - _sentence_offsets[index];
 
         if(debug_level >= 10000)
-            wcout << "Seeing if boundary " << boundary_to_sample << " is greater than "
-                  << num_boundaries << " - " << this_sent_boundaries << endl;
-
-        if(boundary_to_sample > (num_boundaries - this_sent_boundaries))
-        {
-            sent_found = true;
-            _sentence_sampled = si;
-            if(debug_level >= 10000)
-                wcout << "Found sentence containing boundary "
-                      << boundary_to_sample << ": " << *si << endl;
-
-            _boundary_within_sentence =
-                this_sent_boundaries - (num_boundaries - boundary_to_sample);
-
-            if(debug_level >= 10000)
-                wcout << "Will be sampling boundary "
-                      << _boundary_within_sentence
-                      << " inside this sentence " << endl;
-        }
-        else
-        {
-            // haven't found it yet - go to next sentence and set up
-            // new comparisons
-            if(debug_level >= 10000)
-                wcout << "Haven't found boundary " << boundary_to_sample
-                      << " yet, moving on to previous sentence " << endl;
-
-            if(si != sentences_seen.begin())
-            {
-                si--;
-                s = *si;
-                num_boundaries -= this_sent_boundaries;
-
-                if(debug_level >= 10000)
-                    wcout << "Now num_boundaries is " << num_boundaries << endl;
-            }
-            else
-            {
-                if(debug_level >= 1000)
-                    wcout << "***Couldn't find boundary "
-                          << boundary_to_sample
-                          << ", so returning first utterance " << endl;
-
-                sent_found = true;
-                _sentence_sampled = si;
-            }
-        }
+            wcout << "Found sentence containing boundary "
+                  << boundary_to_sample << ": " << sentences_seen[_sentence_sampled] << endl
+                  << "Will be sampling boundary " << _boundary_within_sentence
+                  << " inside this sentence " << endl;
     }
-}
-
-void DecayedMCMC::replace_sampled_sentence(Sentence s, Sentences &sentences_seen)
-{
-    Sentences::iterator si = sentences_seen.end();
-    while((si != _sentence_sampled) && (si != sentences_seen.begin()))
+    else
     {
-        si--;
+        if(debug_level >= 1000)
+            wcout << "***Couldn't find boundary "
+                  << boundary_to_sample
+                  << ", so returning first utterance " << endl;
+
+        _sentence_sampled = 0;
     }
 
-    if(debug_level >= 10000)
-        wcout << "Replacing this sentence in sentences_seen: " << *si << endl
-              << " with this one: " << s << endl;
-    *si = s;
+    return sentences_seen[_sentence_sampled];
 }
 
 void OnlineUnigramDecayedMCMC::estimate_sentence(Sentence& s, F temperature)
 {
     // update current total potential boundaries
-    Us possible_boundaries = s.get_possible_boundaries();
-    U num_boundaries = possible_boundaries.size();
+    U num_boundaries = s.get_possible_boundaries().size();
 
     if(debug_level >= 10000)
     {
@@ -833,13 +1314,10 @@ void OnlineUnigramDecayedMCMC::estimate_sentence(Sentence& s, F temperature)
     // add current words in sentence to lexicon
     s.insert_words(_lex);
 
+    calc_new_cum_prob(s, num_boundaries);
+
     for(U num_samples = 0; num_samples < _samples_per_utt; num_samples++)
     {
-        if(num_samples == 0)
-        { // only do this the first time
-            calc_new_cum_prob(s, num_boundaries);
-        }
-
         // find boundary to sample
         U boundary_to_sample = find_boundary_to_sample();
 
@@ -855,11 +1333,10 @@ void OnlineUnigramDecayedMCMC::estimate_sentence(Sentence& s, F temperature)
                   << _boundaries_num_sampled[boundary_to_sample] << endl;
 
         // locate utterance containing this boundary, which includes
-        // figuring out which boundary position j in the utterance
-        // dummy utterance to be filled by actual utterance - most
-        // often will be curr_utt, though
-        Sentence sent_to_sample = s;
-        find_sent_to_sample(boundary_to_sample, sent_to_sample, _sentences_seen);
+        // figuring out which boundary position j in the utterance -
+        // most often will be curr_utt, though. It is sampled in place.
+        Sentence& sent_to_sample = find_sent_to_sample(
+            boundary_to_sample, _sentences_seen);
 
         // sample _boundary_within_sentence within sent_to_sample use
         // modified form of sample_by_flips
@@ -872,18 +1349,6 @@ void OnlineUnigramDecayedMCMC::estimate_sentence(Sentence& s, F temperature)
         sent_to_sample.sample_one_flip(_lex, temperature, _boundary_within_sentence+1);
         if(debug_level >=10000)
             wcout << "After sampling this sentence: " << sent_to_sample << endl;
-
-        // need to insert updated sentence into _sentences
-        replace_sampled_sentence(sent_to_sample, _sentences_seen);
-
-        // check that replacement was correct
-        if(debug_level >= 10000){
-            wcout << "After replacement: " << endl;
-            for(const auto& _s: _sentences_seen)
-            {
-                wcout << _s << endl;
-            }
-        }
     }
 
     if(debug_level >= 10000)
@@ -892,13 +1357,13 @@ void OnlineUnigramDecayedMCMC::estimate_sentence(Sentence& s, F temperature)
 
 void OnlineUnigramViterbi::estimate_sentence(Sentence& s, F temperature)
 {
-    s.maximize(_lex, _nsentences_seen, temperature,_constants->do_mbdp);
+    s.maximize(_lex, _chart, _nsentences_seen, temperature,_constants->do_mbdp);
     s.insert_words(_lex);
 }
 
 void OnlineUnigramTreeSampler::estimate_sentence(Sentence& s, F temperature)
 {
-    s.sample_tree(_lex, _nsentences_seen, temperature,_constants->do_mbdp);
+    s.sample_tree(_lex, _chart, _nsentences_seen, temperature,_constants->do_mbdp);
     s.insert_words(_lex);
 }
 
@@ -926,12 +1391,17 @@ void BatchBigram::estimate(
     }
 
     // number of accepts in hyperparm resampling. Initialize to the
-    // correct length
-    Bs accepted_anneal(hypersample(1).size());
-    Bs accepted(hypersample(1).size());
+    // correct length, only when starting a new chain as this samples
+    // the hyperparameters (a resumed chain must not draw more numbers)
+    Bs accepted_anneal, accepted;
+    if (_niterations == 0)
+    {
+        accepted_anneal.resize(hypersample(1).size());
+        accepted.resize(hypersample(1).size());
+    }
     U nanneal = 0;
     U n = 0;
-    for (U i=1; i <= iters; i++)
+    for (U i = _niterations + 1; i <= iters; i++)
     {
         //U nchanged = 0; if need to print out, un-comment
         F temperature = _constants->anneal_temperature(i);
@@ -943,7 +1413,7 @@ void BatchBigram::estimate(
 
             // run evaluation over test set
             run_eval(os,temp,maximize);
-            print_eval_scores(wcout);
+            print_eval_scores(os);
 	}
 
         for(auto& sent: _sentences)
@@ -973,6 +1443,8 @@ void BatchBigram::estimate(
         }
 
         assert(sanity_check());
+
+        checkpoint(i);
     }
 
     os << "hyperparm accept rate: " << accepted_anneal/nanneal
@@ -982,14 +1454,14 @@ void BatchBigram::estimate(
 void BatchBigramViterbi::estimate_sentence(Sentence& s, F temperature)
 {
     s.erase_words(_lex);
-    s.maximize(_lex, _constants->nsentences()-1, temperature);
+    s.maximize(_lex, _chart, _constants->nsentences()-1, temperature);
     s.insert_words(_lex);
 }
 
 void BatchBigramTreeSampler::estimate_sentence(Sentence& s, F temperature)
 {
     s.erase_words(_lex);
-    s.sample_tree(_lex, _constants->nsentences()-1, temperature);
+    s.sample_tree(_lex, _chart, _constants->nsentences()-1, temperature);
     s.insert_words(_lex);
 }
 
@@ -1032,7 +1504,7 @@ void OnlineBigram::estimate(
 
                 // run evaluation over test set
                 run_eval(os,temp,maximize);
-                print_eval_scores(wcout);
+                print_eval_scores(os);
             }
 	}
 
@@ -1053,11 +1525,11 @@ void OnlineBigram::estimate(
 
 		// run evaluation over test set
 		run_eval(os,temp,maximize);
-		print_eval_scores(wcout);
+		print_eval_scores(os);
             }
 
             // add current sentence to _sentences_seen
-            _sentences_seen.push_back(*iter);
+            _sentences_seen.push(_sentences, iter);
             estimate_sentence(*iter, temperature);
             _nsentences_seen++;
         }
@@ -1067,7 +1539,11 @@ void OnlineBigram::estimate(
             print_statistics(os, i, temperature);
         }
 
+        // the lexicon is checked against the utterances seen at high
+        // debug levels even when the assertions are compiled out
         assert(sanity_check());
+        if (debug_level >= 1000 and not sanity_check())
+            error("the lexicon does not match the utterances seen\n");
     }
 }
 
@@ -1090,35 +1566,64 @@ void OnlineBigram::forget_items(Sentences::iterator iter)
     }
 }
 
+// checks that the bigram lexicon holds the pairs of consecutive words
+// of the utterance tokens seen so far, unless some of them were
+// forgotten
+bool OnlineBigram::sanity_check() const
+{
+    bool sane = BigramModel::sanity_check();
+    if (_forget_rate)
+        return sane;
+
+    std::unordered_map<S, Sentence::WordCounts> counts;
+    for (U i = 0; i < _sentences_seen.size(); ++i)
+        _sentences_seen[i].count_words(counts);
+
+    U ntokens = 0;
+    for (const auto& item: counts)
+    {
+        Bigrams::const_iterator it = _lex.find(item.first);
+        sane = sane and it != _lex.end();
+        for (const auto& item2: item.second)
+        {
+            sane = sane and it != _lex.end() and it->second.ntokens(item2.first) == item2.second;
+            ntokens += item2.second;
+        }
+    }
+
+    U ntokens_lex = 0;
+    for (const auto& item: _lex)
+        ntokens_lex += item.second.ntokens();
+    sane = sane and ntokens == ntokens_lex;
+    assert(sane);
+    return sane;
+}
+
 void OnlineBigramViterbi::estimate_sentence(Sentence& s, F temperature)
 {
-    s.maximize(_lex, _nsentences_seen, temperature);
+    s.maximize(_lex, _chart, _nsentences_seen, temperature);
     s.insert_words(_lex);
 }
 
 void OnlineBigramTreeSampler::estimate_sentence(Sentence& s, F temperature)
 {
-    s.sample_tree(_lex, _nsentences_seen, temperature);
+    s.sample_tree(_lex, _chart, _nsentences_seen, temperature);
     s.insert_words(_lex);
 }
 
 void OnlineBigramDecayedMCMC::estimate_sentence(Sentence& s, F temperature)
 {
     // update current total potential boundaries
-    Us possible_boundaries = s.get_possible_boundaries();
-    U num_boundaries = possible_boundaries.size();
+    U num_boundaries = s.get_possible_boundaries().size();
     _num_curr_pot_boundaries += num_boundaries;
 
     // add current words in sentence to lexicon
     s.insert_words(_lex);
 
+    calc_new_cum_prob(s, num_boundaries);
+
     for(U num_samples = 0; num_samples < _samples_per_utt; num_samples++)
     {
-        if(num_samples == 0)
-        { // only do this the first time
-            calc_new_cum_prob(s, num_boundaries);
-        }
-
         // find boundary to sample
         U boundary_to_sample = find_boundary_to_sample();
 
@@ -1126,20 +1631,16 @@ void OnlineBigramDecayedMCMC::estimate_sentence(Sentence& s, F temperature)
         _boundaries_num_sampled[boundary_to_sample]++;
 
         // locate utterance containing this boundary, which includes
-        // figuring out which boundary position j in the utterance
-        // dummy utterance to be filled by actual utterance - most
-        // often will be curr_utt, though
-        Sentence sent_to_sample = s;
-        find_sent_to_sample(boundary_to_sample, sent_to_sample, _sentences_seen);
+        // figuring out which boundary position j in the utterance -
+        // most often will be curr_utt, though. It is sampled in place.
+        Sentence& sent_to_sample = find_sent_to_sample(
+            boundary_to_sample, _sentences_seen);
 
         // sample _boundary_within_sentence within sent_to_sample use
         // modified form of sample_by_flips
 
         // +1 for boundary to account for beginning and end of sentence in lex
         sent_to_sample.sample_one_flip(_lex, temperature, _boundary_within_sentence+1);
-
-        // need to insert updated sentence into _sentences
-        replace_sampled_sentence(sent_to_sample, _sentences_seen);
     }
 
     if(debug_level >= 10000)
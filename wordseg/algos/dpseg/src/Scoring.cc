@@ -14,14 +14,45 @@ void Scoring::reset()
     _reference_bs = 0;
     _reference_lex.clear();
     _segmented_lex.clear();
+    _lexicon_correct = 0;
+    _scored_boundaries.clear();
 }
 
-void Scoring::add_words_to_lexicon(const Sentence::Words& words, Lexicon& lex)
+void Scoring::score(const Sentences& sentences)
 {
-    for(const auto& word: words)
+    if (_scored_boundaries.size() != sentences.size())
     {
-        lex.inc(word);
+        reset();
+        for(const auto& sentence: sentences)
+            sentence.score_reference(*this);
+        _scored_boundaries.resize(sentences.size());
     }
+
+    for (size_t i = 0; i < sentences.size(); ++i)
+    {
+        const Bs& boundaries = sentences[i]._boundaries;
+        Bs& scored = _scored_boundaries[i];
+        if (scored == boundaries)
+            continue;
+
+        // take the previous segmentation out of the tally
+        if (! scored.empty())
+            sentences[i].score_segmentation(*this, scored, -1);
+        sentences[i].score_segmentation(*this, boundaries, 1);
+        scored = boundaries;
+    }
+}
+
+void Scoring::add_segmented_word(const S& word)
+{
+    if (_segmented_lex.inc(word) and _reference_lex.count(word))
+        _lexicon_correct++;
+}
+
+void Scoring::remove_segmented_word(const S& word)
+{
+    if (_segmented_lex.dec(word) and _reference_lex.count(word))
+        _lexicon_correct--;
 }
 
 void Scoring::print_results(wostream& os) const
@@ -52,20 +83,13 @@ void Scoring::print_results(wostream& os) const
 // }
 
 /*
-  Looks up each word in the segmented lexicon to see whether it's also
-  in the reference lexicon.  We need to calculate this each time it's
-  called because the number of correct words and lexicon size changes.
+  Number of words in the segmented lexicon that are also in the
+  reference lexicon.  This is updated each time a type enters or
+  leaves the segmented lexicon.
 */
 int Scoring::lexicon_correct() const
 {
-    int correct = 0;
-    for(const auto& item: _segmented_lex)
-    // cforeach(Lexicon, iter, _segmented_lex)
-    {
-        if (_reference_lex.count(item.first))
-            correct++;
-    }
-    return correct;
+    return _lexicon_correct;
 }
 
 void Scoring::print_segmented_lexicon(wostream& os) const
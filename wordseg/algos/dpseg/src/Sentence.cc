@@ -1,10 +1,16 @@
 #include "Sentence.h"
+
+#include <limits>
+
+#include "Chart.h"
 #include "Data.h"
 #include "Scoring.h"
 
 using namespace std;
 
 std::wstring S::data;   //!< global data object, which holds training and eval data
+std::vector<std::size_t> S::_prefix_hashes;
+std::vector<std::size_t> S::_powers;
 
 std::wostream& operator<< (std::wostream& os, const S& s) {
   return os << s.string(); }
@@ -197,6 +203,42 @@ Sentence::erase_words(Bigrams& lex){
   if (debug_level >=90000) TRACE(lex);
 }
 
+// adds the word counts of whole sentence, as insert_words(Unigrams&)
+void
+Sentence::count_words(WordCounts& counts) const {
+  U i = 1;
+  U j = i+1;
+  while (j < _boundaries.size()-1) {
+    if (_boundaries[i] && _boundaries[j]) {
+      ++counts[word_at(i,j)];
+      i=j;
+      j=i+1;
+    }
+    else {
+      j++;
+    }
+  }
+}
+
+// adds the bigram counts of whole sentence, as insert_words(Bigrams&)
+void
+Sentence::count_words(std::unordered_map<S, WordCounts>& counts) const {
+  U k = 0;
+  U i = 1;
+  U j = i+1;
+  while (j < _boundaries.size()) {
+    if (_boundaries[i] && _boundaries[j]) {
+      ++counts[word_at(k,i)][word_at(i,j)];
+      k=i;
+      i=j;
+      j=i+1;
+    }
+    else {
+      j++;
+    }
+  }
+}
+
 // the sampling method used in our ACL paper.
 // results using this function reproduce those of ACL paper, but
 // I have not actually checked the probabilities by hand.
@@ -364,49 +406,49 @@ Sentence::sample_one_flip(Bigrams& lex, F temperature, U boundary_within_sentenc
 // seen (preceding this one, if online; except this one,
 // if batch).
 void
-Sentence::maximize(Unigrams& lex, U nsentences, F temperature, bool do_mbdp){
+Sentence::maximize(Unigrams& lex, Chart& chart, U nsentences, F temperature, bool do_mbdp){
   // cache some useful constants
   int N_branch = lex.ntokens() - nsentences;
-  double p_continue = pow((N_branch +  _constants->aeos/2.0) /
-		       (lex.ntokens() +  _constants->aeos), 1/temperature);
-  if (debug_level >=90000) TRACE(p_continue);
-  // create chart for dynamic program
-  typedef pair<double, U> Cell; //best prob, index of best prob
-  typedef vector<Cell> Chart;
-  Chart best(_boundaries.size()-1, Cell(0.0, 0)); //best seg ending at each index
+  F log_p_continue = log((N_branch +  _constants->aeos/2.0) /
+                         (lex.ntokens() +  _constants->aeos)) / temperature;
+  if (debug_level >=90000) TRACE(log_p_continue);
+  // chart stores the log prob of the best seg ending at each
+  // position of _padded_possible, and where its last word starts
   assert(*(_padded_possible.begin()) == 1);
   assert(*(_padded_possible.end()-1) == _boundaries.size()-2);
-  Us::const_iterator i;
-  Us::const_iterator j;
-  best[1] = Cell(1.0, 0);
-  for (j = _padded_possible.begin() + 1; j <_padded_possible.end(); j++) {
-    for (i = _padded_possible.begin(); i < j; i++) {
-      F prob;
-      if (do_mbdp) {
-	F mbdp_p = mbdp_prob(lex, word_at(*i, *j), nsentences);
-	prob = pow(mbdp_p, 1/temperature) * best[*i].first;
-	if (debug_level >=85000) TRACE5(*i,*j,word_at(*i, *j),mbdp_p,prob);
-      }
-      else {
-	prob = pow(lex(word_at(*i, *j)), 1/temperature)
-	  * p_continue * best[*i].first;
-	if (debug_level >=85000) TRACE5(*i,*j,word_at(*i, *j),lex(word_at(*i, *j)),prob);
-      }
-      if (prob > best[*j].first) {
-	 best[*j] = Cell(prob, *i);
+  chart.positions() = _padded_possible;
+  chart.reset(_constants->max_word_length);
+  const Us& p = chart.positions();
+  const U n = chart.size();
+  chart.forward(0) = 0;
+  chart.backpointer(0) = 0;
+  for (U j = 1; j < n; j++) {
+    F& best = chart.forward(j);
+    best = -std::numeric_limits<F>::infinity();
+    // the chart is reused across sentences, never trace back a
+    // previous sentence's pointer if no word ending at j is allowed
+    chart.backpointer(j) = j - 1;
+    for (U i = chart.first(j); i < j; i++) {
+      if (! chart.allowed(i, j))
+        continue;
+      F logp = unigram_logscore(lex, p[i], p[j], nsentences,
+                                log_p_continue, temperature, do_mbdp)
+        + chart.forward(i);
+      if (logp > best) {
+        best = logp;
+        chart.backpointer(j) = i;
       }
     }
   }
-  if (debug_level >= 70000) TRACE(best);
   // now reconstruct the best segmentation
   U k;
   for (k = 2; k <_boundaries.size() -2; k++) {
     _boundaries[k] = false;
   }
-  k = _boundaries.size() -2;
-  while (best[k].second >0) {
-    k = best[k].second;
-    _boundaries[k] = true;
+  k = n - 1;
+  while (k > 0) {
+    k = chart.backpointer(k);
+    _boundaries[p[k]] = true;
   }
   if (debug_level >= 70000) TRACE(_boundaries);
 }
@@ -420,67 +462,59 @@ Sentence::maximize(Unigrams& lex, U nsentences, F temperature, bool do_mbdp){
 // seen (preceding this one, if online; except this one,
 // if batch).
 void
-Sentence::maximize(Bigrams& lex, U nsentences, F temperature){
-  // create chart for dynamic program
-  typedef pair<double, U> Cell; //best prob, index of best prob
-  typedef vector<Cell> Row;
-  typedef vector<Row> Chart;
-  // chart stores prob of best seg ending at j going thru i
-  Chart best(_boundaries.size(), Row(_boundaries.size(), Cell(0.0, 0)));
+Sentence::maximize(Bigrams& lex, Chart& chart, U nsentences, F temperature){
+  // chart stores the log prob of the best seg whose last word spans
+  // positions j to k, and where the word before it starts
   assert(*(_padded_possible.begin()) == 1);
   assert(*(_padded_possible.end()-1) == _boundaries.size()-2);
-  Us::const_iterator i;
-  Us::const_iterator j;
-  Us::const_iterator k;
-  _padded_possible.insert(_padded_possible.begin(),0); //ugh.
+  const U n = bigram_positions(lex, chart);
+  const Us& p = chart.positions();
+  if (debug_level >=100000) TRACE(p);
   // initialise base case
-  if (debug_level >=100000) TRACE(_padded_possible);
-  for (k = _padded_possible.begin() + 2; k <_padded_possible.end(); k++) {
-    F prob = pow(lex(word_at(0, 1),word_at(1, *k)), 1/temperature);
-    if (debug_level >=85000) TRACE3(*k,word_at(0, 1),word_at(1, *k));
-    if (debug_level >=85000) TRACE2(lex(word_at(0, 1),word_at(1,*k)),prob);
-    best[1][*k] = Cell(prob, 0);
-  }
-  // dynamic program
-  for (k = _padded_possible.begin() + 3; k <_padded_possible.end(); k++) {
-  for (j = _padded_possible.begin() + 2; j < k; j++) {
-    for (i = _padded_possible.begin() + 1; i < j; i++) {
-      F prob = pow(lex(word_at(*i, *j),word_at(*j, *k)), 1/temperature)
-	* best[*i][*j].first;
-      if (debug_level >=85000) TRACE5(*i,*j,*k,word_at(*i, *j),word_at(*j, *k));
-      if (debug_level >=85000) TRACE2(lex(word_at(*i, *j),word_at(*j, *k)),prob);
-      if (prob > best[*j][*k].first) {
-	best[*j][*k] = Cell(prob, *i);
+  for (U k = 2; k < n - 1; k++) {
+    for (U j = chart.first(k); j < k; j++)
+      chart.cell(j, k) = -std::numeric_limits<F>::infinity();
+    if (chart.first(k) <= 1 and chart.allowed(1, k)) {
+      chart.cell(1, k) = bigram_logscore(lex, chart, 0, 1, k, temperature);
+      chart.cell_backpointer(1, k) = 0;
+    }
+  }
+  // dynamic program over the words (i, j) followed by (j, k),
+  // with both words at most chart.width() positions long
+  for (U k = 3; k < n; k++) {
+    for (U j = std::max(chart.first(k), U(2)); j < k; j++) {
+      // final word must be sentence boundary marker.
+      if (k == n - 1 and j != n - 2)
+        continue;
+      if (! chart.allowed(j, k))
+        continue;
+      F& best = chart.cell(j, k);
+      best = -std::numeric_limits<F>::infinity();
+      chart.cell_backpointer(j, k) = j - 1;
+      for (U i = std::max(chart.first(j), U(1)); i < j; i++) {
+        if (! chart.allowed(i, j))
+          continue;
+        F logp = bigram_logscore(lex, chart, i, j, k, temperature)
+          + chart.cell(i, j);
+        if (logp > best) {
+          best = logp;
+          chart.cell_backpointer(j, k) = i;
+        }
       }
     }
   }
-  }
-  // final word must be sentence boundary marker.
-  U m = _boundaries.size() -1;
-  j = _padded_possible.end() -1; // *j is _boundaries.size() -2
-  for (i = _padded_possible.begin()+1; i <j; i++) {
-      F prob = pow(lex(word_at(*i, *j),word_at(*j, m)), 1/temperature)
-	* best[*i][*j].first;
-      if (debug_level >=85000) TRACE5(*i,*j,m,word_at(*i, *j),word_at(*j, m));
-      if (debug_level >=85000) TRACE2(lex(word_at(*i, *j),word_at(*j, m)),prob);
-      if (prob > best[*j][m].first) {
-	best[*j][m] = Cell(prob, *i);
-      }
-  }
-  if (debug_level >= 70000) TRACE(best);
   // now reconstruct the best segmentation
-  for (m = 2; m <_boundaries.size() -2; m++) {
+  for (U m = 2; m <_boundaries.size() -2; m++) {
     _boundaries[m] = false;
   }
-  m = _boundaries.size() -2;
-  U n = _boundaries.size() -1;
-  while (best[m][n].second >0) {
-    U previous = best[m][n].second;
-    _boundaries[previous] = true;
-    n = m;
-    m = previous;
+  U j = n - 2;
+  U k = n - 1;
+  while (j > 1) {
+    U i = chart.cell_backpointer(j, k);
+    _boundaries[p[i]] = true;
+    k = j;
+    j = i;
   }
-  _padded_possible.erase(_padded_possible.begin()); //ugh.
   if (debug_level >= 70000) TRACE(_boundaries);
 }
 
@@ -493,156 +527,174 @@ Sentence::maximize(Bigrams& lex, U nsentences, F temperature){
 // seen (preceding this one, if online; except this one,
 // if batch).
 void
-Sentence::sample_tree(Unigrams& lex, U nsentences, F temperature, bool do_mbdp){
+Sentence::sample_tree(Unigrams& lex, Chart& chart, U nsentences, F temperature, bool do_mbdp){
   // cache some useful constants
   int N_branch = lex.ntokens() - nsentences;
   assert(N_branch >= 0);
-  double p_continue = pow((N_branch +  _constants->aeos/2.0) /
-		       (lex.ntokens() +  _constants->aeos), 1/temperature);
-  if (debug_level >=90000) TRACE(p_continue);
-  // create chart for dynamic program
-  typedef pair<double, U>  Transition; // prob, index from whence prob
-  typedef vector<Transition> Transitions;
-  typedef pair<double, Transitions> Cell; // total prob, choices
-  typedef vector<Cell> Chart;
-  // chart stores probabilities of different paths up to i
-  Chart best(_boundaries.size()-1);
+  F log_p_continue = log((N_branch +  _constants->aeos/2.0) /
+                         (lex.ntokens() +  _constants->aeos)) / temperature;
+  if (debug_level >=90000) TRACE(log_p_continue);
+  // chart stores the log prob of all segs ending at each position of
+  // _padded_possible, and the log score of each word i..j
   assert(*(_padded_possible.begin()) == 1);
   assert(*(_padded_possible.end()-1) == _boundaries.size()-2);
-  Us::const_iterator i;
-  Us::const_iterator j;
-  best[1].first = 1.0;
-  for (j = _padded_possible.begin() + 1; j <_padded_possible.end(); j++) {
-    for (i = _padded_possible.begin(); i < j; i++) {
-      F prob;
-      if (do_mbdp) {
-	F mbdp_p = mbdp_prob(lex, word_at(*i, *j), nsentences);
-	prob = pow(mbdp_p, 1/temperature) * best[*i].first;
-	if (debug_level >=85000) TRACE5(*i,*j,word_at(*i, *j),mbdp_p,prob);
-      }
-      else {
-	prob = pow(lex(word_at(*i, *j)), 1/temperature)
-	  * p_continue * best[*i].first;
-	if (debug_level >=85000) TRACE5(*i,*j,word_at(*i, *j),lex(word_at(*i, *j)),prob);
-      }
-      best[*j].first += prob;
-      best[*j].second.push_back(Transition(prob, *i));
-    }
-  }
-  if (debug_level >= 70000) TRACE(best);
-  // now sample a segmentation
+  chart.positions() = _padded_possible;
+  chart.reset(_constants->max_word_length);
+  const Us& p = chart.positions();
+  const U n = chart.size();
+  chart.forward(0) = 0;
+  for (U j = 1; j < n; j++) {
+    // log-sum-exp over the words ending at j
+    F max = -std::numeric_limits<F>::infinity();
+    for (U i = chart.first(j); i < j; i++) {
+      F logp = -std::numeric_limits<F>::infinity();
+      if (chart.allowed(i, j))
+        logp = unigram_logscore(lex, p[i], p[j], nsentences,
+                                log_p_continue, temperature, do_mbdp)
+          + chart.forward(i);
+      chart.cell(i, j) = logp;
+      if (logp > max)
+        max = logp;
+    }
+    F sum = 0;
+    for (U i = chart.first(j); i < j; i++) {
+      sum += exp(chart.cell(i, j) - max);
+    }
+    chart.forward(j) = max + log(sum);
+  }
+  // now sample a segmentation, going backwards from the end of the
+  // sentence: the start i of the word ending at k is drawn with
+  // probability exp(cell(i, k) - forward(k))
   U k;
   for (k = 2; k <_boundaries.size() -2; k++)
   {
       _boundaries[k] = false;
   }
-  k = _boundaries.size() -2;
-  while (best[k].first < 1.0)
+  k = n - 1;
+  while (k > 0)
   {
-      // sample one of the transitions
-      F r = unif01()* best[k].first;
+      F r = unif01();
       F total = 0;
-      for(const auto& item: best[k].second)
+      U i = chart.first(k);
+      for (; i < k - 1; i++)
       {
-          total += item.first;
+          total += exp(chart.cell(i, k) - chart.forward(k));
           if (r < total)
-          {
-              k = item.second;
-              _boundaries[k] = true;
               break;
-          }
       }
+      k = i;
+      _boundaries[p[k]] = true;
   }
   if (debug_level >= 70000) TRACE(_boundaries);
 }
 
 void
-Sentence::sample_tree(Bigrams& lex, U nsentences, F temperature) {
-  // create chart for dynamic program
-  typedef pair<double, U>  Transition; // prob, index from whence prob
-  typedef vector<Transition> Transitions;
-  typedef pair<double, Transitions> Cell; // total prob, choices
-  typedef vector<Cell> Row;
-  typedef vector<Row> Chart;
-  // chart stores prob of best seg ending at j going thru i
-  Chart best(_boundaries.size(), Row(_boundaries.size()));
+Sentence::sample_tree(Bigrams& lex, Chart& chart, U nsentences, F temperature) {
+  // chart stores the log prob of all segs whose last word spans
+  // positions j to k
   assert(*(_padded_possible.begin()) == 1);
   assert(*(_padded_possible.end()-1) == _boundaries.size()-2);
-  Us::const_iterator i;
-  Us::const_iterator j;
-  Us::const_iterator k;
-  _padded_possible.insert(_padded_possible.begin(),0); //ugh.
+  const U n = bigram_positions(lex, chart);
+  const Us& p = chart.positions();
+  if (debug_level >=100000) TRACE(p);
   // initialise base case
-  if (debug_level >=100000) TRACE(_padded_possible);
-  for (k = _padded_possible.begin() + 2; k <_padded_possible.end(); k++) {
-    F prob = pow(lex(word_at(0, 1),word_at(1, *k)), 1/temperature);
-    if (debug_level >=85000) TRACE3(*k,word_at(0, 1),word_at(1, *k));
-    if (debug_level >=85000) TRACE2(lex(word_at(0, 1),word_at(1,*k)),prob);
-    best[1][*k].first += prob;
-    best[1][*k].second.push_back(Transition(prob, 0));
-  }
-  // dynamic program
-  for (k = _padded_possible.begin() + 3; k <_padded_possible.end(); k++) {
-    for (j = _padded_possible.begin() + 2; j < k; j++) {
-      for (i = _padded_possible.begin() + 1; i < j; i++) {
-	F prob = pow(lex(word_at(*i, *j),word_at(*j, *k)), 1/temperature)
-	  * best[*i][*j].first;
-	if (debug_level >=85000) TRACE5(*i,*j,*k,word_at(*i, *j),word_at(*j, *k));
-	if (debug_level >=85000) TRACE2(lex(word_at(*i, *j),word_at(*j, *k)),prob);
-	best[*j][*k].first += prob;
-	best[*j][*k].second.push_back(Transition(prob, *i));
+  for (U k = 2; k < n - 1; k++) {
+    for (U j = chart.first(k); j < k; j++)
+      chart.cell(j, k) = -std::numeric_limits<F>::infinity();
+    if (chart.first(k) <= 1 and chart.allowed(1, k))
+      chart.cell(1, k) = bigram_logscore(lex, chart, 0, 1, k, temperature);
+  }
+  // dynamic program over the words (i, j) followed by (j, k), with
+  // both words at most chart.width() positions long. The cell (j, k)
+  // is the log-sum-exp of the scores of the words (i, j) before it.
+  for (U k = 3; k < n; k++) {
+    for (U j = std::max(chart.first(k), U(2)); j < k; j++) {
+      // final word must be sentence boundary marker.
+      if (k == n - 1 and j != n - 2)
+        continue;
+      if (! chart.allowed(j, k))
+        continue;
+      // single pass log-sum-exp, rescaling the sum when the max
+      // changes
+      F max = -std::numeric_limits<F>::infinity();
+      F sum = 0;
+      for (U i = std::max(chart.first(j), U(1)); i < j; i++) {
+        if (! chart.allowed(i, j))
+          continue;
+        F logp = bigram_logscore(lex, chart, i, j, k, temperature)
+          + chart.cell(i, j);
+        if (logp > max) {
+          sum = sum * exp(max - logp) + 1;
+          max = logp;
+        }
+        else {
+          sum += exp(logp - max);
+        }
       }
+      chart.cell(j, k) = max + log(sum);
     }
   }
-  // final word must be sentence boundary marker.
-  U m = _boundaries.size() -1;
-  j = _padded_possible.end() -1; // *j is _boundaries.size() -2
-  for (i = _padded_possible.begin()+1; i <j; i++) {
-    F prob = pow(lex(word_at(*i, *j),word_at(*j, m)), 1/temperature)
-      * best[*i][*j].first;
-    if (debug_level >=85000) TRACE5(*i,*j,m,word_at(*i, *j),word_at(*j, m));
-    if (debug_level >=85000) TRACE2(lex(word_at(*i, *j),word_at(*j, m)),prob);
-    best[*j][m].first += prob;
-    best[*j][m].second.push_back(Transition(prob, *i));
-  }
-  if (debug_level >= 70000) TRACE(best);
-  // now sample a segmentation
-  for (m = 2; m <_boundaries.size() -2; m++) {
+  // now sample a segmentation, going backwards from the end of the
+  // sentence: given the word (j, k), the start i of the word before
+  // it is drawn with probability exp(score(i, j, k) + cell(i, j) -
+  // cell(j, k))
+  for (U m = 2; m <_boundaries.size() -2; m++) {
     _boundaries[m] = false;
   }
-  m = _boundaries.size() -2;
-  U n = _boundaries.size() -1;
-  while (best[m][n].second[0].second > 0) {
-    // sample one of the transitions
-    F r = unif01()* best[m][n].first;
+  U j = n - 2;
+  U k = n - 1;
+  while (j > 1) {
+    F r = unif01();
     F total = 0;
-    for(const auto& item: best[m][n].second)
-    {
-        total += item.first;
-        if (r < total)
-        {
-            U previous = item.second;
-            _boundaries[previous] = true;
-            n = m;
-            m = previous;
-            break;
-        }
-    }
+    U i = std::max(chart.first(j), U(1));
+    for (; i < j - 1; i++) {
+      if (! chart.allowed(i, j))
+        continue;
+      total += exp(bigram_logscore(lex, chart, i, j, k, temperature)
+                   + chart.cell(i, j) - chart.cell(j, k));
+      if (r < total)
+        break;
+    }
+    _boundaries[p[i]] = true;
+    k = j;
+    j = i;
   }
-  _padded_possible.erase(_padded_possible.begin()); //ugh.
   if (debug_level >= 70000) TRACE(_boundaries);
 }
 
 void
-Sentence::score(Scoring& scoring) const {
+Sentence::score_reference(Scoring& scoring) const {
   scoring._sentences++;
-  scoring.add_words_to_lexicon(get_segmented_words(),
-		       scoring._segmented_lex);
-  scoring.add_words_to_lexicon(get_reference_words(),
-		       scoring._reference_lex);
-  // calculate number of correct words, segmented words,
-  // and reference words and add to totals
-  const Bs& segmented = _boundaries;
+  for(const auto& word: get_reference_words())
+    scoring._reference_lex.inc(word);
+  // calculate number of reference words and boundaries and add to
+  // totals
+  const Bs& ref = _true_boundaries;
+  U r = 2; //start after eos and beginning of 1st word
+  while (r < ref.size()-1) {
+    if (ref[r]) {
+      scoring._reference_words++;
+      scoring._reference_bs++;
+    }
+    r++;
+  }
+  //subtract right utt boundary
+  scoring._reference_bs--;
+  if (debug_level >=60000) TRACE2(scoring._reference_bs, scoring._reference_words);
+}
+
+void
+Sentence::score_segmentation(Scoring& scoring, const Bs& boundaries, I sign) const {
+  for(const auto& word: get_words(boundaries)) {
+    if (sign > 0)
+      scoring.add_segmented_word(word);
+    else
+      scoring.remove_segmented_word(word);
+  }
+  // calculate number of correct words and boundaries, and of
+  // segmented words and boundaries, and add them to (or remove them
+  // from) the totals
+  const Bs& segmented = boundaries;
   const Bs& ref = _true_boundaries;
   assert(segmented.size() == ref.size());
   if (debug_level >=50000) TRACE2(segmented, ref);
@@ -651,35 +703,30 @@ Sentence::score(Scoring& scoring) const {
   bool left_match = 1;
   while (s < segmented.size()-1) {
     if (segmented[s] && ref[r]) {
-      scoring._bs_correct++;
-      scoring._segmented_bs++;
-      scoring._reference_bs++;
+      scoring._bs_correct += sign;
+      scoring._segmented_bs += sign;
       if (left_match) {
-	scoring._words_correct++;
+	scoring._words_correct += sign;
       }
       left_match = 1;
-      scoring._segmented_words++;
-      scoring._reference_words++;
+      scoring._segmented_words += sign;
     }
     else if (segmented[s]) {
-      scoring._segmented_words++;
-      scoring._segmented_bs++;
+      scoring._segmented_words += sign;
+      scoring._segmented_bs += sign;
       left_match = 0;
     }
     else if (ref[r]) {
-      scoring._reference_words++;
-      scoring._reference_bs++;
       left_match = 0;
     }
     s++;
     r++;
   }
   //subtract right utt boundary
-  scoring._bs_correct--;
-  scoring._segmented_bs--;
-  scoring._reference_bs--;
-  if (debug_level >=60000) TRACE3(scoring._bs_correct, scoring._segmented_bs, scoring._reference_bs);
-  if (debug_level >=60000) TRACE3(scoring._words_correct, scoring._segmented_words, scoring._reference_words);
+  scoring._bs_correct -= sign;
+  scoring._segmented_bs -= sign;
+  if (debug_level >=60000) TRACE2(scoring._bs_correct, scoring._segmented_bs);
+  if (debug_level >=60000) TRACE2(scoring._words_correct, scoring._segmented_words);
 }
 
 ///////////////////////////////////////////////////////////////
@@ -830,7 +877,7 @@ Sentence::mbdp_prob(Unigrams& lex, const S& word, U nsentences) const {
     const F pi = 4.0*atan(1.0);
     F l_frac = (types - 1)/types;
     F total_base = base(word);
-    Unigrams::WordTypes items = lex.types();
+    const Unigrams::WordTypes& items = lex.types();
     for(const auto& item: items)
     {
       total_base += base(item.first);
@@ -845,3 +892,70 @@ Sentence::mbdp_prob(Unigrams& lex, const S& word, U nsentences) const {
 
   return prob;
 }
+
+// log score of the word spanning characters i..j in the unigram
+// dynamic programs, annealed at the given temperature
+F
+Sentence::unigram_logscore(Unigrams& lex, U i, U j, U nsentences,
+                           F log_p_continue, F temperature, bool do_mbdp) const {
+  F logp;
+  if (do_mbdp) {
+    F mbdp_p = mbdp_prob(lex, word_at(i, j), nsentences);
+    logp = log(mbdp_p) / temperature;
+    if (debug_level >=85000) TRACE4(i,j,word_at(i, j),mbdp_p);
+  }
+  else {
+    F p = lex(word_at(i, j));
+    logp = log(p) / temperature + log_p_continue;
+    if (debug_level >=85000) TRACE4(i,j,word_at(i, j),p);
+  }
+  return logp;
+}
+
+// log score of the word spanning chart positions j..k after the
+// word spanning i..j in the bigram dynamic programs, annealed at the
+// given temperature. The ids of both words and the unigram
+// probability of the word j..k are read from the chart.
+F
+Sentence::bigram_logscore(const Bigrams& lex, Chart& chart, U i, U j, U k, F temperature) const {
+  const Us& pos = chart.positions();
+  F p = lex.prob(chart.cell_id(i, j), chart.cell_id(j, k), chart.cell_prob(j, k));
+  chart.count_lookup();
+  if (debug_level >=85000) TRACE5(pos[i],pos[j],pos[k],word_at(pos[i], pos[j]),word_at(pos[j], pos[k]));
+  if (debug_level >=85000) TRACE(p);
+  return log(p) / temperature;
+}
+
+// fills the chart positions for the bigram dynamic programs: the
+// sentence start marker, _padded_possible and the sentence end
+// marker. The unigram probability of each word that can follow
+// another one is memoized in the chart, since the bigram programs
+// look it up once for every preceding word, and so is the id of each
+// word, so that the bigram lexicon is not hashed in the inner loop
+// either. Returns the number of positions.
+U
+Sentence::bigram_positions(const Bigrams& lex, Chart& chart) const {
+  Us& p = chart.positions();
+  p.clear();
+  p.push_back(0);
+  p.insert(p.end(), _padded_possible.begin(), _padded_possible.end());
+  p.push_back(_boundaries.size() - 1);
+  chart.reset(_constants->max_word_length);
+
+  const U n = p.size();
+  const Interner<S>& ids = lex.base_dist().ids();
+  chart.cell_id(0, 1) = ids.find(word_at(p[0], p[1]));
+  for (U k = 2; k < n; k++) {
+    // final word must be sentence boundary marker.
+    const U j0 = (k == n - 1) ? n - 2 : std::max(chart.first(k), U(1));
+    for (U j = j0; j < k; j++) {
+      if (chart.allowed(j, k)) {
+        const S word = word_at(p[j], p[k]);
+        chart.cell_prob(j, k) = lex.base_dist()(word);
+        chart.cell_id(j, k) = ids.find(word);
+        chart.count_computed();
+      }
+    }
+  }
+  return n;
+}
@@ -1,8 +1,12 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <locale>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 
@@ -25,9 +29,9 @@
 // code (with 'extern' declarations). This is bad (source of bugs,
 // hard to read/debug). Use parameters instead.
 
-uniform01_type unif01;     // random number generator
-unsigned int debug_level;  // higher -> mode debug messages on stdout
-std::wstring sep;          // separator used to separate fields during printing of results
+thread_local uniform01_type unif01;  // random number generator, one per thread
+unsigned int debug_level;            // higher -> mode debug messages on stdout
+std::wstring sep;                    // separator used to separate fields during printing of results
 
 
 std::wstring str2wstr(std::string str)
@@ -59,7 +63,7 @@ Model* get_sampler(CorpusData* data,
     }
 
     // make sure the estimator is valid
-    std::vector<std::string> estimators = {"F", "V", "T", "D"};
+    std::vector<std::string> estimators = {"F", "V", "T", "D", "B"};
     if(std::find(estimators.begin(), estimators.end(), estimator) == estimators.end())
     {
         std::cerr << "Error: " << estimator << " is not a valid estimator" << std::endl;
@@ -79,6 +83,10 @@ Model* get_sampler(CorpusData* data,
             std::cerr
                 << "D(ecayed Flip) estimator cannot be used in batch mode."
                 << std::endl;
+        else if(estimator == "B")
+            std::cerr
+                << "Error: B(lock) estimator cannot be used with bigrams."
+                << std::endl;
     }
 
     // bigram online sampler
@@ -101,6 +109,10 @@ Model* get_sampler(CorpusData* data,
 
             sampler = new OnlineBigramDecayedMCMC(data, forget_rate, decay_rate, samples_per_utt);
         }
+        else if(estimator == "B")
+            std::cerr
+                << "Error: B(lock) estimator cannot be used in online mode."
+                << std::endl;
     }
     else if(ngram == 1 and mode == "batch")
     {
@@ -112,6 +124,8 @@ Model* get_sampler(CorpusData* data,
             sampler = new BatchUnigramTreeSampler(data);
         else if(estimator == "D")
             std::cerr << "D(ecayed Flip) estimator cannot be used in batch mode." << std::endl;
+        else if(estimator == "B")
+            sampler = new BatchUnigramTypeSampler(data);
     }
 
     else if(ngram == 1 and mode == "online")
@@ -134,11 +148,85 @@ Model* get_sampler(CorpusData* data,
 
             sampler = new OnlineUnigramDecayedMCMC(data, forget_rate, decay_rate, samples_per_utt);
         }
+        else if(estimator == "B")
+            std::cerr
+                << "Error: B(lock) estimator cannot be used in online mode."
+                << std::endl;
     }
 
     return sampler;
 }
 
+//! run_subject() simulates a single subject, i.e. an independent
+//! chain over the shared (read-only) corpus. The sampler is built in
+//! the calling thread so that its lexicons draw from that thread's
+//! random number generator, which must be seeded beforehand. Traces
+//! and scores go to `log`, the final segmentation to `os`.
+void run_subject(CorpusData* data, const boost::program_options::variables_map& vm,
+                 const std::string& eval_file, std::wostream& log, std::wostream& os)
+{
+    Model* sampler = get_sampler(
+        data,
+        vm["ngram"].as<unsigned int>(),
+        vm["mode"].as<std::string>(),
+        vm["estimator"].as<std::string>(),
+        vm["forget-rate"].as<F>(),
+        vm["decay-rate"].as<F>(),
+        vm["samples-per-utt"].as<U>());
+
+    if (sampler == NULL)
+        exit(1);
+
+    if (vm.count("load-state") > 0)
+        sampler->load_state(vm["load-state"].as<std::string>());
+
+    // scores printing changes the precision of the log stream, restore
+    // it at the end so that all the subjects are logged the same way
+    const std::streamsize precision = log.precision();
+
+    log << "initial probability = " << sampler->log_posterior() << std::endl;
+    assert(sampler->sanity_check());
+
+    // if want to evaluate test set during training intervals, need to add
+    // that into estimate function
+    sampler->estimate(
+        data->burnin_iterations, log, vm["eval-interval"].as<U>(),
+        1, vm["eval-maximize"].as<U>(), true);
+
+    if (! data->save_state.empty())
+        sampler->save_state(data->save_state);
+
+    // evaluates test set at the end of training
+    if (eval_file == "none")
+    {
+        sampler->print_segmented(os);
+        sampler->print_scores(log);
+        log << "final posterior = " << sampler->log_posterior() << std::endl;
+    }
+    else
+    {
+        if (debug_level >= 5000)
+        {
+            log << "segmented training data:" << std::endl;
+            sampler->print_segmented(log);
+            sampler->print_scores(log);
+            log << "training final posterior = " << sampler->log_posterior() << std::endl;
+            log << "segmented test data:" << std::endl;
+        }
+
+        log << "Test set at end of training " << std::endl;
+        sampler->run_eval(os,1,vm["eval-maximize"].as<U>());
+
+        log << "testing final posterior = " << sampler->log_posterior() << std::endl;
+        sampler->print_eval_segmented(os);
+        sampler->print_eval_scores(log);
+    }
+    sampler->print_chart_statistics(log);
+    log.precision(precision);
+    os << std::endl;
+    delete sampler;
+}
+
 
 int main(int argc, char** argv)
 {
@@ -201,13 +289,21 @@ int main(int argc, char** argv)
          "(default) means to only evaluate the test set after all iterations "
          "are complete.w")
 
+        ("eval-threads", po::value<U>(&data.eval_threads)->default_value(1),
+         "Number of threads segmenting the test set in parallel. With 1 the test "
+         "set is sampled from the model's random stream as in previous versions. "
+         "With more, each test utterance is sampled from its own random stream, "
+         "so the output does not depend on the number of threads beyond 1")
+
         ("output-file,o", po::value<std::string>(),
          "segmented output file")
 
         ("estimator", po::value<std::string>()->default_value("F"),
-         "possible values are: V(iterbi), F(lip), T(ree), D(ecayed Flip). "
-         "Viterbi does dynamic programming maximization, Tree does dynamic "
-         "programming sampling, Flip does original Gibbs sampler.")
+         "possible values are: V(iterbi), F(lip), T(ree), D(ecayed Flip), "
+         "B(lock). Viterbi does dynamic programming maximization, Tree does "
+         "dynamic programming sampling, Flip does original Gibbs sampler, "
+         "Block samples jointly the boundaries sharing the same surrounding "
+         "words (batch unigram only).")
 
         ("decay-rate", po::value<F>()->default_value(1.0),
          "decay rate for D(ecayed Flip), default = 1.0")
@@ -257,6 +353,10 @@ int main(int argc, char** argv)
         ("init-pboundary", po::value<F>(&data.init_pboundary)->default_value(0),
          "Initial segmentation boundary probability (-1 = gold)")
 
+        ("max-word-length", po::value<U>(&data.max_word_length)->default_value(0),
+         "Maximum number of characters in a word for the V(iterbi) and "
+         "T(ree) estimators, bounds the dynamic programs (0 = no limit)")
+
         ("pya-beta-a", po::value<F>(&data.pya_beta_a)->default_value(1),
          "if non-zero, a parameter of Beta prior on pya")
 
@@ -277,9 +377,29 @@ int main(int argc, char** argv)
         ("trace-every", po::value<U>(&data.trace_every)->default_value(100),
          "Epochs between printing out trace information (0 = don't trace)")
 
+        ("save-state", po::value<std::string>(&data.save_state)->default_value(""),
+         "Binary file where to save the sampler state at the end of training, "
+         "to be resumed with --load-state (batch mode and one subject only)")
+
+        ("save-state-every", po::value<U>(&data.save_state_every)->default_value(0),
+         "Epochs between saving the sampler state to the --save-state file "
+         "(0 = only at the end of training)")
+
+        ("load-state", po::value<std::string>(),
+         "Binary file from which to resume the sampler state saved by "
+         "--save-state. The data and the model options must be the same, the "
+         "training goes on until --burnin-iterations is reached.")
+
         ("nsubjects,s", po::value<U>()->default_value(1),
          "Number of subjects to simulate")
 
+        ("nchains", po::value<U>(),
+         "Number of independent chains to run, alias of --nsubjects")
+
+        ("threads", po::value<U>()->default_value(1),
+         "Number of subjects (chains) simulated in parallel. Subject s is "
+         "seeded with randseed + s so the output does not depend on this")
+
         ("forget-rate,f", po::value<F>()->default_value(0),
          "Number of utterances whose words can be remembered")
 
@@ -363,6 +483,7 @@ int main(int argc, char** argv)
             << "# eval-num-sents=" << vm["eval-num-sents"].as<U>() << std::endl
             << "# eval-maximize=" << vm["eval-maximize"].as<U>() << std::endl
             << "# eval-interval=" <<vm["eval-interval"].as<U>() << std::endl
+            << "# eval-threads=" << data.eval_threads << std::endl
             << "# output-file=" << str2wstr(vm["output-file"].as<std::string>()) << std::endl
             << "# estimator=" << str2wstr(vm["estimator"].as<std::string>()) << std::endl
             << "# decay_rate=" << vm["decay-rate"].as<F>() << std::endl
@@ -378,13 +499,17 @@ int main(int argc, char** argv)
             << "# hypersamp-ratio=" << data.hypersampling_ratio << std::endl
             << "# aeos=" << data.aeos << std::endl
             << "# init_pboundary=" << vm["init-pboundary"].as<F>() << std::endl
+            << "# max-word-length=" << data.max_word_length << std::endl
             << "# pya-beta-a="  << data.pya_beta_a << std::endl
             << "# pya-beta-b="  << data.pya_beta_b << std::endl
             << "# pyb-gamma-s="  << data.pyb_gamma_s << std::endl
             << "# pyb-gamma-c="  << data.pyb_gamma_c << std::endl
             << "# randseed=" << vm["randseed"].as<U>() << std::endl
             << "# trace-every=" << data.trace_every << std::endl
+            << "# save-state=" << str2wstr(data.save_state) << std::endl
+            << "# save-state-every=" << data.save_state_every << std::endl
             << "# nsubjects=" << vm["nsubjects"].as<U>() << std::endl
+            << "# threads=" << vm["threads"].as<U>() << std::endl
             << "# forget-rate=" << vm["forget-rate"].as<F>() << std::endl
             << "# burnin-iterations=" << data.burnin_iterations << std::endl
             << "# anneal-iterations=" << data.anneal_iterations << std::endl
@@ -395,39 +520,43 @@ int main(int argc, char** argv)
             << "# result-field-separator=" << sep << std::endl;
     }
 
-    unif01.seed(vm["randseed"].as<U>());
-
-    // read training data
+    // read training data, the input files are decoded from UTF-8 in
+    // one go (much faster than through std::wifstream)
+    auto load_start = std::chrono::steady_clock::now();
     if (data_file != "stdin")
     {
-        std::wifstream is(data_file.c_str());
+        std::ifstream is(data_file.c_str(), std::ios::binary);
         if (!is)
         {
             std::cerr << "Error: couldn't open " << data_file << std::endl;
             exit(1);
         }
-        // is.imbue(std::locale(std::locale(), new utf8_codecvt_facet()));
 
-        data.read(is, vm["data-start-index"].as<U>(), vm["data-num-sents"].as<U>());
+        data.read(read_utf8(is), vm["data-start-index"].as<U>(), vm["data-num-sents"].as<U>());
     }
     else
     {
-        data.read(std::wcin, vm["data-start-index"].as<U>(), vm["data-num-sents"].as<U>());
+        data.read(read_utf8(std::cin), vm["data-start-index"].as<U>(), vm["data-num-sents"].as<U>());
     }
 
     // read evaluation data
     if (eval_file !=  "none")
     {
-        std::wifstream is(eval_file.c_str());
+        std::ifstream is(eval_file.c_str(), std::ios::binary);
         if (!is)
         {
             std::cerr << "Error: couldn't open " << eval_file << std::endl;
             exit(1);
         }
-        // is.imbue(std::locale(std::locale(), new utf8_codecvt_facet()));
-        data.read_eval(is,vm["eval-start-index"].as<U>(),vm["eval-num-sents"].as<U>());
+
+        data.read_eval(read_utf8(is), vm["eval-start-index"].as<U>(), vm["eval-num-sents"].as<U>());
     }
 
+    std::wcout << "data loading time = "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - load_start).count()
+               << " ms (" << S::data.size() << " chars)" << std::endl;
+
     if (debug_level >= 98000) {
         TRACE(S::data.size());
         TRACE(S::data);
@@ -454,52 +583,55 @@ int main(int argc, char** argv)
     }
     // os.imbue(utf8_locale);
 
-    for(unsigned int subject = 0; subject < vm["nsubjects"].as<unsigned int>(); subject++)
+    const U nsubjects = vm.count("nchains") > 0 ?
+        vm["nchains"].as<U>() : vm["nsubjects"].as<U>();
+    const U nthreads = std::max(1u, std::min(vm["threads"].as<U>(), nsubjects));
+
+    if ((vm.count("load-state") > 0 or ! data.save_state.empty())
+        and (nsubjects != 1 or vm["mode"].as<std::string>() != "batch"))
+    {
+        std::cerr << "Error: --save-state and --load-state require batch mode "
+                  << "and a single subject" << std::endl;
+        exit(1);
+    }
+    const U randseed = vm["randseed"].as<U>();
+
+    if (nthreads == 1)
     {
-        Model* sampler = get_sampler(
-            &data,
-            vm["ngram"].as<unsigned int>(),
-            vm["mode"].as<std::string>(),
-            vm["estimator"].as<std::string>(),
-            vm["forget-rate"].as<F>(),
-            vm["decay-rate"].as<F>(),
-            vm["samples-per-utt"].as<U>());
-
-        std::wcout << "initial probability = " << sampler->log_posterior() << std::endl;
-        assert(sampler->sanity_check());
-
-        // if want to evaluate test set during training intervals, need to add
-        // that into estimate function
-        sampler->estimate(
-            data.burnin_iterations, std::wcout, vm["eval-interval"].as<U>(),
-            1, vm["eval-maximize"].as<U>(), true);
-
-        // evaluates test set at the end of training
-        if (eval_file == "none")
+        for(U subject = 0; subject < nsubjects; subject++)
         {
-            sampler->print_segmented(os);
-            sampler->print_scores(std::wcout);
-            std::wcout << "final posterior = " << sampler->log_posterior() << std::endl;
+            unif01.seed(randseed + subject);
+            run_subject(&data, vm, eval_file, std::wcout, os);
         }
-        else
-        {
-            if (debug_level >= 5000)
+    }
+    else
+    {
+        // each subject logs and segments into its own buffers, flushed
+        // in subject order once all the threads are done so that the
+        // output does not depend on the scheduling
+        std::vector<std::wostringstream> logs(nsubjects);
+        std::vector<std::wostringstream> segmentations(nsubjects);
+
+        std::atomic<U> next_subject(0);
+        std::vector<std::thread> workers;
+        for(U t = 0; t < nthreads; t++)
+            workers.emplace_back([&]()
             {
-                std::wcout << "segmented training data:" << std::endl;
-                sampler->print_segmented(std::wcout);
-                sampler->print_scores(std::wcout);
-                std::wcout << "training final posterior = " << sampler->log_posterior() << std::endl;
-                std::wcout << "segmented test data:" << std::endl;
-            }
-
-            std::wcout << "Test set at end of training " << std::endl;
-            sampler->run_eval(os,1,vm["eval-maximize"].as<U>());
-
-            std::wcout << "testing final posterior = " << sampler->log_posterior() << std::endl;
-            sampler->print_eval_segmented(os);
-            sampler->print_eval_scores(std::wcout);
+                for(U subject = next_subject++; subject < nsubjects; subject = next_subject++)
+                {
+                    logs[subject].precision(std::wcout.precision());
+                    unif01.seed(randseed + subject);
+                    run_subject(&data, vm, eval_file, logs[subject], segmentations[subject]);
+                }
+            });
+
+        for(auto& worker: workers)
+            worker.join();
+
+        for(U subject = 0; subject < nsubjects; subject++)
+        {
+            std::wcout << logs[subject].str();
+            os << segmentations[subject].str();
         }
-        os << std::endl;
-        delete sampler;
     }
 }